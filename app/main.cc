@@ -3,10 +3,14 @@
 #include <iostream>
 #include <fstream>
 #include <filesystem>
+#include <exception>
 #include <tclap/CmdLine.h>
 #include <tclap/Arg.h>
+#include <tclap/ValuesConstraint.h>
 #include <bigWigs2tensors/util.h>
 #include <bigWigs2tensors/proc_bigWigs.h>
+#include <bigWigs2tensors/log.h>
+#include <bigWigs2tensors/mem_stats.h>
 
 /*!
 Merge all given paths and matching paths within given directories into a single vector and return it.
@@ -30,12 +34,34 @@ std::vector<std::string> parse_tracks_list(const std::vector<std::string>& track
 
 /*
  * Usage *
- bigWigs2tensors -r <resolution: unsigned int> [-c <coords BED: str>] -s <chrom sizes> -o <out-dir: str> -t <track: str> [-t <track: str> ...]
+ bigWigs2tensors -r <resolution: unsigned int> [-c <coords BED: str>] [-l <bins|tracks>] [-f <pt|npy|zarr|safetensors>] [--dtype <float32|float64>] [--mmap] -s <chrom sizes> -o <out-dir: str> -t <track: str> [-t <track: str> ...]
     * Options *
     track: a path to one of the bigWig files and/or directories containing bigWig files to bin over
     chrom sizes: one -s <path: str>
     _OPTIONAL_
-    coords BED: one -c <path: str> to a bed file specifying the genomic coordinates _within __every__ bigWig_ to bin over
+    coords BED: one -c <path: str> to a bigBed, BED, BED.gz or narrowPeak file specifying the genomic coordinates _within __every__ bigWig_ to bin over
+    layout: one -l <bins|tracks>, whether each chromosome's tensor is [bins, tracks] (default) or [tracks, bins]
+    format: one -f <pt|npy|zarr|safetensors|bsz|arrow|bigwig>, save pickled PyTorch tensors (default, only when built with libtorch), NumPy .npy arrays (default otherwise), a Zarr v2 group, safetensors, byte-shuffled zstd or zlib blocks, an Arrow IPC (Feather v2) file or a <track>.binned.bw bigWig per track
+        arrow: --batch-rows <n> bins per record batch
+        zarr: --chunk-bins <n> --chunk-tracks <n> chunk grid, --zlib-level <0-9> chunk compression (default none)
+        bsz: --block-elems <n> elements per block, --bsz-codec <zstd|zlib> (default zstd), --bsz-level <n> its level (default 1), compression ratio and throughput reported with -v
+        safetensors: --per-chrom-files for one file per chromosome rather than a single binned.safetensors
+        npy: -g/--genome-wide for a single genome.npy [total bins, tracks] plus a genome_index.tsv of interval rows
+    dtype: one --dtype <float32|float64>, element type of the saved arrays (default float64)
+    windows: -w/--windows, also write [windows, length, tracks] shards of shuffled windows to <out dir>/windows, written as each chromosome is binned,
+        --window-length <bins> --window-stride <bins>, --holdout <chrom> (repeatable) for holdout shards, --windows-per-shard <n>, --shuffle-seed <n>
+    sparse: with -f npy, --sparse-density <fraction> to store each chromosome's mostly 0 or NaN tracks in <chrom>.sparse/ as CSC-like columns
+    quantize: with -f npy, one --quantize <uint8|uint16|int16> to save integer codes instead, NaN as the reserved max (min for int16) code,
+        --quant-transform <linear|log1p> and --quant-range <data|header>, per-track parameters in quantization.json
+    mmap: --mmap, with -f npy, preallocate each chromosome's .npy and bin directly into its memory mapping
+    regions: --summit-flank <bp>, with -c a BED or narrowPeak file and -f npy, instead bin a window of flank bases either side of each
+        peak's summit into regions.npy, [regions, 2 * flank / resolution, tracks] in the file's order, with regions_index.tsv
+    exclude: --exclude <path> (repeatable) to a bigBed, BED or BED.gz of regions, e.g. a blacklist, never fetched,
+        --exclude-mode <drop|mask> to cut them out of the intervals (default) or keep their bins as NaN (always with --summit-flank)
+    fetch gap: --fetch-gap <bp>, coalesce the fetches of intervals whose bins are at most this far apart (default 0, only overlapping
+        or adjacent ones), for dense sets of peaks
+    max memory: --max-memory <size, e.g. 64G>, with -f npy, bin ranges of bins at a time with at most this much in flight,
+        streaming each range into its chromosome's .npy, for outputs larger than memory
 */
 
 int main(int argc, char** argv) {
@@ -46,16 +72,78 @@ int main(int argc, char** argv) {
         // TCLAP::UnlabeledMultiArg<std::string> tracks("tracks", "bigWig files to bin", true, "name: str path: str", cmd);
         TCLAP::MultiArg<std::string> tracks_list("t", "tracks-list", "a list of paths of bigWig files and/or directories containing bigWig files to bin over", true, "path (string)", cmd);
         TCLAP::ValueArg<std::string> chrom_sizes("s", "chrom-sizes", "chromosome sizes file", true, "", "path (string)", cmd);
-        TCLAP::ValueArg<std::string> coords_bed("c", "coords-bigBed", "bigBed file of genomic coordinates within all bigWigs to bin over", false, "", "path (string)", cmd);
+        TCLAP::ValueArg<std::string> coords_bed("c", "coords-bigBed", "bigBed, BED, BED.gz or narrowPeak file of genomic coordinates within all bigWigs to bin over", false, "", "path (string)", cmd);
+        std::vector<std::string> layouts {"bins", "tracks"};
+        TCLAP::ValuesConstraint<std::string> layouts_constr(layouts);
+        TCLAP::ValueArg<std::string> layout("l", "layout", "layout of each chromosome's tensor: bin-major [bins, tracks] or track-major [tracks, bins]", false, "bins", &layouts_constr, cmd);
+#ifdef BIGWIGS2TENSORS_WITH_TORCH
+        std::vector<std::string> formats {"pt", "npy", "zarr", "safetensors", "bsz", "arrow", "bigwig"};
+        const std::string default_format = "pt";
+#else
+        // built without libtorch, no .pt output
+        std::vector<std::string> formats {"npy", "zarr", "safetensors", "bsz", "arrow", "bigwig"};
+        const std::string default_format = "npy";
+#endif
+        TCLAP::ValuesConstraint<std::string> formats_constr(formats);
+        TCLAP::ValueArg<std::string> format("f", "format", "output file format: pickled PyTorch tensors, NumPy arrays, a Zarr v2 group of chunked arrays, safetensors, byte-shuffled compressed blocks, an Arrow IPC file or a binned bigWig per track", false, default_format, &formats_constr, cmd);
+        TCLAP::ValueArg<size_t> chunk_bins("", "chunk-bins", "zarr: bins per chunk", false, 16384, "unsigned int", cmd);
+        TCLAP::ValueArg<size_t> chunk_tracks("", "chunk-tracks", "zarr: tracks per chunk", false, 64, "unsigned int", cmd);
+        TCLAP::ValueArg<int> zlib_level("", "zlib-level", "zarr: zlib compression level (1-9) of each chunk, 0 for uncompressed", false, 0, "int", cmd);
+        TCLAP::ValueArg<size_t> block_elems("", "block-elems", "bsz: elements per compressed block", false, 1 << 16, "unsigned int", cmd);
+        TCLAP::ValueArg<size_t> batch_rows("", "batch-rows", "arrow: most bins per record batch", false, 1 << 16, "unsigned int", cmd);
+        TCLAP::ValueArg<int> bsz_level("", "bsz-level", "bsz: compression level of each block, zstd's (1-22) or zlib's (0-9)", false, 1, "int", cmd);
+        std::vector<std::string> bsz_codecs {"zstd", "zlib"};
+        TCLAP::ValuesConstraint<std::string> bsz_codecs_constr(bsz_codecs);
+        TCLAP::ValueArg<std::string> bsz_codec("", "bsz-codec", "bsz: codec of each block", false, "zstd", &bsz_codecs_constr, cmd);
+        std::vector<std::string> dtypes {"float32", "float64"};
+        TCLAP::ValuesConstraint<std::string> dtypes_constr(dtypes);
+        TCLAP::ValueArg<std::string> dtype("", "dtype", "element type of the output", false, "float64", &dtypes_constr, cmd);
+        TCLAP::SwitchArg windows("w", "windows", "also cut the binned chromosomes into shuffled, sharded training windows in <out dir>/windows", cmd, false);
+        TCLAP::ValueArg<unsigned> window_length("", "window-length", "windows: bins per window", false, 1024, "unsigned int", cmd);
+        TCLAP::ValueArg<unsigned> window_stride("", "window-stride", "windows: bins between window starts", false, 1024, "unsigned int", cmd);
+        TCLAP::MultiArg<std::string> holdout("", "holdout", "windows: chromosome whose windows go to the holdout shards", false, "chrom (string)", cmd);
+        TCLAP::ValueArg<size_t> windows_per_shard("", "windows-per-shard", "windows: most windows in a shard", false, 4096, "unsigned int", cmd);
+        TCLAP::ValueArg<uint64_t> shuffle_seed("", "shuffle-seed", "windows: seed of the window shuffle", false, 0, "unsigned int", cmd);
+        TCLAP::ValueArg<double> sparse_density("", "sparse-density", "npy: store a chromosome's tracks with fewer than this fraction of non-empty bins as sparse columns", false, 0, "fraction", cmd);
+        std::vector<std::string> quant_dtypes {"none", "uint8", "uint16", "int16"};
+        TCLAP::ValuesConstraint<std::string> quant_dtypes_constr(quant_dtypes);
+        TCLAP::ValueArg<std::string> quantize("", "quantize", "npy: save integer codes with per-track scale and offset in quantization.json", false, "none", &quant_dtypes_constr, cmd);
+        std::vector<std::string> quant_transforms {"linear", "log1p"};
+        TCLAP::ValuesConstraint<std::string> quant_transforms_constr(quant_transforms);
+        TCLAP::ValueArg<std::string> quant_transform("", "quant-transform", "quantize values as they are or after sign(x)*log1p(|x|)", false, "linear", &quant_transforms_constr, cmd);
+        std::vector<std::string> quant_ranges {"data", "header"};
+        TCLAP::ValuesConstraint<std::string> quant_ranges_constr(quant_ranges);
+        TCLAP::ValueArg<std::string> quant_range("", "quant-range", "per-track range to quantize over: of the binned values, or the bigWig header's min and max", false, "data", &quant_ranges_constr, cmd);
+        TCLAP::SwitchArg per_chrom_files("", "per-chrom-files", "safetensors: write one file per chromosome instead of a single file", cmd, false);
+        TCLAP::SwitchArg genome_wide("g", "genome-wide", "npy: write one genome.npy of all chromosomes' bins concatenated, plus a genome_index.tsv of each interval's rows", cmd, false);
+        TCLAP::SwitchArg mmap_out("", "mmap", "bin straight into memory-mapped .npy files in the output directory, requires -f npy", cmd, false);
+        TCLAP::ValueArg<std::string> max_memory("", "max-memory", "bin within this budget of buffered values (K/M/G/T suffixes), streaming into the .npy files in the output directory, requires -f npy", false, "", "size (string)", cmd);
+        TCLAP::ValueArg<unsigned> summit_flank("", "summit-flank", "bin a window of this many bases either side of each summit of the -c BED or narrowPeak file into regions.npy, requires -f npy", false, 0, "unsigned int", cmd);
+        TCLAP::MultiArg<std::string> exclude("", "exclude", "bigBed, BED or BED.gz file of regions to leave out of binning, e.g. a blacklist", false, "path (string)", cmd);
+        std::vector<std::string> exclude_modes {"drop", "mask"};
+        TCLAP::ValuesConstraint<std::string> exclude_modes_constr(exclude_modes);
+        TCLAP::ValueArg<std::string> exclude_mode("", "exclude-mode", "drop excluded regions from the intervals binned, or keep their bins as NaN", false, "drop", &exclude_modes_constr, cmd);
+        TCLAP::ValueArg<unsigned> fetch_gap("", "fetch-gap", "read intervals whose bins are at most this many bases apart in one fetch per track, gaps included", false, 0, "unsigned int", cmd);
+        TCLAP::ValueArg<std::string> mem_report("", "mem-report", "write peak memory by stage and buffer pool to this JSON file at exit (also summarized with -v)", false, "", "path (string)", cmd);
         TCLAP::UnlabeledValueArg<std::string> out_dir("out-dir", "directory to write binned tensors to", true, "", "path (string)", cmd);
-        TCLAP::SwitchArg verbose("v" , "verbose", "print verbose output", cmd, false);
+        TCLAP::SwitchArg verbose("v" , "verbose", "print verbose output, same as --log-level info", cmd, false);
+        std::vector<std::string> log_levels {"trace", "debug", "info", "warn", "error", "off"};
+        TCLAP::ValuesConstraint<std::string> log_levels_constr(log_levels);
+        TCLAP::ValueArg<std::string> log_level("", "log-level", "lowest level of log messages to print (default warn); trace and debug only if compiled in", false, "warn", &log_levels_constr, cmd);
         cmd.parse(argc, argv);
 
+        if (log_level.isSet())
+            bwlog::set_level(bwlog::parse_level(log_level.getValue()));
+        else if (verbose.getValue())
+            bwlog::set_level(bwlog::Level::info);
+
         if (verbose.getValue()) {
             std::cout << "resolution: " << res.getValue() << std::endl;
             std::cout << "chrom sizes: " << chrom_sizes.getValue() << std::endl;
             std::cout << "coords bed: " << coords_bed.getValue() << std::endl;
             std::cout << "out dir: " << out_dir.getValue() << std::endl;
+            std::cout << "layout: " << layout.getValue() << std::endl;
+            std::cout << "format: " << format.getValue() << ", dtype: " << dtype.getValue() << std::endl;
 
             std::cout << tracks_list.getValue().size() << " track arguments given." << std::endl;
             std::cout << "tracks list: [\n";
@@ -97,33 +185,147 @@ int main(int argc, char** argv) {
         std::string chrom_sizes_path = chrom_sizes.getValue();
         std::map<std::string,int> chr_sizes_map = parse_chrom_sizes(chrom_sizes_path);
 
+        TensorLayout tens_layout = layout.getValue() == "tracks" ? TensorLayout::track_major : TensorLayout::bin_major;
+
         BWBinner* bwb = nullptr;
-        if (coords_bed.isSet()) {
-            std::cout << "Using specified coordinates bigBed..." << std::endl;
-            bwb = new BWBinner(bw_paths, chrom_sizes_path, coords_bed.getValue());
-            // std::cout << "Parsing coordinates bigBed..." << std::endl;
-            // coords_map = parse_coords_bigBed(coords_bed.getValue(), chr_sizes_map);
+        {
+            bwmem::Stage stage("open");
+            // the regions are read on their own, see below
+            if (coords_bed.isSet() && !summit_flank.isSet()) {
+                BW_LOG_INFO("using specified coordinates bigBed...");
+                bwb = new BWBinner(bw_paths, chrom_sizes_path, coords_bed.getValue(), tens_layout);
+                // std::cout << "Parsing coordinates bigBed..." << std::endl;
+                // coords_map = parse_coords_bigBed(coords_bed.getValue(), chr_sizes_map);
+            }
+            else {
+                // coords_map = make_full_chroms_coords_map(chr_sizes_map);
+                bwb = new BWBinner(bw_paths, chrom_sizes_path, tens_layout);
+            }
         }
-        else {
-            // coords_map = make_full_chroms_coords_map(chr_sizes_map);
-            bwb = new BWBinner(bw_paths, chrom_sizes_path);
+
+        if (summit_flank.isSet() && (!coords_bed.isSet() || format.getValue() != "npy" || mmap_out.getValue() || max_memory.isSet()
+                                     || genome_wide.getValue() || quantize.getValue() != "none" || sparse_density.getValue() > 0
+                                     || windows.getValue())) {
+            std::cerr << "--summit-flank requires -c and -f npy, without --mmap, --max-memory, --genome-wide, --quantize, --sparse-density or --windows." << std::endl;
+            return 1;
+        }
+        if (genome_wide.getValue() && (format.getValue() != "npy" || mmap_out.getValue())) {
+            std::cerr << "--genome-wide requires -f npy, without --mmap." << std::endl;
+            return 1;
+        }
+        if (quantize.getValue() != "none" && (format.getValue() != "npy" || mmap_out.getValue())) {
+            std::cerr << "--quantize requires -f npy, without --mmap." << std::endl;
+            return 1;
+        }
+        if (mmap_out.getValue()) {
+            if (format.getValue() != "npy") {
+                std::cerr << "--mmap requires -f npy." << std::endl;
+                return 1;
+            }
+            bwb->map_binneds(out_dir.getValue(), parse_npy_dtype(dtype.getValue()));
         }
+        if (max_memory.isSet()) {
+            if (format.getValue() != "npy" || mmap_out.getValue() || genome_wide.getValue() || quantize.getValue() != "none"
+                || sparse_density.getValue() > 0 || windows.getValue()) {
+                std::cerr << "--max-memory requires -f npy, without --mmap, --genome-wide, --quantize, --sparse-density or --windows." << std::endl;
+                return 1;
+            }
+            bwb->limit_memory(out_dir.getValue(), parse_byte_size(max_memory.getValue()), parse_npy_dtype(dtype.getValue()));
+        }
+
+        // the regions are not intervals to cut excluded regions out of
+        ExcludeMode excl_mode = exclude_mode.getValue() == "mask" || summit_flank.isSet() ? ExcludeMode::mask : ExcludeMode::drop;
+        for (const std::string& exclude_path : exclude.getValue())
+            bwb->exclude(exclude_path, excl_mode);
+        bwb->coalesce_fetches(fetch_gap.getValue());
 
-        std::cout << "Binning bigWigs..." << std::endl;
-        auto binned = bwb->load_bin_all_chroms(res.getValue());
-        std::cout << "Done binning bigWigs: " << binned.size() << " chromosomes" << std::endl;
-        for (auto& [chrom, tensor] : binned) {
-            std::cout << chrom << ": " << tensor.sizes() << std::endl;
+        if (windows.getValue()) {
+            WindowOptions window_opts;
+            window_opts.length = window_length.getValue();
+            window_opts.stride = window_stride.getValue();
+            window_opts.holdout_chroms = holdout.getValue();
+            window_opts.windows_per_shard = windows_per_shard.getValue();
+            window_opts.seed = shuffle_seed.getValue();
+            window_opts.dtype = parse_npy_dtype(dtype.getValue());
+            bwb->shard_windows((std::filesystem::path(out_dir.getValue()) / "windows").string(), window_opts);
+        }
+
+        if (summit_flank.isSet()) {
+            std::vector<BedRegion> regions = parse_regions_bed(coords_bed.getValue(), chr_sizes_map);
+            NDArray binned;
+            {
+                bwmem::Stage stage("bin");
+                binned = bwb->bin_regions(regions, res.getValue(), summit_flank.getValue());
+            }
+            BW_LOG_INFO("writing " << regions.size() << " regions to " << out_dir.getValue() << "...");
+            {
+                bwmem::Stage stage("save");
+                bwb->save_regions(out_dir.getValue(), regions, binned, res.getValue(), summit_flank.getValue(),
+                                  parse_npy_dtype(dtype.getValue()));
+            }
         }
+        else {
+            BW_LOG_INFO("binning bigWigs...");
+            {
+                bwmem::Stage stage("bin");
+                const auto& binned = bwb->load_bin_all_chroms(res.getValue());
+                BW_LOG_INFO("done binning bigWigs: " << binned.size() << " chromosomes");
+                for (auto& [chrom, arr] : binned) {
+                    BW_LOG_INFO(chrom << ": [" << arr.rows() << ", " << arr.cols() << "]");
+                }
+            }
 
-        std::string save_path = out_dir.getValue();
-        std::cout << "Writing tensors to "<< save_path << "..." << std::endl;
-        bwb->save_binneds(save_path);
-        std::cout << "Done writing tensors to disk." << std::endl;
+            std::string save_path = out_dir.getValue();
+            BW_LOG_INFO("writing tensors to "<< save_path << "...");
+            OutputOptions out_opts;
+            if (format.getValue() == "npy")
+                out_opts.format = OutputFormat::npy;
+            else if (format.getValue() == "zarr")
+                out_opts.format = OutputFormat::zarr;
+            else if (format.getValue() == "safetensors")
+                out_opts.format = OutputFormat::safetensors;
+            else if (format.getValue() == "bsz")
+                out_opts.format = OutputFormat::bsz;
+            else if (format.getValue() == "arrow")
+                out_opts.format = OutputFormat::arrow;
+            else if (format.getValue() == "bigwig")
+                out_opts.format = OutputFormat::bigwig;
+            out_opts.dtype = parse_npy_dtype(dtype.getValue());
+            out_opts.chunk_bins = chunk_bins.getValue();
+            out_opts.chunk_tracks = chunk_tracks.getValue();
+            out_opts.zlib_level = zlib_level.getValue();
+            out_opts.block_elems = block_elems.getValue();
+            out_opts.bsz_level = bsz_level.getValue();
+            out_opts.bsz_codec = parse_bsz_codec(bsz_codec.getValue());
+            out_opts.batch_rows = batch_rows.getValue();
+            out_opts.per_chrom_files = per_chrom_files.getValue();
+            out_opts.genome_wide = genome_wide.getValue();
+            out_opts.sparse_density = sparse_density.getValue();
+            out_opts.quant = parse_quant_dtype(quantize.getValue());
+            out_opts.quant_transform = quant_transform.getValue() == "log1p" ? QuantTransform::log1p : QuantTransform::linear;
+            out_opts.quant_range = quant_range.getValue() == "header" ? QuantRange::header : QuantRange::data;
+            {
+                bwmem::Stage stage("save");
+                bwb->save_binneds(save_path, out_opts);
+            }
+            BW_LOG_INFO("done writing tensors to disk");
+        }
 
         delete bwb;
+        bwlog::flush();
+        // too long for a log message
+        if (bwlog::enabled(bwlog::Level::info))
+            bwmem::write_summary(std::cerr);
+        if (mem_report.isSet())
+            bwmem::write_json(mem_report.getValue());
     }
     catch (TCLAP::ArgException& e) {
         std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
     }
+    // the library's errors: bad arguments, unreadable or malformed inputs, failed writes
+    catch (const std::exception& e) {
+        bwlog::flush();
+        std::cerr << "error: " << e.what() << std::endl;
+        return 1;
+    }
 }
\ No newline at end of file
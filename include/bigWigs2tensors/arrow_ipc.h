@@ -0,0 +1,59 @@
+#ifndef ARROW_IPC_H
+#define ARROW_IPC_H
+
+#include <vector>
+#include <string>
+#include <filesystem>
+#include <cstdint>
+#include <bigWigs2tensors/npy.h>
+#include <bigWigs2tensors/atomic_file.h>
+
+class ArrowIpcWriter
+/*!
+Writes binned values as an Arrow IPC file (Feather v2) of one row per bin, with columns
+`chrom` (utf8), `start` and `end` (int64) and then one float column per track,
+in record batches. The flatbuffers metadata is encoded by hand, so no Arrow dependency is needed.
+Every buffer starts 64-byte aligned, so readers can memory-map the columns without copying,
+e.g. `pyarrow.ipc.open_file(pyarrow.memory_map(path))`. Missing values are NaN, not nulls.
+*/
+{
+public:
+    /*!
+    Creates the file at `path` and writes its schema.
+    Throws std::runtime_error if it cannot be written.
+    */
+    ArrowIpcWriter(const std::filesystem::path& path, const std::vector<std::string>& track_names, NpyDtype dtype);
+
+    /*!
+    Writes a record batch of `n_rows` bins of `chrom`, the `r`th spanning [starts[r], ends[r]),
+    with the value of track `t` at `data[r*row_stride + t*track_stride]`,
+    converted to the writer's dtype.
+    */
+    void write_batch(const std::string& chrom, const int64_t* starts, const int64_t* ends, size_t n_rows,
+                     const double* data, size_t row_stride, size_t track_stride);
+
+    /*!
+    Writes the footer, closing the file and moving it into place, and returns its digest.
+    A writer destroyed unclosed leaves no file behind. Throws std::runtime_error if writing failed.
+    */
+    FileDigest close();
+
+private:
+    // file offset, metadata length and body length of each record batch, for the footer
+    struct Block {
+        int64_t offset;
+        int32_t metadata_len;
+        int64_t body_len;
+    };
+
+    std::filesystem::path path;
+    AtomicOfstream out_F;
+    std::vector<std::string> track_names;
+    NpyDtype dtype;
+    std::vector<Block> batches;
+
+    // writes an encapsulated message, returning the length of its metadata
+    int32_t write_message(const std::string& metadata);
+};
+
+#endif
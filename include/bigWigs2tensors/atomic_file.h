@@ -0,0 +1,75 @@
+#ifndef ATOMIC_FILE_H
+#define ATOMIC_FILE_H
+
+#include <vector>
+#include <string>
+#include <ostream>
+#include <memory>
+#include <filesystem>
+#include <cstdint>
+
+/*!
+Size and CRC-32 (zlib's, as in gzip and zip) of a written file, a line of the manifest.
+*/
+struct FileDigest {
+    // relative to the output directory
+    std::string file;
+    uint64_t bytes = 0;
+    uint32_t crc32 = 0;
+};
+
+class AtomicOfstream : public std::ostream
+/*!
+An output stream to a file that only appears at its path once complete: bytes go to `<path>.tmp`
+through a large page-aligned buffer, with writes bigger than the buffer passed straight through
+from the caller's memory, and the CRC-32 is computed as they go. `commit` flushes, fsyncs and renames
+the file into place, so a crash leaves either the previous file or a stray .tmp, never a truncated file.
+If destroyed uncommitted, e.g. unwinding from an exception, the temporary file is removed.
+Seeking back (to patch a header) is supported, the checksum is then read back on commit.
+*/
+{
+public:
+    /*!
+    Creates `<path>.tmp`. Throws std::system_error if it cannot be created.
+    */
+    explicit AtomicOfstream(const std::filesystem::path& path);
+
+    // size of the write buffer, accounted to bwmem::Pool::serialization while the stream lives
+    static constexpr size_t buffer_bytes = 1 << 20;
+
+    /*!
+    Writes out what is buffered, fsyncs and renames the file to its path, returning its digest
+    with `file` set to the path's filename. Throws std::runtime_error if any write failed,
+    or std::system_error if fsync or rename fails.
+    */
+    FileDigest commit();
+
+    ~AtomicOfstream();
+
+private:
+    class Buffer;
+
+    std::filesystem::path path;
+    std::filesystem::path tmp_path;
+    std::unique_ptr<Buffer> buf;
+    bool committed = false;
+};
+
+/*!
+Digest of the file at `path`, read back in full, for files written by other means.
+*/
+FileDigest file_digest(const std::filesystem::path& path);
+
+/*!
+Fsyncs `tmp_path` and renames it to `path`, for files written by other means, e.g. libBigWig.
+Throws std::system_error on failure.
+*/
+void commit_file(const std::filesystem::path& tmp_path, const std::filesystem::path& path);
+
+/*!
+Writes `manifest.tsv` to `out_dir`, a line of file, size in bytes and hex CRC-32 per digest,
+sorted by file, then fsyncs the directory so the renames into it are on disk too.
+*/
+void write_manifest(const std::filesystem::path& out_dir, std::vector<FileDigest> digests);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef BED_H
+#define BED_H
+
+#include <map>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <bigWigs2tensors/util.h>
+
+/*!
+Reads the intervals of a plain-text BED file, BED3 or more columns, e.g. narrowPeak, or a gzipped one
+(detected from its contents, not its name), into an IntervalIndex per chromosome, like
+`parse_coords_bigBed` does a bigBed's.
+The file is memory-mapped (a gzipped one decompressed into memory first) and split at line breaks into
+a part per thread, each parsed in parallel. Each chromosome's intervals are sorted by start, then end.
+Intervals are clipped to their chromosome's size. Those on chromosomes not in `chrom_sizes`, or empty once
+clipped, are left out, and chromosomes without any intervals have no entry. Columns may be separated by
+tabs or spaces; blank lines and `#`, `track` and `browser` lines are skipped.
+Throws std::runtime_error if the file cannot be read, or std::invalid_argument, naming the line,
+if a line does not start with a chromosome, start and end.
+*/
+chroms_coords_map_t parse_coords_bed(const std::string& coords_bed_path, const std::map<std::string, int>& chrom_sizes);
+
+/*!
+A region to bin a fixed-width window around, see `BWBinner::bin_regions`: a peak's summit,
+0-based, on `chrom`, and its name.
+*/
+struct BedRegion {
+    std::string chrom;
+    uint32_t summit;
+    std::string name;
+};
+
+/*!
+Reads the regions of a plain-text or gzipped BED file, read as `parse_coords_bed` does, in the file's order.
+Each region's summit is its start plus narrowPeak's 10th column, the summit's offset, or where there is none
+(or it is -1) the middle of its interval, and its name is the 4th column, "." if missing.
+Regions on chromosomes not in `chrom_sizes`, or with summits past their chromosome's end, are left out.
+Throws as `parse_coords_bed` does, and std::invalid_argument if a summit offset is not a number, or is
+neither -1 nor within [0, end - start).
+*/
+std::vector<BedRegion> parse_regions_bed(const std::string& regions_bed_path, const std::map<std::string, int>& chrom_sizes);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef BIGWIG_OUT_H
+#define BIGWIG_OUT_H
+
+#include <vector>
+#include <map>
+#include <string>
+#include <filesystem>
+#include <cstdint>
+#include <bigWigs2tensors/atomic_file.h>
+
+/*!
+A run of consecutive bins of one track to write to a bigWig: `n` bins of `bin_size` from
+`start` on `chrom`, the `i`th bin's value at `vals[i*stride]`.
+*/
+struct BinnedSegment {
+    std::string chrom;
+    uint32_t start;
+    const double* vals;
+    size_t n;
+    size_t stride;
+};
+
+/*!
+Writes one track's binned values to a new bigWig at `path` with libBigWig's fixed-step writer,
+each run of non-NaN bins as one `bwAddIntervalSpanSteps` (continued with `bwAppendIntervalSpanSteps`)
+of span and step `bin_size`, so missing bins are left out rather than written as NaN.
+`segments` must be in the order of `chrom_sizes`, and ascending within a chromosome.
+libBigWig computes up to `max_zooms` zoom levels when the file is closed.
+It is written to `<path>.tmp` and only renamed to `path` once closed, returning its digest.
+Throws std::runtime_error if libBigWig fails.
+*/
+FileDigest write_binned_bigWig(const std::filesystem::path& path, const std::map<std::string, int>& chrom_sizes,
+                         const std::vector<BinnedSegment>& segments, uint32_t bin_size, int32_t max_zooms = 10);
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef BSZ_H
+#define BSZ_H
+
+#include <vector>
+#include <string>
+#include <filesystem>
+#include <bigWigs2tensors/npy.h>
+
+/*
+.bsz: a 2D array split into fixed-size blocks that are each byte-shuffled and then
+compressed independently, with zstd (bundled) or zlib, so that blocks are compressed in
+parallel and any one of them can be decompressed on its own. Layout, all integers little-endian:
+    magic "\x93BWSHUF" (7) + version (1), u32 header length
+    header: JSON {"dtype", "shape", "block_elems", "codec", "level", "shuffle"}, space-padded to 8-byte alignment
+    block index: u64 num_blocks, then num_blocks + 1 u64 offsets of each block from the data start
+    data: the compressed blocks, back to back
+Block i holds the C-order elements [i*block_elems, (i+1)*block_elems) of the array, the last one fewer.
+Its bytes are shuffled before compression: the first byte of every element, then every second byte, ...,
+which groups the mostly constant exponent bytes of smooth or repetitive signal together.
+*/
+
+/*!
+Sizes and timing of one or more .bsz writes, for reporting.
+*/
+struct BszStats {
+    size_t raw_bytes = 0;
+    size_t compressed_bytes = 0;
+    double seconds = 0;
+    // of the file written, by write_bsz alone, not summed
+    FileDigest digest;
+
+    double ratio() const { return compressed_bytes ? double(raw_bytes) / compressed_bytes : 0; }
+    // of raw bytes, in MB/s
+    double throughput() const { return seconds > 0 ? raw_bytes / seconds / 1e6 : 0; }
+    BszStats& operator+=(const BszStats& other);
+};
+
+/*!
+Codec of a .bsz file's blocks, its header's "codec": zstd, several times faster than zlib at its
+fastest levels for as good a ratio on shuffled signal, or zlib, as the first .bsz files were written.
+*/
+enum class BszCodec { zstd, zlib };
+
+/*!
+Parses "zstd" or "zlib". Throws std::invalid_argument for anything else.
+*/
+BszCodec parse_bsz_codec(const std::string& name);
+
+/*!
+How `write_bsz` splits and compresses an array.
+*/
+struct BszOptions {
+    // elements per block, the unit of compression and of random access
+    size_t block_elems = 1 << 16;
+    NpyDtype dtype = NpyDtype::float64;
+    // of each block: zstd's level (1 to 22, or negative for faster still), or zlib's
+    // (0 to 9, 0 storing them shuffled but uncompressed)
+    int level = 1;
+    BszCodec codec = BszCodec::zstd;
+};
+
+/*!
+Writes the C-order `rows` by `cols` array of doubles `data` to a .bsz file at `path`,
+converting to `opts.dtype`, and compressing its blocks in parallel in batches.
+The file only appears at `path` once complete, see AtomicOfstream.
+Throws std::runtime_error if the file cannot be written.
+*/
+BszStats write_bsz(const std::filesystem::path& path, const double* data, size_t rows, size_t cols,
+                   const BszOptions& opts = BszOptions());
+
+/*!
+The header and block index of a .bsz file, enough to decompress any block.
+*/
+struct BszIndex {
+    NpyDtype dtype;
+    BszCodec codec;
+    std::vector<size_t> shape;
+    size_t block_elems;
+    // file offset of the first block
+    size_t data_start;
+    // num_blocks + 1 offsets, relative to data_start
+    std::vector<uint64_t> offsets;
+
+    size_t num_blocks() const { return offsets.size() - 1; }
+};
+
+/*!
+Reads the header and block index of the .bsz file at `path`.
+Throws std::runtime_error if it is not a valid .bsz file.
+*/
+BszIndex read_bsz_index(const std::filesystem::path& path);
+
+/*!
+Decompresses and unshuffles block `block` of the .bsz file at `path` with index `index`,
+returning its raw little-endian elements of `index.dtype`.
+*/
+std::vector<char> read_bsz_block(const std::filesystem::path& path, const BszIndex& index, size_t block);
+
+#endif
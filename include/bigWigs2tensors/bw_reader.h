@@ -0,0 +1,40 @@
+#ifndef BW_READER_H
+#define BW_READER_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <bigWig.h>
+#include <bigWigs2tensors/mem_stats.h>
+
+/*!
+A worker's reusable buffers for `read_bin_means`: a data block as stored and decompressed,
+and each bin's running sum and covered bases. The last block read is kept, as adjacent fetches
+share it. They only ever grow, so once sized by the first fetches a worker's later fetches
+allocate nothing but libBigWig's list of overlapping blocks.
+*/
+struct BinScratch {
+    bwmem::vector<char, bwmem::Pool::reader> stored;
+    bwmem::vector<char, bwmem::Pool::decode> block;
+    bwmem::vector<double, bwmem::Pool::accumulators> sums;
+    bwmem::vector<uint32_t, bwmem::Pool::accumulators> covered;
+    // which data block `block` holds, and its decompressed length
+    const bigWigFile_t* block_file = nullptr;
+    uint64_t block_offset = 0;
+    size_t block_len = 0;
+    // fetches so far, and the heap allocations made for them: buffer growths plus the block lists
+    size_t fetches = 0;
+    size_t allocations = 0;
+};
+
+/*!
+Writes the mean value of each of the `n_bins` bins of `bin_size` from `start` on `chrom` in `bw`
+to `out`, weighted by the bases each value covers, as `bwStatsFromFull` does, or NaN where no value
+covers the bin. Rather than having libBigWig allocate and return each interval, the overlapping
+data blocks are read and decompressed into `scratch` and reduced into the bins in place.
+`bw` must only be read by one thread at a time.
+*/
+void read_bin_means(bigWigFile_t* bw, const std::string& chrom, uint32_t start, uint32_t bin_size, uint32_t n_bins,
+                    double* out, BinScratch& scratch);
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef INTERVALS_H
+#define INTERVALS_H
+
+#include <vector>
+#include <map>
+#include <string>
+#include <algorithm>
+#include <cstdint>
+
+/*!
+A 0-based half-open interval [start, end) of a chromosome.
+*/
+struct Interval {
+    uint64_t start;
+    uint64_t end;
+};
+
+class IntervalIndex
+/*!
+A chromosome's intervals, e.g. those to bin: owned, move-only, sorted by start then end, and stored as a
+structure of arrays, the starts and the ends each contiguous for the binning's scans over them. Overlapping
+intervals are kept apart. An implicit interval tree, laid over the sorted arrays in place (each interval a node,
+with the largest end in its subtree, as in cgranges), answers overlap queries in O(log n + hits), e.g. to find
+the intervals that regions excluded by `BWBinner::exclude` cut into or mask.
+*/
+{
+public:
+    IntervalIndex() = default;
+
+    /*!
+    Indexes `intervals`, in any order, leaving out empty ones.
+    */
+    explicit IntervalIndex(std::vector<Interval> intervals);
+
+    IntervalIndex(IntervalIndex&&) = default;
+    IntervalIndex& operator=(IntervalIndex&&) = default;
+    IntervalIndex(const IntervalIndex&) = delete;
+    IntervalIndex& operator=(const IntervalIndex&) = delete;
+
+    size_t size() const { return starts.size(); }
+    bool empty() const { return starts.empty(); }
+    uint64_t start(size_t i) const { return starts[i]; }
+    uint64_t end(size_t i) const { return ends[i]; }
+    Interval operator[](size_t i) const { return {starts[i], ends[i]}; }
+
+    /*!
+    Each interval's first bin within the concatenation of all the intervals' fully covered bins of `bin_size`,
+    followed by the total number of bins, i.e. `size() + 1` prefix offsets.
+    */
+    std::vector<unsigned> start_bins(unsigned bin_size) const;
+
+    /*!
+    Indices of the intervals overlapping [start, end), in increasing order.
+    */
+    std::vector<size_t> overlapping(uint64_t start, uint64_t end) const;
+
+    /*!
+    Per interval, 1 if any of `regions` overlaps it, else 0, through an overlap query per region.
+    */
+    std::vector<char> overlapped_by(const std::vector<Interval>& regions) const;
+
+private:
+    std::vector<uint64_t> starts;
+    std::vector<uint64_t> ends;
+    // per node of the implicit tree, the largest end in its subtree
+    std::vector<uint64_t> max_ends;
+    // level of the root, -1 when empty
+    int root_level = -1;
+};
+
+/*!
+Intervals sorted by start, none empty and none overlapping or adjacent, as made by `normalize_intervals`.
+The set algebra below takes and returns these, in time linear in the intervals.
+*/
+using IntervalSet = std::vector<Interval>;
+
+/*!
+Sorts `intervals` and merges those overlapping or adjacent, leaving out empty ones.
+*/
+IntervalSet normalize_intervals(std::vector<Interval> intervals);
+
+IntervalSet union_intervals(const IntervalSet& a, const IntervalSet& b);
+IntervalSet intersect_intervals(const IntervalSet& a, const IntervalSet& b);
+
+/*!
+Each interval of `a` less the bases in `b`, as the pieces left of it. Unlike the set operations, `a` need
+only be sorted by start and may overlap, e.g. a coords BED's peaks, each interval keeping its own pieces.
+The pieces are sorted by start, then end.
+*/
+std::vector<Interval> subtract_intervals(const std::vector<Interval>& a, const IntervalSet& b);
+
+/*!
+Calls `fn(first_bin, n_bins)` for each maximal run of the `n_bins` bins of `bin_size` from `start`
+that do not overlap `excluded`, in order, e.g. to only fetch the bins not masked out.
+*/
+template <typename Fn>
+void for_each_unexcluded_run(const IntervalSet& excluded, uint64_t start, uint32_t bin_size, uint32_t n_bins, Fn&& fn) {
+    // first exclusion ending past `start`
+    auto excl = std::upper_bound(excluded.begin(), excluded.end(), start,
+                                 [](uint64_t pos, const Interval& interv) { return pos < interv.end; });
+    uint32_t bin = 0;
+    for (; excl != excluded.end() && bin < n_bins; ++excl) {
+        // bins [hit_lo, hit_hi) overlap the exclusion
+        if (excl->start >= start + uint64_t(n_bins) * bin_size)
+            break;
+        uint32_t hit_lo = excl->start <= start ? 0 : (excl->start - start) / bin_size;
+        uint32_t hit_hi = std::min<uint64_t>(n_bins, (excl->end - start + bin_size - 1) / bin_size);
+        if (hit_lo > bin)
+            fn(bin, hit_lo - bin);
+        bin = std::max(bin, hit_hi);
+    }
+    if (bin < n_bins)
+        fn(bin, n_bins - bin);
+}
+
+/*!
+Reads the intervals of a bigBed, or a plain-text or gzipped BED, into an IntervalSet per chromosome of
+`chrom_sizes`, clipped to it. Chromosomes without intervals have no entry.
+*/
+std::map<std::string, IntervalSet> read_interval_sets(const std::string& path, const std::map<std::string, int>& chrom_sizes);
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <string>
+#include <string_view>
+#include <sstream>
+#include <utility>
+
+/*!
+Lowest log level compiled in, set by the BIGWIGS2TENSORS_LOG_LEVEL CMake option.
+Calls below it expand to nothing, so e.g. per-interval trace logging costs nothing
+in a build at the default `info`.
+    0: trace, 1: debug, 2: info, 3: warn, 4: error, 5: off
+*/
+#ifndef BW_LOG_COMPILE_LEVEL
+#define BW_LOG_COMPILE_LEVEL 2
+#endif
+
+namespace bwlog {
+
+enum class Level : int { trace = 0, debug, info, warn, error, off };
+
+// the longest message printed whole, see `write`
+constexpr size_t max_message_bytes = 128 * 248;
+
+/*!
+Sets the lowest level printed at runtime. Defaults to `warn`.
+*/
+void set_level(Level level);
+
+Level level();
+
+/*!
+Parses one of "trace", "debug", "info", "warn", "error" or "off".
+Throws std::invalid_argument for anything else.
+*/
+Level parse_level(const std::string& name);
+
+/*!
+Whether a message at `level` would currently be printed. A relaxed atomic load.
+*/
+bool enabled(Level level);
+
+/*!
+Queues a message on the calling thread's ring buffer, to be printed to stderr by the
+background drainer. Never takes a lock: when the ring is full, messages below `warn`
+are dropped (and counted), `warn` and above wait for the drainer. A message longer than
+a slot of the ring spans several, printed as one line; one longer than `max_message_bytes`
+is cut short, ending in "...(+N bytes)" for the N bytes left out.
+*/
+void write(Level level, std::string_view msg);
+
+/*!
+Synchronously prints everything queued so far, from every thread.
+*/
+void flush();
+
+}  // namespace bwlog
+
+#define BW_LOG(level, expr)                                     \
+    do {                                                        \
+        if (bwlog::enabled(level)) {                            \
+            std::ostringstream bw_log_os_;                      \
+            bw_log_os_ << expr;                                 \
+            bwlog::write(level, bw_log_os_.str());              \
+        }                                                       \
+    } while (0)
+
+// a call compiled out: `expr` is still checked, and what it names counts as used, but never evaluated
+#define BW_LOG_DISABLED(expr) ((void)sizeof(std::declval<std::ostringstream&>() << expr))
+
+#if BW_LOG_COMPILE_LEVEL <= 0
+#define BW_LOG_TRACE(expr) BW_LOG(bwlog::Level::trace, expr)
+#else
+#define BW_LOG_TRACE(expr) BW_LOG_DISABLED(expr)
+#endif
+
+#if BW_LOG_COMPILE_LEVEL <= 1
+#define BW_LOG_DEBUG(expr) BW_LOG(bwlog::Level::debug, expr)
+#else
+#define BW_LOG_DEBUG(expr) BW_LOG_DISABLED(expr)
+#endif
+
+#if BW_LOG_COMPILE_LEVEL <= 2
+#define BW_LOG_INFO(expr) BW_LOG(bwlog::Level::info, expr)
+#else
+#define BW_LOG_INFO(expr) BW_LOG_DISABLED(expr)
+#endif
+
+#if BW_LOG_COMPILE_LEVEL <= 3
+#define BW_LOG_WARN(expr) BW_LOG(bwlog::Level::warn, expr)
+#else
+#define BW_LOG_WARN(expr) BW_LOG_DISABLED(expr)
+#endif
+
+#if BW_LOG_COMPILE_LEVEL <= 4
+#define BW_LOG_ERROR(expr) BW_LOG(bwlog::Level::error, expr)
+#else
+#define BW_LOG_ERROR(expr) BW_LOG_DISABLED(expr)
+#endif
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <filesystem>
+
+class MappedFile
+/*!
+A file preallocated at a fixed size and memory-mapped read-write and shared,
+so that writes to `data()` land in the file without going through a buffer,
+or an existing file mapped read-only. A created file is mapped at `<path>.tmp`, and only
+renamed to its path by `commit`, so an interrupted run leaves no full-size file of garbage.
+Move-only, unmaps and closes the file on destruction.
+*/
+{
+public:
+    /*!
+    Creates (or truncates) `<path>.tmp`, allocates `size` bytes of disk for it
+    up front, so running out of space fails here rather than on a page fault, and maps it.
+    If destroyed uncommitted, e.g. unwinding from an exception, the temporary file is removed.
+    Throws std::system_error on failure.
+    */
+    static MappedFile create(const std::filesystem::path& path, size_t size);
+
+    /*!
+    Maps the existing file at `path` read-only, for reading through sequentially; `data()` must not
+    be written to. An empty file has no mapping, `data()` is then null.
+    Throws std::system_error on failure.
+    */
+    static MappedFile open_read(const std::filesystem::path& path);
+
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile();
+
+    char* data() const { return addr; }
+    size_t size() const { return len; }
+    // where the file is, or for a created file, will be once committed
+    const std::filesystem::path& path() const { return file_path; }
+
+    /*!
+    Flushes the mapping to disk, blocking until written.
+    Throws std::system_error on failure.
+    */
+    void sync() const;
+
+    /*!
+    Flushes the mapping to disk and renames a created file from `<path>.tmp` to its path, which the
+    mapping stays valid across. Does nothing for a file already at its path.
+    Throws std::system_error on failure.
+    */
+    void commit();
+
+private:
+    MappedFile(const std::filesystem::path& path, int fd, char* addr, size_t len);
+
+    void release();
+
+    std::filesystem::path file_path;
+    // of a created file until committed, else empty
+    std::filesystem::path tmp_path;
+    int fd;
+    char* addr;
+    size_t len;
+};
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef MEM_STATS_H
+#define MEM_STATS_H
+
+#include <array>
+#include <vector>
+#include <string>
+#include <memory>
+#include <chrono>
+#include <ostream>
+#include <filesystem>
+#include <cstddef>
+
+namespace bwmem {
+
+/*!
+What the accounted memory is for:
+    reader: data blocks as stored in the bigWigs, read for binning
+    decode: decompressed data blocks
+    accumulators: per-bin sums and the workers' tiles of binned values
+    outputs: the binned arrays (NDArrays owning their buffer), and staging copies of them for saving
+    serialization: write buffers, format conversion and compression buffers
+*/
+enum class Pool : int { reader = 0, decode, accumulators, outputs, serialization };
+constexpr size_t num_pools = 5;
+
+const char* pool_name(Pool pool);
+
+/*!
+Accounts `bytes` allocated for, or freed from, `pool`. Relaxed atomics, cheap enough for every
+buffer (re)allocation, but not meant for per-value paths.
+*/
+void add(Pool pool, size_t bytes);
+void sub(Pool pool, size_t bytes);
+
+struct PoolStats {
+    size_t current = 0;
+    // highest `current` over the whole run
+    size_t peak = 0;
+    size_t allocations = 0;
+};
+
+PoolStats stats(Pool pool);
+
+/*!
+An std::allocator that accounts what it allocates to `pool`, for buffers owned by standard containers.
+*/
+template <typename T, Pool pool>
+struct Allocator {
+    using value_type = T;
+    template <typename U>
+    struct rebind { using other = Allocator<U, pool>; };
+
+    Allocator() = default;
+    template <typename U>
+    Allocator(const Allocator<U, pool>&) {}
+
+    T* allocate(size_t n) {
+        T* p = std::allocator<T>().allocate(n);
+        add(pool, n * sizeof(T));
+        return p;
+    }
+
+    void deallocate(T* p, size_t n) {
+        sub(pool, n * sizeof(T));
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    friend bool operator==(const Allocator&, const Allocator&) { return true; }
+    friend bool operator!=(const Allocator&, const Allocator&) { return false; }
+};
+
+template <typename T, Pool pool>
+using vector = std::vector<T, Allocator<T, pool>>;
+
+/*!
+Accounts memory allocated by other means, e.g. by a C library, to `pool` for as long as it lives.
+*/
+class Charge {
+public:
+    Charge(Pool pool, size_t bytes) : pool(pool), bytes(bytes) { add(pool, bytes); }
+    ~Charge() { sub(pool, bytes); }
+    Charge(const Charge&) = delete;
+    Charge& operator=(const Charge&) = delete;
+
+private:
+    Pool pool;
+    size_t bytes;
+};
+
+/*!
+A stage's memory: its peak and final resident set size, the peak never below the final,
+and each pool's peak within it.
+*/
+struct StageReport {
+    std::string name;
+    double seconds = 0;
+    size_t peak_rss = 0;
+    size_t end_rss = 0;
+    std::array<size_t, num_pools> pool_peaks {};
+};
+
+class Stage
+/*!
+Marks a stage of the pipeline, e.g. binning, for as long as it lives: the pools' peaks and the
+process's peak RSS (VmHWM, reset through /proc/self/clear_refs where the kernel allows, else the peak
+so far) are taken from its start, and recorded with its name when it ends, also logged at `info`.
+Stages follow one another, they do not nest.
+*/
+{
+public:
+    explicit Stage(std::string name);
+    ~Stage();
+    Stage(const Stage&) = delete;
+    Stage& operator=(const Stage&) = delete;
+
+private:
+    std::string name;
+    std::chrono::steady_clock::time_point start;
+};
+
+/*!
+The stages recorded so far, in the order they ended.
+*/
+std::vector<StageReport> stages();
+
+/*!
+Current resident set size of the process in bytes, 0 where /proc is not available.
+*/
+size_t current_rss();
+
+/*!
+Prints a line per stage and then the pools' totals over the run, in MiB.
+*/
+void write_summary(std::ostream& os);
+
+/*!
+Writes the stages and the pools' totals, in bytes, to `path` as JSON.
+*/
+void write_json(const std::filesystem::path& path);
+
+}  // namespace bwmem
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef NDARRAY_H
+#define NDARRAY_H
+
+#include <vector>
+#include <memory>
+#include <ostream>
+#include <bigWigs2tensors/npy.h>
+
+class NDArray
+/*!
+A dense, C-order (row-major) 2D array of binned values with a runtime element type,
+either owning its (64-byte aligned) buffer or viewing memory owned elsewhere,
+e.g. a memory-mapped file. Copies are shallow and share the buffer, like torch Tensors.
+*/
+{
+public:
+    /*!
+    An empty 0 x 0 array.
+    */
+    NDArray() = default;
+
+    /*!
+    Allocates an uninitialized `rows` by `cols` array of `dtype`.
+    */
+    NDArray(size_t rows, size_t cols, NpyDtype dtype = NpyDtype::float64);
+
+    /*!
+    A `rows` by `cols` array of `dtype` viewing `data`, which must outlive it.
+    */
+    static NDArray view(void* data, size_t rows, size_t cols, NpyDtype dtype = NpyDtype::float64);
+
+    size_t rows() const { return n_rows; }
+    size_t cols() const { return n_cols; }
+    std::vector<size_t> shape() const { return {n_rows, n_cols}; }
+    size_t numel() const { return n_rows * n_cols; }
+    NpyDtype dtype() const { return elem_dtype; }
+    size_t nbytes() const { return numel() * npy_itemsize(elem_dtype); }
+
+    /*!
+    Typed pointer to the first element. `T` must match `dtype()`, this is not checked.
+    */
+    template <typename T>
+    T* data() const { return static_cast<T*>(buf.get()); }
+
+    void* raw_data() const { return buf.get(); }
+
+private:
+    std::shared_ptr<void> buf;
+    size_t n_rows = 0;
+    size_t n_cols = 0;
+    NpyDtype elem_dtype = NpyDtype::float64;
+};
+
+/*!
+Prints the shape and then the values of `arr`, one row per line.
+*/
+std::ostream& operator<<(std::ostream& os, const NDArray& arr);
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef NPY_H
+#define NPY_H
+
+#include <vector>
+#include <string>
+#include <filesystem>
+#include <ostream>
+#include <bigWigs2tensors/atomic_file.h>
+
+/*!
+Element types that binned values can be written as to .npy files.
+Binning is always done in double precision, narrower types are converted on write.
+*/
+enum class NpyDtype { float32, float64 };
+
+/*!
+Parses one of "float32" or "float64". Throws std::invalid_argument for anything else.
+*/
+NpyDtype parse_npy_dtype(const std::string& name);
+
+/*!
+Returns the NumPy array-protocol type string of `dtype`, e.g. "<f8".
+*/
+std::string npy_descr(NpyDtype dtype);
+
+/*!
+Returns the size in bytes of one element of `dtype`.
+*/
+size_t npy_itemsize(NpyDtype dtype);
+
+/*!
+Builds the header of a version 1.0 .npy file holding a C-order array of `shape`,
+padded with spaces so that the data after it starts 64-byte aligned (as NumPy does),
+which keeps `np.load(mmap_mode='r')` views aligned.
+*/
+std::string npy_header(NpyDtype dtype, const std::vector<size_t>& shape);
+
+/*!
+As above, for an array of any NumPy type `descr`, e.g. "<u2".
+*/
+std::string npy_header(const std::string& descr, const std::vector<size_t>& shape);
+
+/*!
+Writes `numel` doubles from `data` to `out` as raw little-endian `dtype` elements,
+straight from `data` for float64, in fixed-size converted chunks otherwise.
+*/
+void write_npy_data(std::ostream& out, const double* data, size_t numel, NpyDtype dtype);
+
+/*!
+Writes the C-order array of doubles `data` of `shape` to a .npy file at `path`,
+converting each value to `dtype`. The data is written straight from `data`,
+in fixed-size chunks when converting, and the file only appears at `path` once complete, see AtomicOfstream.
+Returns its size and checksum. Throws std::runtime_error if the file cannot be written.
+*/
+FileDigest write_npy(const std::filesystem::path& path, const double* data, const std::vector<size_t>& shape, NpyDtype dtype);
+
+/*!
+The raw contents of a C-order .npy file.
+*/
+struct NpyArray {
+    std::string descr;
+    std::vector<size_t> shape;
+    std::vector<char> bytes;
+};
+
+/*!
+Reads the version 1.0 .npy file at `path`, as written by `write_npy`.
+Throws std::runtime_error if it is not one, or is Fortran-ordered.
+*/
+NpyArray read_npy(const std::filesystem::path& path);
+
+#endif
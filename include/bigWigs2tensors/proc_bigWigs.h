@@ -9,14 +9,114 @@
 #include <iostream>
 #include <fstream>
 #include <filesystem>
-#include <torch/torch.h>
+#include <functional>
 #include <bigWig.h>
 #include <bigWigs2tensors/util.h>
+#include <bigWigs2tensors/npy.h>
+#include <bigWigs2tensors/ndarray.h>
+#include <bigWigs2tensors/mapped_file.h>
+#include <bigWigs2tensors/zarr.h>
+#include <bigWigs2tensors/safetensors.h>
+#include <bigWigs2tensors/bsz.h>
+#include <bigWigs2tensors/quantize.h>
+#include <bigWigs2tensors/sparse.h>
+#include <bigWigs2tensors/windows.h>
+#include <bigWigs2tensors/arrow_ipc.h>
+#include <bigWigs2tensors/bigwig_out.h>
+#include <bigWigs2tensors/bw_reader.h>
+#include <bigWigs2tensors/bed.h>
+#include <bigWigs2tensors/intervals.h>
+#include <bigWigs2tensors/mem_stats.h>
 
 namespace constants {
-    static const torch::TensorOptions tensor_opts = torch::TensorOptions()
-                                                    .dtype(torch::kFloat64)
-                                                    .requires_grad(false);
+    // number of bins per worker tile, i.e. per fetch from a single bigWig
+    static const unsigned tile_bins = 1024;
+    // number of bigWigs (tracks) per worker tile
+    static const unsigned tile_tracks = 16;
+    // longest fetch that intervals are coalesced into, in bins
+    static const unsigned max_fetch_bins = 4 * tile_bins;
+};
+
+// a worker's tile of binned values, see `BWBinner::load_bin_chrom_tile`
+using TileBuffer = bwmem::vector<double, bwmem::Pool::accumulators>;
+
+/*!
+A worker's reusable buffers for `BWBinner::load_bin_chrom_tile`: a BinScratch per bigWig of its block,
+the pieces of intervals within the tile being loaded, and a coalesced fetch's bins.
+*/
+struct TileScratch {
+    // a piece of an interval: its bins [chrom_lo, chrom_hi) on the chromosome, from `tile_lo` in the tile
+    struct Segment {
+        unsigned chrom_lo;
+        unsigned chrom_hi;
+        unsigned tile_lo;
+    };
+
+    std::vector<BinScratch> tracks;
+    std::vector<Segment> segments;
+    bwmem::vector<double, bwmem::Pool::accumulators> fetched;
+};
+
+/*!
+Memory layout of each chromosome's binned array.
+    bin_major:   [num_bins, num_bws], each bigWig a column and each row a bin.
+    track_major: [num_bws, num_bins], each bigWig a row, so a track's bins are contiguous.
+*/
+enum class TensorLayout { bin_major, track_major };
+
+/*!
+What `BWBinner::exclude` does with excluded regions, e.g. a blacklist.
+    drop: cut them out of the intervals to bin, so their bins are not in the arrays at all.
+    mask: keep the bins, NaN where a bin overlaps an excluded region.
+Either way, the excluded data is never fetched.
+*/
+enum class ExcludeMode { drop, mask };
+
+/*!
+File format of the saved binned chromosomes.
+    pt:  pickled PyTorch tensors, `torch.load`-able, only when built with libtorch
+    npy: NumPy arrays, `np.load`-able, including with `mmap_mode='r'`
+    zarr: a Zarr v2 group of chunked, optionally compressed, arrays, `zarr.open`-able
+    safetensors: one safetensors file of all chromosomes (or one per chromosome), memory-mappable
+    bsz: byte-shuffled, zstd- or zlib-compressed blocks with a block index, see bsz.h
+    arrow: one Arrow IPC (Feather v2) file of a row per bin, with a column per track, see arrow_ipc.h
+    bigwig: a binned bigWig per track, for genome browsers
+*/
+enum class OutputFormat { pt, npy, zarr, safetensors, bsz, arrow, bigwig };
+
+/*!
+How `BWBinner::save_binneds` writes the binned chromosomes.
+*/
+struct OutputOptions {
+#ifdef BIGWIGS2TENSORS_WITH_TORCH
+    OutputFormat format = OutputFormat::pt;
+#else
+    OutputFormat format = OutputFormat::npy;
+#endif
+    // element type saved, binned values are converted on write
+    NpyDtype dtype = NpyDtype::float64;
+    // zarr: chunk grid over (bins, tracks), whatever the layout
+    size_t chunk_bins = 16384;
+    size_t chunk_tracks = 64;
+    // zarr: zlib level of each chunk, 0 for uncompressed
+    int zlib_level = 0;
+    // safetensors: a `<chrom>.safetensors` per chromosome rather than a single `binned.safetensors`
+    bool per_chrom_files = false;
+    // bsz: elements per independently compressed block, their codec and its level
+    size_t block_elems = 1 << 16;
+    int bsz_level = 1;
+    BszCodec bsz_codec = BszCodec::zstd;
+    // npy: integer codes instead of floats, with per-track parameters in `quantization.json`, see quantize.h
+    QuantDtype quant = QuantDtype::none;
+    QuantTransform quant_transform = QuantTransform::linear;
+    QuantRange quant_range = QuantRange::data;
+    // arrow: most bins per record batch, a chromosome's bins are split over as many as needed
+    size_t batch_rows = 1 << 16;
+    // npy: tracks of a chromosome with fewer than this fraction of bins other than 0 (or NaN) are
+    // stored as sparse columns in `<chrom>.sparse/` rather than in `<chrom>.npy`, 0 for all dense
+    double sparse_density = 0;
+    // npy: a single `genome.npy` of all chromosomes' bins, see `BWBinner::save_binneds`
+    bool genome_wide = false;
 };
 
 /*!
@@ -32,6 +132,21 @@ If any NaNs in a bin, sets result for that bin to NaN.
 */
 std::vector<double> bin_vec_NaNmeans(const std::vector<double>& in_vec, size_t bin_size);
 
+/*!
+Writes a tile of binned values, laid out track-major as `[n_tracks][n_bins]`, into
+the chromosome's output buffer `dest` of `dest_bins` bins by `dest_tracks` tracks in
+the given layout, with the tile's first bin at `bin_lo` and its first track at `track_lo`.
+For a bin-major `dest` this is a blocked transpose, so each cache line of `dest`
+is written in full from cache-resident rows of the tile.
+A `float` destination is converted to on the fly.
+*/
+void write_tile(const double* tile, size_t n_tracks, size_t n_bins,
+                double* dest, size_t dest_bins, size_t dest_tracks,
+                size_t track_lo, size_t bin_lo, TensorLayout layout);
+void write_tile(const double* tile, size_t n_tracks, size_t n_bins,
+                float* dest, size_t dest_bins, size_t dest_tracks,
+                size_t track_lo, size_t bin_lo, TensorLayout layout);
+
 class BWBinner
 /*!
 a "manager" for binning a set of "alignable" bigWig files together
@@ -44,17 +159,21 @@ public:
         bw_paths: a NULL-terminated array of paths to bigWig files
         chrom_sizes_path: path to a whitespace-delimited file of chromosome sizes
         coords_bed_path: optional path to a bed file specifying coordinates to bin over
+        layout: memory layout of the binned arrays, see `TensorLayout`
     */
-    // BWBinner(const std::vector<std::string>& bigWig_paths, const std::string& chrom_sizes_path, const std::map<std::string, bbOverlappingEntries_t*>& coords_map);
-    BWBinner(const std::vector<std::string>& bigWig_paths, const std::string& chrom_sizes_path, const std::string& coords_bed_path);
+    // BWBinner(const std::vector<std::string>& bigWig_paths, const std::string& chrom_sizes_path, const chroms_coords_map_t& coords_map);
+    BWBinner(const std::vector<std::string>& bigWig_paths, const std::string& chrom_sizes_path, const std::string& coords_bed_path,
+             TensorLayout layout = TensorLayout::bin_major);
 
     /*!
     Constructs a BWBinner object that will bin the bigWig files
     Args:
         bw_paths: a NULL-terminated array of paths to bigWig files
         chrom_sizes_path: path to a whitespace-delimited file of chromosome sizes
+        layout: memory layout of the binned arrays, see `TensorLayout`
     */
-    BWBinner(const std::vector<std::string>& bigWig_paths, const std::string& chrom_sizes_path);
+    BWBinner(const std::vector<std::string>& bigWig_paths, const std::string& chrom_sizes_path,
+             TensorLayout layout = TensorLayout::bin_major);
 
     /*!
     Move constructor
@@ -64,53 +183,287 @@ public:
     ~BWBinner();
 
     /*!
-    Loads the binned data for all chromosomes into a map of torch Tensors,
+    Makes binning write straight into memory-mapped .npy files instead of in-memory arrays:
+    each chromosome's `<chrom>.npy` in `out_dir` is preallocated at its final size when
+    its binning starts, and its array is a view of the mapped data.
+    Must be called before `load_bin_all_chroms`. The arrays are only valid while
+    this BWBinner is alive.
+    \arg out_dir the directory to write to, created if missing.
+    \arg dtype element type of the files (and arrays), converted to as tiles are written.
+    */
+    void map_binneds(const std::string& out_dir, NpyDtype dtype = NpyDtype::float64);
+
+    /*!
+    Makes `load_bin_all_chroms` bin within a memory budget, for outputs larger than memory: rather than
+    holding each chromosome's array, it bins a range of bins at a time, over all tracks in parallel tiles,
+    with ranges small enough that the buffers in flight stay under `max_memory` bytes, and streams each
+    finished range into the chromosome's `<chrom>.npy` in `out_dir`, which only appears once complete.
+    The buffers are the range, each worker's tile and read buffers, and the file's write buffer.
+    A tighter budget only means more, smaller ranges. libBigWig's own per-file buffers come on top.
+    The chromosomes are then not in `binned_chroms`, and can only be saved as npy.
+    Must be called before `load_bin_all_chroms`, and not with `map_binneds` or `shard_windows`.
+    \arg out_dir the directory to write to, created if missing.
+    \arg max_memory bytes of binned values in flight, at least enough for one bin of every track.
+    \arg dtype element type of the files, converted to as tiles are written.
+    Throws std::invalid_argument if `max_memory` is too small, see `min_memory_budget`.
+    */
+    void limit_memory(const std::string& out_dir, size_t max_memory, NpyDtype dtype = NpyDtype::float64);
+
+    /*!
+    The smallest `max_memory` that `limit_memory` accepts for `dtype`: a single bin of every track, plus the
+    workers' fixed buffers, each a tile's worth of reads from its block of bigWigs (the largest data block of
+    any, as stored and decompressed, and the per-bin sums of a longest fetch, per track) and the write buffer.
+    */
+    size_t min_memory_budget(NpyDtype dtype = NpyDtype::float64) const;
+
+    /*!
+    Sets how far apart, in bases, the bins of intervals (e.g. nearby peaks) may be for their fetches to be
+    coalesced: each track is read once over all their bins, gaps included, and each interval's bins are
+    copied out to its own rows of the arrays, which are the same as without coalescing. Overlapping and adjacent
+    intervals are always coalesced, so the bases they share are only read and reduced once (per tile of bins),
+    which is all the default `max_gap` of 0 does. A larger gap trades reading the bins in between for fewer
+    fetches, each of which walks the bigWig's index. Fetches are at most `constants::max_fetch_bins` long.
+    Applies to `load_bin_all_chroms` and `stream` called after it.
+    */
+    void coalesce_fetches(unsigned max_gap);
+
+    /*!
+    Excludes the regions of a bigBed, or a plain-text or gzipped BED, e.g. the ENCODE blacklist, from binning
+    rather than masking them in the arrays afterwards. With `ExcludeMode::drop`, they are subtracted from the
+    intervals to bin right away, each interval keeping the pieces left of it, and chromosomes left without any are
+    dropped. With `ExcludeMode::mask`, the bins overlapping them are left NaN and only the runs of bins between
+    them are fetched; this also applies to `bin_regions`. May be called more than once, the exclusions adding up.
+    Must be called before `load_bin_all_chroms`, `stream` or `bin_regions`.
+    */
+    void exclude(const std::string& exclude_path, ExcludeMode mode = ExcludeMode::drop);
+
+    /*!
+    Makes `load_bin_all_chroms` also cut the binned chromosomes into fixed-length training windows
+    as it goes, each window's bins taken from within one interval, written to pre-shuffled shards
+    in `out_dir`: `train-NNNNN.npy` and, for the holdout chromosomes, `holdout-NNNNN.npy`, each a
+    `[windows, length, num_bws]` array. The shards are preallocated and memory-mapped once the windows
+    are known, before any binning, and each chromosome's windows are copied into their rows as soon as
+    it is binned. `windows_index.tsv` maps each row back to its genomic coordinates.
+    Must be called before `load_bin_all_chroms`.
+    \arg opts window length and stride, holdout chromosomes, shard size and shuffle seed, see `WindowOptions`.
+    */
+    void shard_windows(const std::string& out_dir, const WindowOptions& opts);
+
+    /*!
+    Loads the binned data for all chromosomes into a map of NDArrays,
     by calling `load_bin_chrom_tensor` on each chromosome.
+    See `to_tensor` in torch_sink.h for handing them to libtorch without a copy.
     \arg bin_size The size of the bins to use.
     */
-    const std::map<std::string, torch::Tensor>& load_bin_all_chroms(unsigned bin_size);
+    const std::map<std::string, NDArray>& load_bin_all_chroms(unsigned bin_size);
+
+    /*!
+    Bins all chromosomes, in `chrom_sizes` order, a range of `chunk_bins` bins at a time, handing each range
+    to `callback` as soon as it is binned instead of keeping any of it, for processing in passes without
+    ever holding a chromosome. `callback(chrom, first_bin, chunk)` gets the chromosome's bins
+    [first_bin, first_bin + n) of all tracks as an `n`-bin array of `dtype`, laid out like the chromosome's
+    array would be: `[n, num_bws]`, or `[num_bws, n]` track-major. `n` is `chunk_bins` but for a chromosome's
+    last range. `chunk` views a buffer that the next range is binned into, so anything needed after the call
+    returns must be copied out. Nothing is kept in `binned_chroms`, and `map_binneds`, `limit_memory` and
+    `shard_windows` do not apply.
+    Throws std::invalid_argument if `chunk_bins` is 0. Exceptions thrown by `callback` stop the binning.
+    */
+    void stream(unsigned bin_size, size_t chunk_bins,
+                const std::function<void(const std::string& chrom, unsigned first_bin, const NDArray& chunk)>& callback,
+                NpyDtype dtype = NpyDtype::float64);
+
+    /*!
+    Bins a window of `2 * flank` bases, `2 * flank / bin_size` bins, centred on each region's summit, over all
+    tracks, e.g. for models taking a fixed-length input around each peak. Returns the windows in the order of
+    `regions`, as `[regions.size() * window_bins, num_bws]` rows, i.e. a C-order `[regions, window_bins, num_bws]`
+    array whatever the layout. Bins not wholly on the chromosome, or masked by `exclude`, are NaN.
+    The regions are fetched in genomic order rather than their own, so neighbouring windows share the bigWigs'
+    reads, each block of bigWigs by its own worker. Independent of the intervals binned by `load_bin_all_chroms`.
+    Throws std::invalid_argument if `2 * flank` is not a positive multiple of `bin_size`, or a region is on
+    a chromosome not in `chrom_sizes`.
+    */
+    NDArray bin_regions(const std::vector<BedRegion>& regions, unsigned bin_size, unsigned flank);
+
+    /*!
+    Saves the windows `binned` by `bin_regions` over `regions` to `regions.npy` in `out_dir` as a
+    `[regions, window_bins, num_bws]` array of `dtype`, with `regions_index.tsv` of each region's row, chrom,
+    summit, window start and end (the start may be negative near a chromosome's start) and name,
+    `tensor_bigWigs_inds.csv` and `manifest.tsv`, as `save_binneds` does.
+    */
+    void save_regions(const std::string& out_dir, const std::vector<BedRegion>& regions, const NDArray& binned,
+                      unsigned bin_size, unsigned flank, NpyDtype dtype = NpyDtype::float64) const;
 
     /*!
     Data getter for the binned data for all chromosomes.
     \note Before binning, this will be empty.
     */
-    std::map<std::string, torch::Tensor> binned_chroms() const;
+    std::map<std::string, NDArray> binned_chroms() const;
 
     /*!
-    Saves the binned data for all chromosomes (each a Tensor) and
-    a text file with the bigWig filename stems in their order in the Tensors,
+    Saves the binned data for all chromosomes (each an NDArray) and
+    a text file with the bigWig filename stems in their order in the arrays,
     one per line.
-    Each Tensor is saved to a separate file, named by the chromosome name.
+    Each array is saved to a separate file, named by the chromosome name, the chromosomes in parallel
+    for the formats of a file (or directory) per chromosome.
+    Files only appear under their names once completely written and fsynced, see AtomicOfstream,
+    and `manifest.tsv` lists each file written with its size and CRC-32, last, so its presence
+    marks a complete save.
+    Chromosomes binned into memory-mapped .npy files (see `map_binneds`) are only flushed to
+    disk, or copied if `out_dir` is another directory.
     \arg out_dir the directory to save to, without a trailing '/'.
+    With the zarr format, `out_dir` is itself the Zarr group, holding one array per chromosome
+    and the track names in its attributes. With the safetensors format, each chromosome is a tensor
+    named by the chromosome, and the layout and track names are in the header's metadata.
+    With `genome_wide` (npy only), all chromosomes are instead concatenated, in `chrom_sizes` order,
+    into one `[total_bins, num_bws]` array in `genome.npy`, whatever the layout, and `genome_index.tsv`
+    maps each interval to its rows: a position `pos` in [start, end) of `chrom` is at row
+    `row_offset + (pos - start) / bin_size`.
+    With the arrow format, all chromosomes are in `binned.arrow`, in `chrom_sizes` order, each bin a row
+    of its chrom, start and end, then its value in each track, in columns named as in `tensor_bigWigs_inds.csv`.
+    With the bigwig format, each track is written to `<bigWig stem>.binned.bw`, in parallel, one writer per track,
+    as fixed-step intervals of a bin each, with NaN bins left out and zoom levels added.
+    With `sparse_density` (npy only), `<chrom>.npy` holds only the chromosome's dense tracks, in order, and
+    its mostly-empty ones are in `<chrom>.sparse/`, see `SparseColumns`; `read_sparse_columns` and
+    `SparseColumns::densify` read windows of them back.
+    With `quant` (npy only), each track's values are stored as integer codes, NaNs as a sentinel code,
+    and `quantization.json` holds each track's scale and offset to dequantize them with.
+    \arg opts the format, element type and any format-specific options, see `OutputOptions`.
     */
-    void save_binneds(const std::string& out_dir) const; 
+    void save_binneds(const std::string& out_dir, const OutputOptions& opts = OutputOptions()) const;
 
 private:
     std::vector<std::filesystem::path> bw_paths;
     std::vector<bigWigFile_t*> bw_files;
     unsigned int num_bws;
     std::map<std::string, int> chrom_sizes;
-    // entries are {chrom: bbOverlappingEntries_t*}
-    //  '-> key struct members are array of starts, array of ends, and number of entries
-    std::map<std::string, bbOverlappingEntries_t*> spec_coords;
-    std::map<std::string, torch::Tensor> chrom_binneds;
-    torch::TensorOptions tens_opts;
+    // each chromosome's intervals to bin, see `IntervalIndex`
+    chroms_coords_map_t spec_coords;
+    std::map<std::string, NDArray> chrom_binneds;
+    TensorLayout layout;
+    // set by map_binneds(), .npy files that chrom_binneds are views of
+    std::filesystem::path mapped_dir;
+    NpyDtype mapped_dtype;
+    std::map<std::string, MappedFile> chrom_mappings;
+    // set by limit_memory(), and the digest of each chromosome's .npy once streamed
+    std::filesystem::path streamed_dir;
+    NpyDtype streamed_dtype;
+    size_t memory_budget = 0;
+    std::map<std::string, FileDigest> streamed_digests;
+    // set by coalesce_fetches()
+    unsigned fetch_gap = 0;
+    // set by exclude() with ExcludeMode::mask, each chromosome's regions whose bins are left NaN
+    std::map<std::string, IntervalSet> masked;
+    // per chromosome, each track's counts of 0 and NaN bins, counted while binning
+    std::map<std::string, std::vector<TrackFill>> chrom_fills;
+    // set by shard_windows(), and each window's start bin and slot, per chromosome
+    struct ChromWindow {
+        unsigned bin_lo;
+        uint64_t start;
+        bool holdout;
+        ShardSlot slot;
+    };
+    std::filesystem::path windows_dir;
+    WindowOptions window_opts;
+    std::map<std::string, std::vector<ChromWindow>> chrom_windows;
+    // train shards, then holdout shards, each with the offset of its data after the .npy header
+    struct WindowShard {
+        MappedFile file;
+        size_t data_offset;
+    };
+    std::vector<WindowShard> window_shards[2];
+    // bin size of the last load_bin_all_chroms()
+    unsigned binned_bin_size = 0;
 
-    // Loads all the data (binned series of values) for the `interv_idx`'th interval
-    // for chromosome `chrom` into a torch Tensor, each bigWig a column and each row a bin.
+    /*!
+    Loads the binned values of bigWigs [bw_lo, bw_hi) over the chromosome's bins [bin_lo, bin_hi)
+    into `tile`, laid out track-major as `[bw_hi - bw_lo][bin_hi - bin_lo]`. Bins without data are NaN.
+    Pre-computed bin offsets of the intervals, from `IntervalIndex::start_bins`, and the flags of `masked_intervals`
+    match the `spec_coords` intervals by index; only the flagged intervals are split around the masked regions.
+    The tile's pieces of intervals are fetched together where their bins overlap or are within `fetch_gap`
+    bases, see `coalesce_fetches`. Each bigWig is read through its own of the worker's buffers,
+    `scratch.tracks[bw_idx - bw_lo]`.
+    */
+    void load_bin_chrom_tile(const std::string& chrom, const std::vector<unsigned>& start_bindxs,
+                             const std::vector<char>& masked_intervals, unsigned bin_size,
+                             size_t bw_lo, size_t bw_hi, unsigned bin_lo, unsigned bin_hi, TileBuffer& tile,
+                             TileScratch& scratch);
 
     /*!
-    Loads all the data (binned series of values) for the given bigWig for chromosome `chrom`
-    into a torch Tensor, each row being a bin. Pre-computed bin intervals passed from
-    `load_bin_chrom_tensor`, match the `spec_coords` intervals by index.
+    Per interval of the chromosome's `spec_coords`, 1 if a region masked by `exclude` overlaps it, found through
+    the interval tree; empty if nothing on the chromosome is masked.
     */
-    void load_bin_chrom_bigWig_tensor(const std::string& chrom, size_t bw_idx, const std::vector<unsigned>& start_bindxs, unsigned bin_size, unsigned num_bins);
+    std::vector<char> masked_intervals(const std::string& chrom) const;
 
     /*!
     Loads all the data (binned series of values) for chromosome `chrom`
-    into the respective torch Tensor in the map, one column per bigWig file.
+    into a newly allocated (or memory-mapped) NDArray in the map.
     */
     void load_bin_chrom_tensor(const std::string& chrom, unsigned bin_size);
+
+    /*!
+    Bins per range for `bin_chrom_chunks` to keep a range of `dtype`, the workers' tiles and their read buffers,
+    see `min_memory_budget`, within `max_memory` bytes. Throws std::invalid_argument if not even one bin fits.
+    */
+    size_t budget_chunk_bins(size_t max_memory, NpyDtype dtype) const;
+
+    /*!
+    Bins chromosome `chrom` a range of bins at a time into `chunk`, laid out as the chromosome's array
+    but only as many bins long (`chunk.rows()`, or `chunk.cols()` track-major), the tracks in parallel tiles.
+    Each worker takes blocks of tracks in turn, with its own tile and read buffers kept across the ranges.
+    Calls `sink(bin_lo, n_bins)` once the chromosome's bins [bin_lo, bin_lo + n_bins) of all tracks
+    are the first `n_bins` bins of `chunk`.
+    */
+    void bin_chrom_chunks(const std::string& chrom, unsigned bin_size, NDArray& chunk,
+                          const std::function<void(unsigned, unsigned)>& sink);
+
+    /*!
+    Bins chromosome `chrom` within `memory_budget`, streaming it into its .npy in `streamed_dir`.
+    */
+    void stream_chrom_npy(const std::string& chrom, unsigned bin_size);
+
+    /*!
+    Lays out the windows of all chromosomes, assigns them shard slots and creates the shard files.
+    */
+    void plan_windows(unsigned bin_size);
+
+    /*!
+    Copies chromosome `chrom`'s windows from its binned array into their shard rows.
+    */
+    void write_chrom_windows(const std::string& chrom);
+
+    /*!
+    Flushes the shards and writes `windows_index.tsv`.
+    */
+    void finish_windows(unsigned bin_size);
+
+    /*!
+    Writes `tensor_bigWigs_inds.csv`, each bigWig's column in the arrays and its filename stem.
+    */
+    FileDigest save_track_names(const std::filesystem::path& out_dir_p) const;
+
+    /*!
+    Saves each track as a binned bigWig, all tracks in parallel.
+    */
+    std::vector<FileDigest> save_binned_bigWigs(const std::filesystem::path& out_dir_p) const;
+
+    /*!
+    Saves all chromosomes concatenated into `genome.npy`, with the `genome_index.tsv` of their intervals' rows.
+    */
+    std::vector<FileDigest> save_genome_binned(const std::filesystem::path& out_dir_p, const OutputOptions& opts,
+                                               const QuantParams& quant) const;
+
+    /*!
+    Fits the per-track quantization parameters of `opts`, over each track's range of binned values
+    in all chromosomes or as given by its bigWig's header.
+    */
+    QuantParams fit_binneds_quant(const OutputOptions& opts) const;
+
+    /*!
+    Saves chromosome `chrom` as `<chrom>.npy` of its dense tracks and `<chrom>.sparse/` of those
+    below `opts.sparse_density`.
+    */
+    std::vector<FileDigest> save_sparse_binned(const std::filesystem::path& out_dir_p, const std::string& chrom,
+                                               const OutputOptions& opts) const;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,85 @@
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+
+#include <vector>
+#include <string>
+#include <filesystem>
+#include <ostream>
+#include <bigWigs2tensors/atomic_file.h>
+
+/*!
+Integer types binned values can be quantized to, `none` to keep them floating point.
+The largest code (the smallest for int16) is reserved for NaN, see `quant_sentinel`.
+*/
+enum class QuantDtype { none, uint8, uint16, int16 };
+
+/*!
+Transform applied before quantizing linearly:
+    linear: none
+    log1p:  sign(x) * log1p(|x|), for heavy-tailed signal, undone with sign(y) * expm1(|y|)
+*/
+enum class QuantTransform { linear, log1p };
+
+/*!
+Where the per-track value ranges come from:
+    data:   a pass over the binned values
+    header: the min and max values in each bigWig's header, no extra pass but possibly wider
+*/
+enum class QuantRange { data, header };
+
+/*!
+Parses "none", "uint8", "uint16" or "int16". Throws std::invalid_argument for anything else.
+*/
+QuantDtype parse_quant_dtype(const std::string& name);
+
+/*!
+Returns the NumPy array-protocol type string of `dtype`, e.g. "<u2".
+*/
+std::string quant_descr(QuantDtype dtype);
+
+/*!
+Returns the code that NaNs are stored as.
+*/
+long quant_sentinel(QuantDtype dtype);
+
+/*!
+Per-track parameters of a quantization: a (transformed) value `y` of track `t` is stored as
+`code = round((y - offset[t]) / scale[t])`, clamped to the codes other than the sentinel, so that
+`offset[t] + code * scale[t]` recovers it (then untransformed, for log1p).
+*/
+struct QuantParams {
+    QuantDtype dtype = QuantDtype::none;
+    QuantTransform transform = QuantTransform::linear;
+    std::vector<double> scale;
+    std::vector<double> offset;
+};
+
+/*!
+Fits each track's scale and offset so that its untransformed range [lo[t], hi[t]] spans all
+non-sentinel codes. Tracks with no range (e.g. all NaN) get a scale of 1.
+*/
+QuantParams fit_quant(QuantDtype dtype, QuantTransform transform, const std::vector<double>& lo, const std::vector<double>& hi);
+
+/*!
+Writes the C-order `rows` by `cols` array of doubles `data` to `out` as quantized codes,
+each track along `track_axis` (0 for rows, 1 for columns) with its own parameters.
+*/
+void write_quantized_data(std::ostream& out, const double* data, size_t rows, size_t cols, size_t track_axis,
+                          const QuantParams& params);
+
+/*!
+Writes `data` quantized as above to a .npy file of the codes at `path`, returning its digest.
+Throws std::runtime_error if the file cannot be written.
+*/
+FileDigest write_quantized_npy(const std::filesystem::path& path, const double* data, size_t rows, size_t cols, size_t track_axis,
+                         const QuantParams& params);
+
+/*!
+Writes the sidecar JSON of `params` to `path`: the dtype, transform and sentinel, the track names
+and the `scale` and `offset` arrays, in track order, so that readers can dequantize a whole array
+at once, e.g. `np.where(codes == sentinel, np.nan, codes * scale + offset)` for bin-major arrays.
+Returns the file's digest.
+*/
+FileDigest write_quant_params(const std::filesystem::path& path, const QuantParams& params, const std::vector<std::string>& track_names);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef SAFETENSORS_H
+#define SAFETENSORS_H
+
+#include <vector>
+#include <map>
+#include <string>
+#include <filesystem>
+#include <bigWigs2tensors/npy.h>
+
+/*!
+A named C-order array of doubles to write to a safetensors file.
+*/
+struct SafetensorsEntry {
+    std::string name;
+    const double* data;
+    std::vector<size_t> shape;
+};
+
+/*!
+Returns the safetensors dtype string of `dtype`, e.g. "F64".
+*/
+std::string safetensors_dtype(NpyDtype dtype);
+
+/*!
+Builds the header of a safetensors file holding `tensors` back to back, in order, as `dtype`:
+the little-endian u64 length, then the JSON object of each tensor's dtype, shape and data
+offsets (plus the string to string `metadata`, if any), space-padded so that the data starts
+64-byte aligned. Every tensor then starts aligned to its element size.
+*/
+std::string safetensors_header(const std::vector<SafetensorsEntry>& tensors, NpyDtype dtype,
+                               const std::map<std::string, std::string>& metadata = {});
+
+/*!
+Writes `tensors` to a safetensors file at `path`, converting each value to `dtype`, streamed
+from each tensor's buffer. The result can be memory-mapped, e.g. by `safetensors.safe_open`.
+Returns the file's digest. Throws std::runtime_error if the file cannot be written.
+*/
+FileDigest write_safetensors(const std::filesystem::path& path, const std::vector<SafetensorsEntry>& tensors, NpyDtype dtype,
+                       const std::map<std::string, std::string>& metadata = {});
+
+#endif
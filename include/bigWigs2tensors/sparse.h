@@ -0,0 +1,66 @@
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include <vector>
+#include <filesystem>
+#include <bigWigs2tensors/npy.h>
+
+/*!
+Counts of a track's bins over a chromosome that are exactly 0 and that are NaN,
+from which its density (and its fill value) is decided.
+*/
+struct TrackFill {
+    size_t zeros = 0;
+    size_t nans = 0;
+
+    /*!
+    The more common of 0 and NaN, the value left implicit when the track is stored sparse.
+    */
+    double fill() const;
+
+    /*!
+    Fraction of `num_bins` bins that differ from `fill()`, i.e. that would be stored.
+    */
+    double density(size_t num_bins) const;
+};
+
+/*!
+Mostly-empty tracks of a chromosome, stored column by column (CSC-like): the stored bins of
+column `c` are `indices[indptr[c]:indptr[c+1]]`, ascending, with values `data[indptr[c]:indptr[c+1]]`,
+and every other bin is `fill[c]`. Column `c` is track `tracks[c]`.
+*/
+struct SparseColumns {
+    size_t num_bins = 0;
+    std::vector<int64_t> tracks;
+    std::vector<double> fill;
+    std::vector<int64_t> indptr {0};
+    std::vector<int64_t> indices;
+    std::vector<double> data;
+
+    /*!
+    Writes bins [bin_lo, bin_hi) of column `col` to `out`, `bin_hi - bin_lo` values,
+    finding the first stored bin by binary search.
+    */
+    void densify(size_t col, size_t bin_lo, size_t bin_hi, double* out) const;
+};
+
+/*!
+Gathers the `tracks` (ascending) of the C-order `rows` by `cols` array `data`, tracks along `track_axis`
+(0 for rows, 1 for columns), into sparse columns, leaving out each track's `fills` value.
+*/
+SparseColumns make_sparse_columns(const double* data, size_t rows, size_t cols, size_t track_axis,
+                                  const std::vector<int64_t>& tracks, const std::vector<double>& fills);
+
+/*!
+Writes `cols` to the directory `dir` as `tracks.npy`, `fill.npy`, `indptr.npy`, `indices.npy`
+(all int64 but `fill`) and `data.npy` (of `dtype`), plus the bin count in `num_bins.npy`.
+Returns their digests, named as `<dir's name>/<file>`.
+*/
+std::vector<FileDigest> write_sparse_columns(const std::filesystem::path& dir, const SparseColumns& cols, NpyDtype dtype);
+
+/*!
+Reads sparse columns written by `write_sparse_columns` back from `dir`.
+*/
+SparseColumns read_sparse_columns(const std::filesystem::path& dir);
+
+#endif
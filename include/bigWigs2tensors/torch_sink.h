@@ -0,0 +1,35 @@
+#ifndef TORCH_SINK_H
+#define TORCH_SINK_H
+
+#include <filesystem>
+#include <torch/torch.h>
+#include <bigWigs2tensors/ndarray.h>
+#include <bigWigs2tensors/npy.h>
+#include <bigWigs2tensors/atomic_file.h>
+
+/*
+libtorch interop, only built with BIGWIGS2TENSORS_WITH_TORCH.
+The binning core itself works on NDArrays and does not need libtorch.
+*/
+
+namespace constants {
+    static const torch::TensorOptions tensor_opts = torch::TensorOptions()
+                                                    .dtype(torch::kFloat64)
+                                                    .requires_grad(false);
+};
+
+/*!
+Returns a Tensor of the same shape and dtype viewing `arr`'s buffer, no copy.
+The Tensor keeps the buffer alive, but a view of a memory-mapped array is
+still only valid while its BWBinner is.
+*/
+torch::Tensor to_tensor(const NDArray& arr);
+
+/*!
+Saves `arr` as a pickled Tensor of `dtype` to `path`, `torch.load`-able, returning the file's digest.
+pickle_save needs the whole file in memory first, unlike the other formats.
+Throws std::runtime_error if the file cannot be written.
+*/
+FileDigest write_pt(const std::filesystem::path& path, const NDArray& arr, NpyDtype dtype);
+
+#endif
@@ -3,14 +3,18 @@
 
 #include <vector>
 #include <map>
+#include <algorithm>
 #include <execution>
+#include <exception>
+#include <mutex>
 #include <iostream>
 #include <fstream>
 #include <filesystem>
 #include <bigWig.h>
+#include <bigWigs2tensors/intervals.h>
 
-// Map for storing any user-specified coordinates, one bbOverlappingEntries_t per chromosome
-using chroms_coords_map_t = std::map<std::string, bbOverlappingEntries_t*>;
+// Map for storing any user-specified coordinates, one IntervalIndex per chromosome
+using chroms_coords_map_t = std::map<std::string, IntervalIndex>;
 
 /*!
 Utility function to find all files of a given type in a directory.
@@ -21,6 +25,41 @@ _Note_: __Not__ recursive.
 */
 std::vector<std::string> find_paths_filetype(const std::string& search_dir, const std::string& file_ext);
 
+/*!
+Calls `func` on every element of [first, last) in parallel (`std::execution::par`).
+Unlike passing an execution policy to std::for_each, which calls std::terminate when
+`func` throws, the first exception thrown is rethrown once all calls have finished.
+*/
+template <typename It, typename Func>
+void parallel_for_each(It first, It last, Func func) {
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    std::for_each(std::execution::par, first, last,
+                    [&func, &error, &error_mutex](auto&& elem) {
+                        try {
+                            func(elem);
+                        }
+                        catch (...) {
+                            std::lock_guard<std::mutex> lock(error_mutex);
+                            if (!error)
+                                error = std::current_exception();
+                        }
+                    });
+    if (error)
+        std::rethrow_exception(error);
+}
+
+/*!
+Returns `str` as a double-quoted JSON string, escaping as needed.
+*/
+std::string json_quote(const std::string& str);
+
+/*!
+Parses a size in bytes, optionally with a binary K, M, G or T suffix (and a trailing B or iB),
+e.g. "512M" or "64GiB". Throws std::invalid_argument if it is not one.
+*/
+size_t parse_byte_size(const std::string& str);
+
 /*!
 Reads a whitespace-delimited chrom_sizes file into
 a map of chromosome names to their sizes.
@@ -28,27 +67,24 @@ a map of chromosome names to their sizes.
 std::map<std::string, int> parse_chrom_sizes(const std::string& chrom_sizes_path);
 
 /*!
-Reads a whitespace-delimited bed file of coordinates into a map of chromosome names to
-references to all the intervals specified, within a bbOverlappingEntries_t per chromosome.
+Reads a bigBed file of coordinates into a map of chromosome names to
+all the intervals specified, within an IntervalIndex per chromosome.
+The chromosomes of `chrom_sizes` are fetched in parallel, each worker through its own handle on the file
+taking the next chromosome, into a slot per chromosome. Chromosomes without intervals have no entry.
+Throws std::runtime_error if the file is not a bigBed or cannot be opened.
 */
 chroms_coords_map_t parse_coords_bigBed(const std::string& coords_bed_path, const std::map<std::string, int>& chrom_sizes);
 
 /*!
 Combined function to parse chrom_sizes and coords_bed files. Extracts sizes only for chromosomes in coords_bed.
+`coords_bed_path` may be a bigBed, or a plain-text or gzipped BED such as narrowPeak, see `parse_coords_bed`.
 */
 std::pair< std::map<std::string,int>, chroms_coords_map_t > parse_chrom_sizes_coords(const std::string& chrom_sizes_path, const std::string& coords_bed_path);
 
 /*!
 Returns the number of bins fully covered by the interval [start, end) with given bin size.
 */
-unsigned num_bins_intersect_interval(unsigned start, unsigned end, unsigned bin_size);
-
-/*!
-Generates a "binned copy" of the given bbOverlappingEntries_t, where each interval is the
-starting bin and ending bin of the original interval after binning with given bin size.
-The interval values are set to the number of bins in the interval.
-*/
-bwOverlappingIntervals_t* bin_coords(const bbOverlappingEntries_t* coords, unsigned bin_size);
+unsigned num_bins_intersect_interval(uint64_t start, uint64_t end, unsigned bin_size);
 
 /*
 Returns a map of the same type as parse_coords_bigBed() for all chromosomes given in chrom_sizes
@@ -0,0 +1,46 @@
+#ifndef WINDOWS_H
+#define WINDOWS_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <bigWigs2tensors/npy.h>
+
+/*!
+How `BWBinner::shard_windows` cuts the binned chromosomes into training windows.
+*/
+struct WindowOptions {
+    // bins per window, and between the starts of consecutive windows
+    unsigned length = 1024;
+    unsigned stride = 1024;
+    // chromosomes whose windows go to the holdout shards instead of the train ones
+    std::vector<std::string> holdout_chroms;
+    // upper bound on the windows of a shard, shards of a split differ by at most one window
+    size_t windows_per_shard = 4096;
+    // of the shuffle, the same seed always gives the same shards
+    uint64_t seed = 0;
+    NpyDtype dtype = NpyDtype::float64;
+};
+
+/*!
+Where a window is written: row `row` of shard `shard` of its split.
+*/
+struct ShardSlot {
+    uint32_t shard;
+    uint64_t row;
+};
+
+/*!
+Shuffles `n_windows` windows, in a fixed order, with a Fisher-Yates shuffle seeded by `seed`
+(portable, unlike std::shuffle) and deals them into as few shards of at most `windows_per_shard`
+as possible, balanced to within one window. Returns each window's slot, and fills `shard_sizes`.
+*/
+std::vector<ShardSlot> assign_shards(size_t n_windows, size_t windows_per_shard, uint64_t seed,
+                                     std::vector<size_t>& shard_sizes);
+
+/*!
+Returns the file name of shard `shard` of `split`, e.g. "train-00003.npy".
+*/
+std::string shard_name(const std::string& split, size_t shard);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef ZARR_H
+#define ZARR_H
+
+#include <vector>
+#include <string>
+#include <filesystem>
+#include <bigWigs2tensors/npy.h>
+#include <bigWigs2tensors/atomic_file.h>
+
+/*!
+Chunking and encoding of a 2D array written as a Zarr v2 array.
+*/
+struct ZarrArrayOptions {
+    // chunk shape, rows by columns
+    size_t chunk_rows;
+    size_t chunk_cols;
+    // element type stored, converted to from double
+    NpyDtype dtype = NpyDtype::float64;
+    // zlib level (1-9) of each chunk, or 0 for uncompressed chunks
+    int zlib_level = 0;
+};
+
+/*!
+Writes the `.zgroup` of a Zarr v2 group at `group_dir`, creating the directory,
+and its `.zattrs` holding `attrs_json` (a JSON object) unless empty.
+Each file is written through an AtomicOfstream, returning their digests named as in `group_dir`.
+Throws std::runtime_error if a file cannot be written.
+*/
+std::vector<FileDigest> write_zarr_group(const std::filesystem::path& group_dir, const std::string& attrs_json = "");
+
+/*!
+Writes the C-order `rows` by `cols` array of doubles `data` as a Zarr v2 array at `array_dir`:
+its `.zarray` metadata, and one file per chunk named `<i>.<j>` by chunk grid index.
+Edge chunks are padded with NaN, the array's fill value, to the full chunk shape as Zarr v2
+requires. Chunks are gathered, converted, compressed and written in parallel, each through an
+AtomicOfstream, and the `.zarray` last. Returns their digests, named relative to `array_dir`'s parent.
+Throws std::runtime_error if a file cannot be written.
+*/
+std::vector<FileDigest> write_zarr_array(const std::filesystem::path& array_dir, const double* data, size_t rows, size_t cols,
+                                         const ZarrArrayOptions& opts);
+
+#endif
@@ -0,0 +1,362 @@
+#include <vector>
+#include <string>
+#include <deque>
+#include <memory>
+#include <filesystem>
+#include <algorithm>
+#include <cstring>
+#include <bit>
+#include <stdexcept>
+#include <bigWigs2tensors/arrow_ipc.h>
+#include <bigWigs2tensors/mem_stats.h>
+
+// flatbuffers and Arrow buffers are little-endian, written straight from memory
+static_assert(std::endian::native == std::endian::little, "Arrow IPC writer assumes a little-endian host");
+
+namespace {
+
+const char arrow_magic[] = "ARROW1";
+constexpr size_t buffer_align = 64;
+// elements converted per write
+constexpr size_t convert_chunk = 1 << 16;
+
+// Arrow's Schema.fbs and Message.fbs enum values
+constexpr int16_t metadata_v5 = 4;
+constexpr uint8_t header_schema = 1;
+constexpr uint8_t header_record_batch = 3;
+constexpr uint8_t type_int = 2;
+constexpr uint8_t type_floating_point = 3;
+constexpr uint8_t type_utf8 = 5;
+constexpr int16_t precision_single = 1;
+constexpr int16_t precision_double = 2;
+
+/*
+A minimal flatbuffers encoder: objects are built as a tree and then laid out front to back,
+breadth first, so every offset points forward to a child laid out after its parent, and
+each table's vtable sits just before it.
+*/
+namespace fb {
+
+struct Object;
+using Ref = std::shared_ptr<Object>;
+
+// a table field, either scalar bytes or an offset to another object
+struct Slot {
+    int id;
+    std::string bytes;
+    size_t align;
+    Ref ref;
+};
+
+struct Object {
+    enum Kind { table, string, struct_vector, offset_vector } kind;
+    // table
+    std::vector<Slot> slots;
+    // string contents, or the struct vector's elements back to back
+    std::string bytes;
+    size_t count = 0;
+    size_t elem_align = 1;
+    // offset vector
+    std::vector<Ref> refs;
+};
+
+template <typename T>
+Slot scalar(int id, T val) {
+    std::string bytes(sizeof(T), '\0');
+    std::memcpy(bytes.data(), &val, sizeof(T));
+    return {id, bytes, sizeof(T), nullptr};
+}
+
+Slot offset(int id, Ref ref) {
+    return {id, "", 4, std::move(ref)};
+}
+
+Ref table(std::vector<Slot> slots) {
+    auto obj = std::make_shared<Object>();
+    obj->kind = Object::table;
+    obj->slots = std::move(slots);
+    return obj;
+}
+
+Ref string(const std::string& str) {
+    auto obj = std::make_shared<Object>();
+    obj->kind = Object::string;
+    obj->bytes = str;
+    return obj;
+}
+
+Ref structs(std::string bytes, size_t count, size_t elem_align) {
+    auto obj = std::make_shared<Object>();
+    obj->kind = Object::struct_vector;
+    obj->bytes = std::move(bytes);
+    obj->count = count;
+    obj->elem_align = elem_align;
+    return obj;
+}
+
+Ref vector(std::vector<Ref> refs) {
+    auto obj = std::make_shared<Object>();
+    obj->kind = Object::offset_vector;
+    obj->refs = std::move(refs);
+    return obj;
+}
+
+template <typename T>
+void put(std::string& out, size_t pos, T val) {
+    std::memcpy(out.data() + pos, &val, sizeof(T));
+}
+
+// pads `out` so that `extra` bytes further on is aligned to `align`
+void pad_to(std::string& out, size_t align, size_t extra = 0) {
+    out.resize(out.size() + (align - (out.size() + extra) % align) % align, '\0');
+}
+
+std::string serialize(const Ref& root) {
+    // the root offset, then the objects
+    std::string out(4, '\0');
+    std::deque<std::pair<size_t, Ref>> pending {{0, root}};
+    while (!pending.empty()) {
+        auto [patch_pos, obj] = pending.front();
+        pending.pop_front();
+        size_t pos;
+        switch (obj->kind) {
+            case Object::string:
+                pad_to(out, 4);
+                pos = out.size();
+                out.resize(pos + 4);
+                put<uint32_t>(out, pos, obj->bytes.size());
+                out += obj->bytes;
+                out += '\0';
+                break;
+            case Object::struct_vector:
+                // the elements, after the length, aligned
+                pad_to(out, std::max<size_t>(4, obj->elem_align), 4);
+                pos = out.size();
+                out.resize(pos + 4);
+                put<uint32_t>(out, pos, obj->count);
+                out += obj->bytes;
+                break;
+            case Object::offset_vector:
+                pad_to(out, 4);
+                pos = out.size();
+                out.resize(pos + 4);
+                put<uint32_t>(out, pos, obj->refs.size());
+                for (const Ref& ref : obj->refs) {
+                    pending.push_back({out.size(), ref});
+                    out.resize(out.size() + 4);
+                }
+                break;
+            case Object::table: {
+                int n_ids = 0;
+                for (const Slot& slot : obj->slots) {
+                    n_ids = std::max(n_ids, slot.id + 1);
+                }
+                pad_to(out, 2);
+                size_t vtable_pos = out.size();
+                out.resize(vtable_pos + 4 + 2*n_ids, '\0');
+
+                pad_to(out, 4);
+                pos = out.size();
+                out.resize(pos + 4);
+                put<int32_t>(out, pos, pos - vtable_pos);
+                for (const Slot& slot : obj->slots) {
+                    pad_to(out, slot.align);
+                    size_t field_pos = out.size();
+                    if (slot.ref) {
+                        pending.push_back({field_pos, slot.ref});
+                        out.resize(field_pos + 4);
+                    }
+                    else {
+                        out += slot.bytes;
+                    }
+                    put<uint16_t>(out, vtable_pos + 4 + 2*slot.id, field_pos - pos);
+                }
+                put<uint16_t>(out, vtable_pos, 4 + 2*n_ids);
+                put<uint16_t>(out, vtable_pos + 2, out.size() - pos);
+                break;
+            }
+        }
+        put<uint32_t>(out, patch_pos, pos - patch_pos);
+    }
+    return out;
+}
+
+}  // namespace fb
+
+fb::Ref field(const std::string& name, bool nullable, uint8_t type_type, fb::Ref type) {
+    // readers expect children, if empty
+    return fb::table({fb::offset(0, fb::string(name)), fb::scalar<uint8_t>(1, nullable), fb::scalar<uint8_t>(2, type_type),
+                      fb::offset(3, type), fb::offset(5, fb::vector({}))});
+}
+
+fb::Ref schema_table(const std::vector<std::string>& track_names, NpyDtype dtype) {
+    auto int64_type = [] { return fb::table({fb::scalar<int32_t>(0, 64), fb::scalar<uint8_t>(1, true)}); };
+    std::vector<fb::Ref> fields {field("chrom", false, type_utf8, fb::table({})),
+                                 field("start", false, type_int, int64_type()),
+                                 field("end", false, type_int, int64_type())};
+    int16_t precision = dtype == NpyDtype::float32 ? precision_single : precision_double;
+    for (const std::string& name : track_names) {
+        fields.push_back(field(name, true, type_floating_point, fb::table({fb::scalar<int16_t>(0, precision)})));
+    }
+    // little-endian
+    return fb::table({fb::scalar<int16_t>(0, 0), fb::offset(1, fb::vector(fields))});
+}
+
+template <typename T>
+void append_struct(std::string& bytes, T val) {
+    bytes.append(reinterpret_cast<const char*>(&val), sizeof(T));
+}
+
+}  // namespace
+
+ArrowIpcWriter::ArrowIpcWriter(const std::filesystem::path& path, const std::vector<std::string>& track_names, NpyDtype dtype)
+    : path(path), out_F(path), track_names(track_names), dtype(dtype)
+{
+    // magic, padded to 8 bytes
+    out_F.write(arrow_magic, 6);
+    out_F.write("\0\0", 2);
+
+    fb::Ref message = fb::table({fb::scalar<int16_t>(0, metadata_v5), fb::scalar<uint8_t>(1, header_schema),
+                                 fb::offset(2, schema_table(track_names, dtype)), fb::scalar<int64_t>(3, 0)});
+    write_message(fb::serialize(message));
+}
+
+int32_t ArrowIpcWriter::write_message(const std::string& metadata) {
+    // continuation marker and length, then the metadata padded so that the body starts aligned in the file
+    int64_t body_start = int64_t(out_F.tellp()) + 8 + metadata.size();
+    int32_t padded_len = metadata.size() + (buffer_align - body_start % buffer_align) % buffer_align;
+    const uint32_t continuation = 0xFFFFFFFF;
+    out_F.write(reinterpret_cast<const char*>(&continuation), 4);
+    out_F.write(reinterpret_cast<const char*>(&padded_len), 4);
+    out_F.write(metadata.data(), metadata.size());
+    std::string padding(padded_len - metadata.size(), '\0');
+    out_F.write(padding.data(), padding.size());
+    return 8 + padded_len;
+}
+
+void ArrowIpcWriter::write_batch(const std::string& chrom, const int64_t* starts, const int64_t* ends, size_t n_rows,
+                                 const double* data, size_t row_stride, size_t track_stride) {
+    // buffers of each column, in order: chrom (validity, offsets, data), start and end (validity, data),
+    // then each track (validity, data); no nulls, so every validity buffer is empty
+    std::vector<std::pair<int64_t, int64_t>> buffers;
+    int64_t body_len = 0;
+    auto add_buffer = [&buffers, &body_len](int64_t len) {
+        body_len = (body_len + buffer_align - 1) / buffer_align * buffer_align;
+        buffers.push_back({body_len, len});
+        body_len += len;
+    };
+    add_buffer(0);
+    add_buffer((n_rows + 1) * sizeof(int32_t));
+    add_buffer(n_rows * chrom.size());
+    for (int c = 0; c < 2; c++) {
+        add_buffer(0);
+        add_buffer(n_rows * sizeof(int64_t));
+    }
+    const size_t itemsize = npy_itemsize(dtype);
+    for (size_t t = 0; t < track_names.size(); t++) {
+        add_buffer(0);
+        add_buffer(n_rows * itemsize);
+    }
+    body_len = (body_len + buffer_align - 1) / buffer_align * buffer_align;
+
+    std::string nodes, buffer_structs;
+    for (size_t c = 0; c < 3 + track_names.size(); c++) {
+        append_struct<int64_t>(nodes, n_rows);
+        append_struct<int64_t>(nodes, 0);
+    }
+    for (const auto& [offset, len] : buffers) {
+        append_struct<int64_t>(buffer_structs, offset);
+        append_struct<int64_t>(buffer_structs, len);
+    }
+    fb::Ref batch = fb::table({fb::scalar<int64_t>(0, n_rows),
+                               fb::offset(1, fb::structs(nodes, 3 + track_names.size(), 8)),
+                               fb::offset(2, fb::structs(buffer_structs, buffers.size(), 8))});
+    fb::Ref message = fb::table({fb::scalar<int16_t>(0, metadata_v5), fb::scalar<uint8_t>(1, header_record_batch),
+                                 fb::offset(2, batch), fb::scalar<int64_t>(3, body_len)});
+
+    Block block {int64_t(out_F.tellp()), 0, body_len};
+    block.metadata_len = write_message(fb::serialize(message));
+
+    // the body, each buffer written at its offset
+    int64_t written = 0;
+    size_t buffer_idx = 0;
+    auto start_buffer = [this, &written, &buffers, &buffer_idx]() {
+        std::string padding(buffers[buffer_idx++].first - written, '\0');
+        out_F.write(padding.data(), padding.size());
+        written += padding.size();
+    };
+    auto write_buffer = [this, &written, &start_buffer](const char* bytes, size_t len) {
+        start_buffer();
+        out_F.write(bytes, len);
+        written += len;
+    };
+    write_buffer(nullptr, 0);
+    std::vector<int32_t> offsets(n_rows + 1);
+    for (size_t r = 0; r <= n_rows; r++) {
+        offsets[r] = r * chrom.size();
+    }
+    write_buffer(reinterpret_cast<const char*>(offsets.data()), offsets.size() * sizeof(int32_t));
+    std::string chroms;
+    chroms.reserve(n_rows * chrom.size());
+    for (size_t r = 0; r < n_rows; r++) {
+        chroms += chrom;
+    }
+    write_buffer(chroms.data(), chroms.size());
+    write_buffer(nullptr, 0);
+    write_buffer(reinterpret_cast<const char*>(starts), n_rows * sizeof(int64_t));
+    write_buffer(nullptr, 0);
+    write_buffer(reinterpret_cast<const char*>(ends), n_rows * sizeof(int64_t));
+
+    // each track gathered (and converted) into a contiguous column
+    bwmem::vector<double, bwmem::Pool::serialization> col64;
+    bwmem::vector<float, bwmem::Pool::serialization> col32;
+    for (size_t t = 0; t < track_names.size(); t++) {
+        write_buffer(nullptr, 0);
+        start_buffer();
+        for (size_t lo = 0; lo < n_rows; lo += convert_chunk) {
+            size_t n = std::min(convert_chunk, n_rows - lo);
+            const double* first = data + lo*row_stride + t*track_stride;
+            if (dtype == NpyDtype::float32) {
+                col32.resize(n);
+                for (size_t r = 0; r < n; r++) {
+                    col32[r] = first[r*row_stride];
+                }
+                out_F.write(reinterpret_cast<const char*>(col32.data()), n * sizeof(float));
+            }
+            else {
+                col64.resize(n);
+                for (size_t r = 0; r < n; r++) {
+                    col64[r] = first[r*row_stride];
+                }
+                out_F.write(reinterpret_cast<const char*>(col64.data()), n * sizeof(double));
+            }
+        }
+        written += n_rows * itemsize;
+    }
+    std::string padding(body_len - written, '\0');
+    out_F.write(padding.data(), padding.size());
+
+    batches.push_back(block);
+}
+
+FileDigest ArrowIpcWriter::close() {
+    // end-of-stream marker
+    const uint32_t eos[2] = {0xFFFFFFFF, 0};
+    out_F.write(reinterpret_cast<const char*>(eos), sizeof(eos));
+
+    std::string blocks;
+    for (const Block& block : batches) {
+        append_struct<int64_t>(blocks, block.offset);
+        append_struct<int32_t>(blocks, block.metadata_len);
+        append_struct<int32_t>(blocks, 0);
+        append_struct<int64_t>(blocks, block.body_len);
+    }
+    fb::Ref footer = fb::table({fb::scalar<int16_t>(0, metadata_v5), fb::offset(1, schema_table(track_names, dtype)),
+                                fb::offset(2, fb::structs("", 0, 8)), fb::offset(3, fb::structs(blocks, batches.size(), 8))});
+    std::string footer_bytes = fb::serialize(footer);
+    out_F.write(footer_bytes.data(), footer_bytes.size());
+    int32_t footer_len = footer_bytes.size();
+    out_F.write(reinterpret_cast<const char*>(&footer_len), 4);
+    out_F.write(arrow_magic, 6);
+    return out_F.commit();
+}
@@ -0,0 +1,226 @@
+#include <vector>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+#include <new>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <bigWigs2tensors/atomic_file.h>
+#include <bigWigs2tensors/mem_stats.h>
+
+namespace {
+
+// page-aligned, and large enough that each write(2) amortizes its syscall
+constexpr size_t buffer_align = 4096;
+constexpr size_t buffer_size = AtomicOfstream::buffer_bytes;
+
+uint32_t crc32_update(uint32_t crc, const char* bytes, size_t n) {
+    return crc32_z(crc, reinterpret_cast<const Bytef*>(bytes), n);
+}
+
+void fsync_path(const std::filesystem::path& path, int flags) {
+    int fd = open(path.c_str(), flags);
+    if (fd == -1)
+        throw std::system_error(errno, std::generic_category(), "fsync: could not open " + path.string());
+    if (fsync(fd) == -1) {
+        int err = errno;
+        close(fd);
+        throw std::system_error(err, std::generic_category(), "fsync: failed for " + path.string());
+    }
+    close(fd);
+}
+
+}  // namespace
+
+class AtomicOfstream::Buffer : public std::streambuf {
+public:
+    explicit Buffer(int fd)
+        : fd(fd), mem(static_cast<char*>(std::aligned_alloc(buffer_align, buffer_size))) {
+        if (!mem)
+            throw std::bad_alloc();
+        setp(mem, mem + buffer_size);
+    }
+
+    ~Buffer() {
+        std::free(mem);
+        if (fd != -1)
+            close(fd);
+    }
+
+    int fd;
+    // errno of the first failed write, 0 if none
+    int error = 0;
+    // file offset of the start of the buffer, and the file's size so far
+    uint64_t pos = 0;
+    uint64_t end = 0;
+    // of the bytes [0, end), while every write has been an append
+    uint32_t crc = 0;
+    bool crc_valid = true;
+
+    bool drain() {
+        bool ok = write_at(pbase(), pptr() - pbase());
+        setp(mem, mem + buffer_size);
+        return ok;
+    }
+
+protected:
+    int_type overflow(int_type c) override {
+        if (!drain())
+            return traits_type::eof();
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+        // bigger than the buffer: written from the caller's memory rather than copied through
+        if (size_t(n) >= buffer_size) {
+            if (!drain() || !write_at(s, n))
+                return 0;
+            return n;
+        }
+        std::streamsize done = 0;
+        while (done < n) {
+            std::streamsize room = epptr() - pptr();
+            if (room == 0) {
+                if (!drain())
+                    return done;
+                continue;
+            }
+            std::streamsize len = std::min(room, n - done);
+            std::memcpy(pptr(), s + done, len);
+            pbump(len);
+            done += len;
+        }
+        return done;
+    }
+
+    int sync() override {
+        return drain() ? 0 : -1;
+    }
+
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override {
+        uint64_t at = pos + (pptr() - pbase());
+        // tellp, no need to write anything out
+        if (dir == std::ios_base::cur && off == 0)
+            return pos_type(off_type(at));
+        if (dir == std::ios_base::beg)
+            at = 0;
+        else if (dir == std::ios_base::end)
+            at = std::max(end, at);
+        return seekpos(pos_type(off_type(at) + off), which);
+    }
+
+    pos_type seekpos(pos_type sp, std::ios_base::openmode) override {
+        if (off_type(sp) < 0 || !drain())
+            return pos_type(off_type(-1));
+        pos = off_type(sp);
+        // anything but an append rewrites bytes already summed
+        if (pos != end)
+            crc_valid = false;
+        return sp;
+    }
+
+private:
+    char* mem;
+    bwmem::Charge charge {bwmem::Pool::serialization, buffer_size};
+
+    bool write_at(const char* s, size_t n) {
+        if (error)
+            return false;
+        if (crc_valid)
+            crc = crc32_update(crc, s, n);
+        while (n > 0) {
+            ssize_t written = pwrite(fd, s, n, pos);
+            if (written == -1) {
+                if (errno == EINTR)
+                    continue;
+                error = errno;
+                return false;
+            }
+            s += written;
+            n -= written;
+            pos += written;
+        }
+        end = std::max(end, pos);
+        return true;
+    }
+};
+
+AtomicOfstream::AtomicOfstream(const std::filesystem::path& path)
+    : std::ostream(nullptr), path(path), tmp_path(path.string() + ".tmp")
+{
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+        throw std::system_error(errno, std::generic_category(), "AtomicOfstream: could not open " + tmp_path.string());
+    buf = std::make_unique<Buffer>(fd);
+    rdbuf(buf.get());
+}
+
+AtomicOfstream::~AtomicOfstream() {
+    if (!committed) {
+        buf.reset();
+        std::error_code ec;
+        std::filesystem::remove(tmp_path, ec);
+    }
+}
+
+FileDigest AtomicOfstream::commit() {
+    flush();
+    if (fail() || buf->error)
+        throw std::runtime_error("AtomicOfstream: failed writing " + tmp_path.string()
+                                 + (buf->error ? std::string(": ") + std::strerror(buf->error) : ""));
+
+    FileDigest digest {path.filename().string(), buf->end, buf->crc};
+    if (!buf->crc_valid)
+        digest.crc32 = file_digest(tmp_path).crc32;
+    if (fsync(buf->fd) == -1)
+        throw std::system_error(errno, std::generic_category(), "AtomicOfstream: fsync failed for " + tmp_path.string());
+    close(std::exchange(buf->fd, -1));
+    std::filesystem::rename(tmp_path, path);
+    committed = true;
+    return digest;
+}
+
+FileDigest file_digest(const std::filesystem::path& path) {
+    std::ifstream in_F(path, std::ios::binary);
+    if (!in_F.is_open())
+        throw std::runtime_error("file_digest: could not open " + path.string());
+    FileDigest digest {path.filename().string()};
+    std::vector<char> chunk(buffer_size);
+    while (in_F.read(chunk.data(), chunk.size()) || in_F.gcount() > 0) {
+        digest.crc32 = crc32_update(digest.crc32, chunk.data(), in_F.gcount());
+        digest.bytes += in_F.gcount();
+    }
+    return digest;
+}
+
+void commit_file(const std::filesystem::path& tmp_path, const std::filesystem::path& path) {
+    fsync_path(tmp_path, O_RDONLY);
+    std::filesystem::rename(tmp_path, path);
+}
+
+void write_manifest(const std::filesystem::path& out_dir, std::vector<FileDigest> digests) {
+    std::sort(digests.begin(), digests.end(),
+              [](const FileDigest& a, const FileDigest& b) { return a.file < b.file; });
+
+    AtomicOfstream manifest_F(out_dir / "manifest.tsv");
+    manifest_F << "file" << '\t' << "bytes" << '\t' << "crc32" << '\n';
+    char crc_hex[9];
+    for (const FileDigest& digest : digests) {
+        std::snprintf(crc_hex, sizeof(crc_hex), "%08x", digest.crc32);
+        manifest_F << digest.file << '\t' << digest.bytes << '\t' << crc_hex << '\n';
+    }
+    manifest_F.commit();
+    fsync_path(out_dir, O_RDONLY | O_DIRECTORY);
+}
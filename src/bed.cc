@@ -0,0 +1,315 @@
+#include <vector>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <algorithm>
+#include <numeric>
+#include <thread>
+#include <charconv>
+#include <cstring>
+#include <cstdlib>
+#include <stdexcept>
+#include <zlib.h>
+#include <bigWigs2tensors/bed.h>
+#include <bigWigs2tensors/intervals.h>
+#include <bigWigs2tensors/mapped_file.h>
+#include <bigWigs2tensors/log.h>
+
+namespace {
+
+// smallest part worth its own thread
+constexpr size_t min_part_bytes = 1 << 20;
+constexpr size_t gz_read_bytes = 1 << 20;
+
+// one thread's intervals, by chromosome index, and the counts it left out
+struct PartIntervals {
+    std::vector<std::vector<Interval>> by_chrom;
+    size_t unknown_chrom = 0;
+    size_t empty = 0;
+};
+
+bool is_gzip(const char* data, size_t len) {
+    return len >= 2 && static_cast<unsigned char>(data[0]) == 0x1f && static_cast<unsigned char>(data[1]) == 0x8b;
+}
+
+// all of a gzipped file, concatenated members included
+std::vector<char> read_gzip(const std::string& path) {
+    gzFile gz = gzopen(path.c_str(), "rb");
+    if (!gz)
+        throw std::runtime_error("parse_coords_bed: could not open " + path);
+    gzbuffer(gz, 1 << 17);
+    std::vector<char> text;
+    while (true) {
+        size_t len = text.size();
+        text.resize(len + gz_read_bytes);
+        int n = gzread(gz, text.data() + len, gz_read_bytes);
+        if (n < 0) {
+            int errnum;
+            std::string msg = gzerror(gz, &errnum);
+            gzclose(gz);
+            throw std::runtime_error("parse_coords_bed: could not decompress " + path + ": " + msg);
+        }
+        text.resize(len + n);
+        if (n == 0)
+            break;
+    }
+    gzclose(gz);
+    return text;
+}
+
+// 1-based line number of byte `offset`, only counted when reporting an error
+size_t line_number(const char* data, size_t offset) {
+    return 1 + std::count(data, data + offset, '\n');
+}
+
+bool is_sep(char c) {
+    return c == '\t' || c == ' ';
+}
+
+// a BED file's text: mapped, or decompressed into memory if gzipped
+struct BedText {
+    MappedFile mapping;
+    std::vector<char> inflated;
+    const char* data;
+    size_t len;
+
+    explicit BedText(const std::string& path) : mapping(MappedFile::open_read(path)), data(mapping.data()), len(mapping.size()) {
+        if (is_gzip(data, len)) {
+            inflated = read_gzip(path);
+            data = inflated.data();
+            len = inflated.size();
+        }
+    }
+};
+
+// bounds of parts of about equal size, one per thread, each moved on to just past a line break
+std::vector<const char*> part_bounds(const char* data, size_t len) {
+    size_t n_parts = std::clamp<size_t>(len / min_part_bytes, 1, std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<const char*> bounds {data};
+    for (size_t i = 1; i < n_parts; i++) {
+        const char* at = std::max(bounds.back(), data + len * i / n_parts);
+        const char* eol = static_cast<const char*>(std::memchr(at, '\n', data + len - at));
+        bounds.push_back(eol ? eol + 1 : data + len);
+    }
+    bounds.push_back(data + len);
+    return bounds;
+}
+
+// calls `on_line(line, first, line_end)` for each line of [first, last) that is not blank, a comment or
+// a header, `first` its first non-separator
+template <typename OnLine>
+void for_each_record(const char* first, const char* last, OnLine&& on_line) {
+    const char* line = first;
+    while (line < last) {
+        // memchr is vectorized, the bulk of the bytes are only ever seen by it
+        const char* eol = static_cast<const char*>(std::memchr(line, '\n', last - line));
+        if (!eol)
+            eol = last;
+        const char* line_end = eol > line && eol[-1] == '\r' ? eol - 1 : eol;
+
+        const char* p = line;
+        while (p < line_end && is_sep(*p))
+            p++;
+        std::string_view rest(p, line_end - p);
+        if (!rest.empty() && rest[0] != '#' && rest.rfind("track", 0) != 0 && rest.rfind("browser", 0) != 0)
+            on_line(line, p, line_end);
+        line = eol + 1;
+    }
+}
+
+// the field starting at or after `from`, nullptr at the end of the line
+const char* next_field(const char* from, const char* line_end, const char*& field_end) {
+    while (from < line_end && is_sep(*from))
+        from++;
+    if (from == line_end)
+        return nullptr;
+    field_end = from;
+    while (field_end < line_end && !is_sep(*field_end))
+        field_end++;
+    return from;
+}
+
+// parses the number field after `from` into `val`, returning its end, or nullptr if it is not one
+template <typename T>
+const char* number_field(const char* from, const char* line_end, T& val) {
+    const char* field_end;
+    const char* field = next_field(from, line_end, field_end);
+    if (!field)
+        return nullptr;
+    auto [ptr, ec] = std::from_chars(field, field_end, val);
+    if (ec != std::errc() || ptr != field_end)
+        return nullptr;
+    return field_end;
+}
+
+[[noreturn]] void throw_bad_line(const char* data, const char* line, const char* line_end, const std::string& path,
+                                 const std::string& what, const std::string& problem = "is not a chromosome, start and end") {
+    throw std::invalid_argument(what + ": line " + std::to_string(line_number(data, line - data)) + " of "
+                                + path + " " + problem + ": " + std::string(line, line_end));
+}
+
+// parses the lines of [first, last), which starts at a line and ends at one's end
+void parse_part(const char* data, const char* first, const char* last,
+                const std::unordered_map<std::string_view, uint32_t>& chrom_idxs, const std::vector<uint64_t>& sizes,
+                const std::string& path, PartIntervals& part) {
+    part.by_chrom.resize(sizes.size());
+    for_each_record(first, last, [&](const char* line, const char* p, const char* line_end) {
+        const char* chrom_end = p;
+        while (chrom_end < line_end && !is_sep(*chrom_end))
+            chrom_end++;
+        uint64_t start, end;
+        const char* after_start = number_field(chrom_end, line_end, start);
+        const char* after_end = after_start ? number_field(after_start, line_end, end) : nullptr;
+        if (!after_end || end < start)
+            throw_bad_line(data, line, line_end, path, "parse_coords_bed");
+
+        auto chrom_idx = chrom_idxs.find(std::string_view(p, chrom_end - p));
+        if (chrom_idx == chrom_idxs.end()) {
+            part.unknown_chrom++;
+            return;
+        }
+        end = std::min(end, sizes[chrom_idx->second]);
+        if (start < end)
+            part.by_chrom[chrom_idx->second].push_back({start, end});
+        else
+            part.empty++;
+    });
+}
+
+// one thread's regions, in file order, and the counts it left out
+struct PartRegions {
+    std::vector<BedRegion> regions;
+    size_t unknown_chrom = 0;
+    size_t outside = 0;
+};
+
+void parse_regions_part(const char* data, const char* first, const char* last,
+                        const std::map<std::string, int>& chrom_sizes, const std::string& path, PartRegions& part) {
+    for_each_record(first, last, [&](const char* line, const char* p, const char* line_end) {
+        const char* chrom_end = p;
+        while (chrom_end < line_end && !is_sep(*chrom_end))
+            chrom_end++;
+        uint32_t start, end;
+        const char* after_start = number_field(chrom_end, line_end, start);
+        const char* after_end = after_start ? number_field(after_start, line_end, end) : nullptr;
+        if (!after_end || end < start)
+            throw_bad_line(data, line, line_end, path, "parse_regions_bed");
+
+        auto chrom_size = chrom_sizes.find(std::string(p, chrom_end));
+        if (chrom_size == chrom_sizes.end()) {
+            part.unknown_chrom++;
+            return;
+        }
+
+        // the name, then columns 5 to 9 skipped to narrowPeak's 10th, the summit's offset from start
+        std::string_view name = ".";
+        const char* field_end = after_end;
+        const char* field = next_field(after_end, line_end, field_end);
+        if (field)
+            name = std::string_view(field, field_end - field);
+        for (int col = 5; col <= 10 && field; col++)
+            field = next_field(field_end, line_end, field_end);
+        // 64-bit, so that no offset wraps around into the chromosome
+        uint64_t summit = start + uint64_t(end - start) / 2;
+        if (field) {
+            int64_t offset;
+            if (!number_field(field, line_end, offset))
+                throw_bad_line(data, line, line_end, path, "parse_regions_bed", "has a summit offset that is not a number");
+            // -1 when no summit was called, else within the peak
+            if (offset != -1 && (offset < 0 || uint64_t(offset) >= end - start))
+                throw_bad_line(data, line, line_end, path, "parse_regions_bed", "has a summit offset outside its interval");
+            if (offset != -1)
+                summit = start + uint64_t(offset);
+        }
+
+        if (summit >= uint64_t(chrom_size->second))
+            part.outside++;
+        else
+            part.regions.push_back({chrom_size->first, uint32_t(summit), std::string(name)});
+    });
+}
+
+
+}  // namespace
+
+chroms_coords_map_t parse_coords_bed(const std::string& coords_bed_path, const std::map<std::string, int>& chrom_sizes) {
+    BedText text(coords_bed_path);
+    const char* data = text.data;
+
+    // chromosome names to indices, viewing the map's keys
+    std::unordered_map<std::string_view, uint32_t> chrom_idxs;
+    std::vector<const std::string*> chrom_names;
+    std::vector<uint64_t> sizes;
+    for (const auto& [chrom, size] : chrom_sizes) {
+        chrom_idxs.emplace(chrom, chrom_names.size());
+        chrom_names.push_back(&chrom);
+        sizes.push_back(size);
+    }
+
+    std::vector<const char*> bounds = part_bounds(data, text.len);
+    size_t n_parts = bounds.size() - 1;
+
+    std::vector<PartIntervals> parts(n_parts);
+    std::vector<size_t> part_idxs(n_parts);
+    std::iota(part_idxs.begin(), part_idxs.end(), 0);
+    parallel_for_each(part_idxs.begin(), part_idxs.end(),
+                    [data, &bounds, &chrom_idxs, &sizes, &coords_bed_path, &parts](size_t i) {
+                        parse_part(data, bounds[i], bounds[i+1], chrom_idxs, sizes, coords_bed_path, parts[i]);
+                    });
+
+    // each chromosome's intervals gathered from the parts, in file order, then sorted
+    std::vector<size_t> chrom_order(sizes.size());
+    std::iota(chrom_order.begin(), chrom_order.end(), 0);
+    std::vector<IntervalIndex> indexes(sizes.size());
+    parallel_for_each(chrom_order.begin(), chrom_order.end(),
+                    [&parts, &indexes](size_t c) {
+                        std::vector<Interval> intervals = std::move(parts[0].by_chrom[c]);
+                        for (size_t i = 1; i < parts.size(); i++)
+                            intervals.insert(intervals.end(), parts[i].by_chrom[c].begin(), parts[i].by_chrom[c].end());
+                        indexes[c] = IntervalIndex(std::move(intervals));
+                    });
+
+    chroms_coords_map_t chroms_coords;
+    size_t unknown_chrom = 0, empty = 0;
+    for (const PartIntervals& part : parts) {
+        unknown_chrom += part.unknown_chrom;
+        empty += part.empty;
+    }
+    for (size_t c = 0; c < sizes.size(); c++) {
+        if (!indexes[c].empty()) {
+            BW_LOG_DEBUG(indexes[c].size() << " intervals for " << *chrom_names[c]);
+            chroms_coords.emplace(*chrom_names[c], std::move(indexes[c]));
+        }
+    }
+    BW_LOG_INFO(coords_bed_path << ": intervals on " << chroms_coords.size() << " chromosomes, in " << n_parts << " parts; "
+                << unknown_chrom << " on chromosomes not in the chrom sizes and " << empty << " empty left out");
+    return chroms_coords;
+}
+
+std::vector<BedRegion> parse_regions_bed(const std::string& regions_bed_path, const std::map<std::string, int>& chrom_sizes) {
+    BedText text(regions_bed_path);
+    std::vector<const char*> bounds = part_bounds(text.data, text.len);
+    size_t n_parts = bounds.size() - 1;
+
+    std::vector<PartRegions> parts(n_parts);
+    std::vector<size_t> part_idxs(n_parts);
+    std::iota(part_idxs.begin(), part_idxs.end(), 0);
+    parallel_for_each(part_idxs.begin(), part_idxs.end(),
+                    [&text, &bounds, &chrom_sizes, &regions_bed_path, &parts](size_t i) {
+                        parse_regions_part(text.data, bounds[i], bounds[i+1], chrom_sizes, regions_bed_path, parts[i]);
+                    });
+
+    // the parts are consecutive, so concatenating them keeps the file's order
+    std::vector<BedRegion> regions = std::move(parts[0].regions);
+    size_t unknown_chrom = parts[0].unknown_chrom, outside = parts[0].outside;
+    for (size_t i = 1; i < n_parts; i++) {
+        regions.insert(regions.end(), std::make_move_iterator(parts[i].regions.begin()),
+                       std::make_move_iterator(parts[i].regions.end()));
+        unknown_chrom += parts[i].unknown_chrom;
+        outside += parts[i].outside;
+    }
+    BW_LOG_INFO(regions_bed_path << ": " << regions.size() << " regions, in " << n_parts << " parts; " << unknown_chrom
+                << " on chromosomes not in the chrom sizes and " << outside << " with summits past their chromosome's end left out");
+    return regions;
+}
@@ -0,0 +1,74 @@
+#include <vector>
+#include <map>
+#include <string>
+#include <memory>
+#include <filesystem>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <bigWig.h>
+#include <bigWigs2tensors/bigwig_out.h>
+#include <bigWigs2tensors/mem_stats.h>
+
+namespace {
+
+// values converted to float per libBigWig call
+constexpr size_t convert_chunk = 1 << 16;
+
+void check(int status, const std::string& what, const std::filesystem::path& path) {
+    if (status != 0)
+        throw std::runtime_error("write_binned_bigWig: " + what + " failed for " + path.string());
+}
+
+}  // namespace
+
+FileDigest write_binned_bigWig(const std::filesystem::path& path, const std::map<std::string, int>& chrom_sizes,
+                               const std::vector<BinnedSegment>& segments, uint32_t bin_size, int32_t max_zooms) {
+    std::filesystem::path tmp_path = path.string() + ".tmp";
+    // closed, writing the index and zoom levels, however this returns
+    std::unique_ptr<bigWigFile_t, decltype(&bwClose)> bw(bwOpen(tmp_path.c_str(), NULL, "w"), &bwClose);
+    if (!bw)
+        throw std::runtime_error("write_binned_bigWig: could not open " + tmp_path.string());
+    check(bwCreateHdr(bw.get(), max_zooms), "bwCreateHdr", path);
+
+    std::vector<const char*> chroms;
+    std::vector<uint32_t> lengths;
+    for (const auto& [chrom, size] : chrom_sizes) {
+        chroms.push_back(chrom.c_str());
+        lengths.push_back(size);
+    }
+    bw->cl = bwCreateChromList(chroms.data(), lengths.data(), chroms.size());
+    if (!bw->cl)
+        throw std::runtime_error("write_binned_bigWig: bwCreateChromList failed for " + path.string());
+    check(bwWriteHdr(bw.get()), "bwWriteHdr", path);
+
+    bwmem::vector<float, bwmem::Pool::serialization> vals;
+    for (const BinnedSegment& seg : segments) {
+        size_t i = 0;
+        while (i < seg.n) {
+            // skip to the next run of non-NaN bins
+            while (i < seg.n && std::isnan(seg.vals[i*seg.stride]))
+                i++;
+            size_t run_end = i;
+            while (run_end < seg.n && !std::isnan(seg.vals[run_end*seg.stride]))
+                run_end++;
+            // added in chunks, a new block for the run's first one
+            for (size_t lo = i; lo < run_end; lo += convert_chunk) {
+                size_t n = std::min(convert_chunk, run_end - lo);
+                vals.resize(n);
+                for (size_t b = 0; b < n; b++) {
+                    vals[b] = seg.vals[(lo + b)*seg.stride];
+                }
+                if (lo == i)
+                    check(bwAddIntervalSpanSteps(bw.get(), seg.chrom.c_str(), seg.start + lo*bin_size, bin_size, bin_size, vals.data(), n),
+                          "bwAddIntervalSpanSteps", path);
+                else
+                    check(bwAppendIntervalSpanSteps(bw.get(), vals.data(), n), "bwAppendIntervalSpanSteps", path);
+            }
+            i = run_end;
+        }
+    }
+    bw.reset();
+    commit_file(tmp_path, path);
+    return file_digest(path);
+}
@@ -0,0 +1,252 @@
+#include <vector>
+#include <array>
+#include <string>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <numeric>
+#include <chrono>
+#include <thread>
+#include <cstring>
+#include <stdexcept>
+#include <memory>
+#include <zlib.h>
+#include <zstd.h>
+#include <bigWigs2tensors/bsz.h>
+#include <bigWigs2tensors/util.h>
+#include <bigWigs2tensors/mem_stats.h>
+
+namespace {
+
+using Bytes = bwmem::vector<char, bwmem::Pool::serialization>;
+
+constexpr std::array<const char*, 2> codec_names {"zstd", "zlib"};
+
+const char bsz_magic[] = "\x93" "BWSHUF" "\x01";
+constexpr size_t magic_len = sizeof(bsz_magic) - 1;
+// blocks compressed in parallel per hardware thread before being written out,
+// bounding the compressed data held in memory
+constexpr size_t blocks_per_thread = 4;
+
+void put_u64(std::string& out, uint64_t val) {
+    for (int i = 0; i < 8; i++) {
+        out += static_cast<char>((val >> (8*i)) & 0xFF);
+    }
+}
+
+uint64_t get_u64(const char* bytes) {
+    uint64_t val = 0;
+    for (int i = 7; i >= 0; i--) {
+        val = (val << 8) | static_cast<unsigned char>(bytes[i]);
+    }
+    return val;
+}
+
+// byte `b` of element `i` goes to b*n + i
+void shuffle(const char* in, char* out, size_t n, size_t itemsize) {
+    for (size_t i = 0; i < n; i++) {
+        for (size_t b = 0; b < itemsize; b++) {
+            out[b*n + i] = in[i*itemsize + b];
+        }
+    }
+}
+
+void unshuffle(const char* in, char* out, size_t n, size_t itemsize) {
+    for (size_t b = 0; b < itemsize; b++) {
+        for (size_t i = 0; i < n; i++) {
+            out[i*itemsize + b] = in[b*n + i];
+        }
+    }
+}
+
+// converts, shuffles and compresses elements [lo, hi) of `data` into `out`
+void compress_block(const double* data, size_t lo, size_t hi, const BszOptions& opts, Bytes& out) {
+    size_t n = hi - lo;
+    size_t itemsize = npy_itemsize(opts.dtype);
+    Bytes raw(n * itemsize);
+    if (opts.dtype == NpyDtype::float32)
+        std::copy_n(data + lo, n, reinterpret_cast<float*>(raw.data()));
+    else
+        std::memcpy(raw.data(), data + lo, n * itemsize);
+
+    Bytes shuffled(raw.size());
+    shuffle(raw.data(), shuffled.data(), n, itemsize);
+
+    if (opts.codec == BszCodec::zlib) {
+        out.resize(compressBound(shuffled.size()));
+        uLongf compressed_size = out.size();
+        if (compress2(reinterpret_cast<Bytef*>(out.data()), &compressed_size,
+                      reinterpret_cast<const Bytef*>(shuffled.data()), shuffled.size(), opts.level) != Z_OK)
+            throw std::runtime_error("write_bsz: zlib failed compressing a block");
+        out.resize(compressed_size);
+        return;
+    }
+    // a context per writer thread, reused across blocks and files rather than set up for each block
+    thread_local std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> cctx(ZSTD_createCCtx(), &ZSTD_freeCCtx);
+    out.resize(ZSTD_compressBound(shuffled.size()));
+    size_t compressed_size = ZSTD_compressCCtx(cctx.get(), out.data(), out.size(), shuffled.data(), shuffled.size(), opts.level);
+    if (ZSTD_isError(compressed_size))
+        throw std::runtime_error(std::string("write_bsz: zstd failed compressing a block: ") + ZSTD_getErrorName(compressed_size));
+    out.resize(compressed_size);
+}
+
+// decompresses `compressed` into all of `raw`, false if it is corrupt or not exactly that size
+bool decompress_block(BszCodec codec, const std::vector<char>& compressed, std::vector<char>& raw) {
+    if (codec == BszCodec::zlib) {
+        uLongf raw_size = raw.size();
+        return uncompress(reinterpret_cast<Bytef*>(raw.data()), &raw_size,
+                          reinterpret_cast<const Bytef*>(compressed.data()), compressed.size()) == Z_OK
+               && raw_size == raw.size();
+    }
+    size_t raw_size = ZSTD_decompress(raw.data(), raw.size(), compressed.data(), compressed.size());
+    return !ZSTD_isError(raw_size) && raw_size == raw.size();
+}
+
+// value of `"key":` in the flat JSON header, up to the next ',' or '}' (or ']' after a '[')
+std::string json_field(const std::string& json, const std::string& key) {
+    size_t pos = json.find("\"" + key + "\":");
+    if (pos == std::string::npos)
+        throw std::runtime_error("read_bsz_index: header is missing " + key);
+    pos += key.size() + 3;
+    size_t end = json[pos] == '[' ? json.find(']', pos) + 1 : json.find_first_of(",}", pos);
+    return json.substr(pos, end - pos);
+}
+
+}  // namespace
+
+BszCodec parse_bsz_codec(const std::string& name) {
+    for (size_t i = 0; i < codec_names.size(); i++) {
+        if (name == codec_names[i])
+            return static_cast<BszCodec>(i);
+    }
+    throw std::invalid_argument("parse_bsz_codec: unknown codec " + name);
+}
+
+BszStats& BszStats::operator+=(const BszStats& other) {
+    raw_bytes += other.raw_bytes;
+    compressed_bytes += other.compressed_bytes;
+    seconds += other.seconds;
+    return *this;
+}
+
+BszStats write_bsz(const std::filesystem::path& path, const double* data, size_t rows, size_t cols,
+                   const BszOptions& opts) {
+    if (opts.block_elems == 0)
+        throw std::invalid_argument("write_bsz: blocks must hold at least one element");
+    auto t_start = std::chrono::steady_clock::now();
+
+    std::string json = "{\"dtype\":\"" + npy_descr(opts.dtype) + "\",\"shape\":[" + std::to_string(rows) + "," + std::to_string(cols) + "],"
+                       "\"block_elems\":" + std::to_string(opts.block_elems) + ",\"codec\":\"" + codec_names[static_cast<int>(opts.codec)] + "\",\"level\":" + std::to_string(opts.level) + ","
+                       "\"shuffle\":\"byte\"}";
+    json.resize(json.size() + (8 - (magic_len + 4 + json.size()) % 8) % 8, ' ');
+    std::string header(bsz_magic, magic_len);
+    for (int i = 0; i < 4; i++) {
+        header += static_cast<char>((json.size() >> (8*i)) & 0xFF);
+    }
+    header += json;
+
+    size_t numel = rows * cols;
+    size_t num_blocks = (numel + opts.block_elems - 1) / opts.block_elems;
+    put_u64(header, num_blocks);
+    const size_t index_pos = header.size();
+    std::vector<uint64_t> offsets(num_blocks + 1, 0);
+
+    AtomicOfstream out_F(path);
+    out_F.write(header.data(), header.size());
+    // block index placeholder, filled in once the blocks are written
+    std::string index(offsets.size() * 8, '\0');
+    out_F.write(index.data(), index.size());
+
+    size_t batch = std::max(1u, std::thread::hardware_concurrency()) * blocks_per_thread;
+    std::vector<Bytes> compressed(std::min(batch, num_blocks));
+    std::vector<size_t> batch_blocks;
+    for (size_t batch_lo = 0; batch_lo < num_blocks; batch_lo += batch) {
+        size_t batch_hi = std::min(batch_lo + batch, num_blocks);
+        batch_blocks.resize(batch_hi - batch_lo);
+        std::iota(batch_blocks.begin(), batch_blocks.end(), batch_lo);
+        parallel_for_each(batch_blocks.begin(), batch_blocks.end(),
+                        [data, numel, batch_lo, &opts, &compressed](size_t block) {
+                            size_t lo = block * opts.block_elems;
+                            compress_block(data, lo, std::min(lo + opts.block_elems, numel), opts, compressed[block - batch_lo]);
+                        });
+        for (size_t block = batch_lo; block < batch_hi; block++) {
+            const Bytes& bytes = compressed[block - batch_lo];
+            out_F.write(bytes.data(), bytes.size());
+            offsets[block + 1] = offsets[block] + bytes.size();
+        }
+    }
+
+    index.clear();
+    for (uint64_t offset : offsets) {
+        put_u64(index, offset);
+    }
+    out_F.seekp(index_pos);
+    out_F.write(index.data(), index.size());
+
+    BszStats stats;
+    stats.digest = out_F.commit();
+    stats.raw_bytes = numel * npy_itemsize(opts.dtype);
+    stats.compressed_bytes = header.size() + index.size() + offsets.back();
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+    return stats;
+}
+
+BszIndex read_bsz_index(const std::filesystem::path& path) {
+    std::ifstream in_F(path, std::ios::binary);
+    char preamble[magic_len + 4];
+    if (!in_F.read(preamble, sizeof(preamble)) || std::memcmp(preamble, bsz_magic, magic_len) != 0)
+        throw std::runtime_error("read_bsz_index: not a .bsz file: " + path.string());
+    uint32_t json_len = 0;
+    for (int i = 3; i >= 0; i--) {
+        json_len = (json_len << 8) | static_cast<unsigned char>(preamble[magic_len + i]);
+    }
+    std::string json(json_len, '\0');
+    in_F.read(json.data(), json_len);
+
+    BszIndex index;
+    std::string descr = json_field(json, "dtype");
+    index.dtype = descr == "\"<f4\"" ? NpyDtype::float32 : NpyDtype::float64;
+    std::string codec = json_field(json, "codec");
+    if (codec == "\"zstd\"")
+        index.codec = BszCodec::zstd;
+    else if (codec == "\"zlib\"")
+        index.codec = BszCodec::zlib;
+    else
+        throw std::runtime_error("read_bsz_index: unknown codec " + codec + " in " + path.string());
+    std::string shape = json_field(json, "shape");
+    size_t comma = shape.find(',');
+    index.shape = {std::stoul(shape.substr(1, comma - 1)), std::stoul(shape.substr(comma + 1))};
+    index.block_elems = std::stoul(json_field(json, "block_elems"));
+
+    char count[8];
+    in_F.read(count, 8);
+    std::vector<char> offsets((get_u64(count) + 1) * 8);
+    in_F.read(offsets.data(), offsets.size());
+    if (!in_F)
+        throw std::runtime_error("read_bsz_index: truncated block index in " + path.string());
+    for (size_t i = 0; i < offsets.size(); i += 8) {
+        index.offsets.push_back(get_u64(offsets.data() + i));
+    }
+    index.data_start = in_F.tellg();
+    return index;
+}
+
+std::vector<char> read_bsz_block(const std::filesystem::path& path, const BszIndex& index, size_t block) {
+    if (block >= index.num_blocks())
+        throw std::out_of_range("read_bsz_block: no block " + std::to_string(block) + " in " + path.string());
+    std::ifstream in_F(path, std::ios::binary);
+    std::vector<char> compressed(index.offsets[block + 1] - index.offsets[block]);
+    in_F.seekg(index.data_start + index.offsets[block]);
+    in_F.read(compressed.data(), compressed.size());
+
+    size_t itemsize = npy_itemsize(index.dtype);
+    size_t numel = index.shape[0] * index.shape[1];
+    size_t n = std::min(index.block_elems, numel - block*index.block_elems);
+    std::vector<char> shuffled(n * itemsize);
+    if (!in_F || !decompress_block(index.codec, compressed, shuffled))
+        throw std::runtime_error("read_bsz_block: corrupt block " + std::to_string(block) + " in " + path.string());
+
+    std::vector<char> raw(shuffled.size());
+    unshuffle(shuffled.data(), raw.data(), n, itemsize);
+    return raw;
+}
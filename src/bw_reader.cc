@@ -0,0 +1,134 @@
+#include <vector>
+#include <string>
+#include <memory>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <bit>
+#include <zlib.h>
+#include <bigWig.h>
+// libBigWig's internal block-level reading, its header lacks C linkage
+extern "C" {
+#include <bwCommon.h>
+}
+#include <bigWigs2tensors/bw_reader.h>
+
+// block items are read as little-endian, straight from the decompressed bytes
+static_assert(std::endian::native == std::endian::little, "bigWig reader assumes a little-endian host");
+
+namespace {
+
+// on-disk data block header: tid, start, end, step, span (u32), type, reserved (u8), item count (u16)
+constexpr size_t block_header_len = 24;
+enum BlockType : uint8_t { bed_graph = 1, var_step = 2, fixed_step = 3 };
+
+template <typename T>
+T get(const char* bytes) {
+    T val;
+    std::memcpy(&val, bytes, sizeof(T));
+    return val;
+}
+
+// grows `buf` to at least `n`, to exactly `n` so what is held stays within a known bound, counting the allocation
+template <typename Buf>
+void reserve(Buf& buf, size_t n, BinScratch& scratch) {
+    if (buf.size() < n) {
+        buf.reserve(n);
+        buf.resize(n);
+        scratch.allocations++;
+    }
+}
+
+struct BlocksDeleter {
+    void operator()(bwOverlapBlock_t* blocks) const { destroyBWOverlapBlock(blocks); }
+};
+
+}  // namespace
+
+void read_bin_means(bigWigFile_t* bw, const std::string& chrom, uint32_t start, uint32_t bin_size, uint32_t n_bins,
+                    double* out, BinScratch& scratch) {
+    const uint32_t end = start + n_bins * bin_size;
+    scratch.fetches++;
+    reserve(scratch.sums, n_bins, scratch);
+    reserve(scratch.covered, n_bins, scratch);
+    std::fill_n(scratch.sums.begin(), n_bins, 0.0);
+    std::fill_n(scratch.covered.begin(), n_bins, 0u);
+
+    // adds `val` over [lo, hi) to the bins it overlaps
+    auto add = [&scratch, start, end, bin_size](uint32_t lo, uint32_t hi, float val) {
+        lo = std::max(lo, start);
+        hi = std::min(hi, end);
+        for (uint32_t pos = lo; pos < hi; ) {
+            uint32_t bin = (pos - start) / bin_size;
+            uint32_t bin_end = std::min(start + (bin + 1) * bin_size, hi);
+            scratch.sums[bin] += double(val) * (bin_end - pos);
+            scratch.covered[bin] += bin_end - pos;
+            pos = bin_end;
+        }
+    };
+
+    uint32_t tid = bwGetTid(bw, chrom.c_str());
+    if (tid != uint32_t(-1) && n_bins > 0) {
+        if (!bw->idx)
+            bw->idx = bwReadIndex(bw, bw->hdr->indexOffset);
+        if (!bw->idx)
+            throw std::runtime_error("read_bin_means: could not read the bigWig's index");
+        std::unique_ptr<bwOverlapBlock_t, BlocksDeleter> blocks(walkRTreeNodes(bw, bw->idx->root, tid, start, end));
+        scratch.allocations++;
+        for (uint64_t i = 0; blocks && i < blocks->n; i++) {
+            // the previous fetch's last block is usually the next one's first, already at hand
+            if (blocks->offset[i] != scratch.block_offset || bw != scratch.block_file) {
+                reserve(scratch.stored, blocks->size[i], scratch);
+                if (bwSetPos(bw, blocks->offset[i]) || bwRead(scratch.stored.data(), blocks->size[i], 1, bw) != 1)
+                    throw std::runtime_error("read_bin_means: could not read a data block of " + chrom);
+                scratch.block_len = blocks->size[i];
+                if (bw->hdr->bufSize) {
+                    reserve(scratch.block, bw->hdr->bufSize, scratch);
+                    uLongf block_len = scratch.block.size();
+                    if (uncompress(reinterpret_cast<Bytef*>(scratch.block.data()), &block_len,
+                                   reinterpret_cast<const Bytef*>(scratch.stored.data()), scratch.block_len) != Z_OK)
+                        throw std::runtime_error("read_bin_means: could not decompress a data block of " + chrom);
+                    scratch.block_len = block_len;
+                }
+                scratch.block_file = bw;
+                scratch.block_offset = blocks->offset[i];
+            }
+            const char* data = bw->hdr->bufSize ? scratch.block.data() : scratch.stored.data();
+            size_t len = scratch.block_len;
+            if (len < block_header_len || get<uint32_t>(data) != tid)
+                continue;
+
+            uint32_t block_start = get<uint32_t>(data + 4);
+            uint32_t step = get<uint32_t>(data + 12);
+            uint32_t span = get<uint32_t>(data + 16);
+            uint8_t type = get<uint8_t>(data + 20);
+            uint16_t n_items = get<uint16_t>(data + 22);
+            const char* item = data + block_header_len;
+            const size_t item_len = type == bed_graph ? 12 : type == var_step ? 8 : 4;
+            if (block_header_len + n_items * item_len > len)
+                throw std::runtime_error("read_bin_means: truncated data block of " + chrom);
+            for (uint16_t j = 0; j < n_items; j++, item += item_len) {
+                switch (type) {
+                    case bed_graph:
+                        add(get<uint32_t>(item), get<uint32_t>(item + 4), get<float>(item + 8));
+                        break;
+                    case var_step: {
+                        uint32_t lo = get<uint32_t>(item);
+                        add(lo, lo + span, get<float>(item + 4));
+                        break;
+                    }
+                    case fixed_step: {
+                        uint32_t lo = block_start + j * step;
+                        add(lo, lo + span, get<float>(item));
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    for (uint32_t b = 0; b < n_bins; b++) {
+        out[b] = scratch.covered[b] ? scratch.sums[b] / scratch.covered[b] : std::nan("");
+    }
+}
@@ -0,0 +1,194 @@
+#include <vector>
+#include <map>
+#include <string>
+#include <algorithm>
+#include <bigWigs2tensors/intervals.h>
+#include <bigWigs2tensors/bed.h>
+#include <bigWigs2tensors/util.h>
+
+IntervalIndex::IntervalIndex(std::vector<Interval> intervals) {
+    intervals.erase(std::remove_if(intervals.begin(), intervals.end(), [](const Interval& x) { return x.start >= x.end; }),
+                    intervals.end());
+    std::sort(intervals.begin(), intervals.end(),
+              [](const Interval& a, const Interval& b) { return a.start < b.start || (a.start == b.start && a.end < b.end); });
+    const size_t n = intervals.size();
+    starts.resize(n);
+    ends.resize(n);
+    for (size_t i = 0; i < n; i++) {
+        starts[i] = intervals[i].start;
+        ends[i] = intervals[i].end;
+    }
+    if (n == 0)
+        return;
+
+    // bottom-up over the implicit tree: the nodes at level k are the indices whose lowest k bits are all 1,
+    // the leaves the even ones; `last` tracks the largest end under the rightmost node, whose subtree is cut short
+    max_ends = ends;
+    size_t last_i = 0;
+    uint64_t last = 0;
+    for (size_t i = 0; i < n; i += 2) {
+        last_i = i;
+        last = max_ends[i];
+    }
+    int k = 1;
+    for (; (size_t(1) << k) <= n; k++) {
+        size_t x = size_t(1) << (k - 1);
+        for (size_t i = (x << 1) - 1; i < n; i += x << 2) {
+            uint64_t left = max_ends[i - x];
+            uint64_t right = i + x < n ? max_ends[i + x] : last;
+            max_ends[i] = std::max({ends[i], left, right});
+        }
+        // move on to the rightmost node's parent
+        last_i = (last_i >> k & 1) ? last_i - x : last_i + x;
+        if (last_i < n && max_ends[last_i] > last)
+            last = max_ends[last_i];
+    }
+    root_level = k - 1;
+}
+
+std::vector<unsigned> IntervalIndex::start_bins(unsigned bin_size) const {
+    std::vector<unsigned> start_bindxs(size() + 1);
+    start_bindxs[0] = 0;
+    for (size_t i = 0; i < size(); i++) {
+        // start of this interval is 1 + end of previous interval
+        start_bindxs[i+1] = start_bindxs[i] + num_bins_intersect_interval(starts[i], ends[i], bin_size);
+    }
+    return start_bindxs;
+}
+
+std::vector<size_t> IntervalIndex::overlapping(uint64_t start, uint64_t end) const {
+    std::vector<size_t> hits;
+    if (root_level < 0)
+        return hits;
+    const size_t n = size();
+    // top-down, left subtrees first, so the hits come out in order
+    struct Node {
+        int level;
+        size_t i;
+        bool left_done;
+    };
+    Node stack[64];
+    int top = 0;
+    stack[top++] = {root_level, (size_t(1) << root_level) - 1, false};
+    while (top) {
+        Node node = stack[--top];
+        if (node.level <= 3) {
+            // a small subtree, scanned in order
+            size_t lo = node.i >> node.level << node.level;
+            size_t hi = std::min(n, lo + (size_t(1) << (node.level + 1)) - 1);
+            for (size_t i = lo; i < hi && starts[i] < end; i++) {
+                if (start < ends[i])
+                    hits.push_back(i);
+            }
+        }
+        else if (!node.left_done) {
+            // the left child may be past the end, its subtree then only partly there
+            size_t left = node.i - (size_t(1) << (node.level - 1));
+            stack[top++] = {node.level, node.i, true};
+            if (left >= n || max_ends[left] > start)
+                stack[top++] = {node.level - 1, left, false};
+        }
+        else if (node.i < n && starts[node.i] < end) {
+            if (start < ends[node.i])
+                hits.push_back(node.i);
+            stack[top++] = {node.level - 1, node.i + (size_t(1) << (node.level - 1)), false};
+        }
+    }
+    return hits;
+}
+
+std::vector<char> IntervalIndex::overlapped_by(const std::vector<Interval>& regions) const {
+    std::vector<char> hit(size(), 0);
+    for (const Interval& region : regions) {
+        for (size_t i : overlapping(region.start, region.end))
+            hit[i] = 1;
+    }
+    return hit;
+}
+
+IntervalSet normalize_intervals(std::vector<Interval> intervals) {
+    std::sort(intervals.begin(), intervals.end(),
+              [](const Interval& a, const Interval& b) { return a.start < b.start; });
+    IntervalSet merged;
+    for (const Interval& interv : intervals) {
+        if (interv.start >= interv.end)
+            continue;
+        if (!merged.empty() && interv.start <= merged.back().end)
+            merged.back().end = std::max(merged.back().end, interv.end);
+        else
+            merged.push_back(interv);
+    }
+    return merged;
+}
+
+IntervalSet union_intervals(const IntervalSet& a, const IntervalSet& b) {
+    IntervalSet both;
+    both.reserve(a.size() + b.size());
+    // merged by start, then runs joined as in normalize_intervals
+    std::merge(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(both),
+               [](const Interval& x, const Interval& y) { return x.start < y.start; });
+    IntervalSet merged;
+    for (const Interval& interv : both) {
+        if (!merged.empty() && interv.start <= merged.back().end)
+            merged.back().end = std::max(merged.back().end, interv.end);
+        else
+            merged.push_back(interv);
+    }
+    return merged;
+}
+
+IntervalSet intersect_intervals(const IntervalSet& a, const IntervalSet& b) {
+    IntervalSet common;
+    size_t i = 0, j = 0;
+    while (i < a.size() && j < b.size()) {
+        uint64_t lo = std::max(a[i].start, b[j].start);
+        uint64_t hi = std::min(a[i].end, b[j].end);
+        if (lo < hi)
+            common.push_back({lo, hi});
+        // whichever ends first cannot overlap anything further
+        if (a[i].end < b[j].end)
+            i++;
+        else
+            j++;
+    }
+    return common;
+}
+
+std::vector<Interval> subtract_intervals(const std::vector<Interval>& a, const IntervalSet& b) {
+    std::vector<Interval> pieces;
+    pieces.reserve(a.size());
+    for (const Interval& interv : a) {
+        // first of `b` ending past the interval's start; a's starts only grow, but its ends need not
+        auto excl = std::upper_bound(b.begin(), b.end(), interv.start,
+                                     [](uint64_t pos, const Interval& x) { return pos < x.end; });
+        uint64_t at = interv.start;
+        for (; excl != b.end() && excl->start < interv.end; ++excl) {
+            if (excl->start > at)
+                pieces.push_back({at, excl->start});
+            at = std::max(at, excl->end);
+        }
+        if (at < interv.end)
+            pieces.push_back({at, interv.end});
+    }
+    // a long interval's later pieces can start past a following, shorter one's
+    std::sort(pieces.begin(), pieces.end(),
+              [](const Interval& x, const Interval& y) { return x.start < y.start || (x.start == y.start && x.end < y.end); });
+    return pieces;
+}
+
+std::map<std::string, IntervalSet> read_interval_sets(const std::string& path, const std::map<std::string, int>& chrom_sizes) {
+    // anything but a bigBed is read as a plain-text, or gzipped, BED
+    chroms_coords_map_t coords = bbIsBigBed(const_cast<char*>(path.c_str()), NULL) == 1 ? parse_coords_bigBed(path, chrom_sizes)
+                                                                                      : parse_coords_bed(path, chrom_sizes);
+    std::map<std::string, IntervalSet> sets;
+    for (const auto& [chrom, index] : coords) {
+        std::vector<Interval> intervals(index.size());
+        uint64_t size = chrom_sizes.at(chrom);
+        for (size_t i = 0; i < index.size(); i++)
+            intervals[i] = {index.start(i), std::min(index.end(i), size)};
+        IntervalSet set = normalize_intervals(std::move(intervals));
+        if (!set.empty())
+            sets.emplace(chrom, std::move(set));
+    }
+    return sets;
+}
@@ -0,0 +1,221 @@
+#include <array>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <memory>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <iostream>
+#include <bigWigs2tensors/log.h>
+
+namespace {
+
+constexpr size_t ring_slots = 1024;
+constexpr size_t msg_capacity = 248;
+// a longer message spans several slots, up to an eighth of the ring, and is cut short past that
+static_assert(bwlog::max_message_bytes == ring_slots / 8 * msg_capacity);
+constexpr std::array<const char*, 6> level_names {"trace", "debug", "info", "warn", "error", "off"};
+
+std::atomic<int> runtime_level {static_cast<int>(bwlog::Level::warn)};
+
+struct Entry {
+    bwlog::Level level;
+    // more of the message follows in the next slot
+    bool continued;
+    uint16_t len;
+    char msg[msg_capacity];
+};
+
+// single-producer (the owning thread), single-consumer (the drainer) ring of messages
+struct Ring {
+    std::array<Entry, ring_slots> entries;
+    // next slot to write, only advanced by the owning thread
+    std::atomic<size_t> head {0};
+    // next slot to print, only advanced by the drainer
+    std::atomic<size_t> tail {0};
+    std::atomic<size_t> dropped {0};
+    std::atomic<bool> thread_exited {false};
+};
+
+class Drainer {
+public:
+    Drainer() : thread([this] { run(); }) {}
+
+    ~Drainer() {
+        stopping = true;
+        wake();
+        thread.join();
+        drain();
+    }
+
+    std::shared_ptr<Ring> register_ring() {
+        auto ring = std::make_shared<Ring>();
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        rings.push_back(ring);
+        return ring;
+    }
+
+    void wake() {
+        woken = true;
+        wake_cv.notify_one();
+    }
+
+    // prints every queued message, ring by ring
+    void drain() {
+        std::vector<std::shared_ptr<Ring>> to_drain;
+        {
+            std::lock_guard<std::mutex> lock(rings_mutex);
+            to_drain = rings;
+        }
+
+        std::lock_guard<std::mutex> lock(print_mutex);
+        std::string out;
+        for (auto& ring : to_drain) {
+            size_t tail = ring->tail.load(std::memory_order_relaxed);
+            size_t head = ring->head.load(std::memory_order_acquire);
+            // whole messages only, their slots being published together
+            bool continuing = false;
+            for (; tail != head; tail++) {
+                const Entry& entry = ring->entries[tail % ring_slots];
+                if (!continuing) {
+                    out += '[';
+                    out += level_names[static_cast<int>(entry.level)];
+                    out += "] ";
+                }
+                out.append(entry.msg, entry.len);
+                continuing = entry.continued;
+                if (!continuing)
+                    out += '\n';
+            }
+            ring->tail.store(tail, std::memory_order_release);
+
+            if (size_t dropped = ring->dropped.exchange(0, std::memory_order_relaxed)) {
+                out += "[warn] " + std::to_string(dropped) + " log messages dropped, ring buffer full\n";
+            }
+        }
+        if (!out.empty()) {
+            std::cerr.write(out.data(), out.size());
+            std::cerr.flush();
+        }
+
+        // forget the rings of threads that have finished, once printed
+        std::lock_guard<std::mutex> rings_lock(rings_mutex);
+        std::erase_if(rings, [](const std::shared_ptr<Ring>& ring) {
+            return ring->thread_exited && ring->tail.load() == ring->head.load();
+        });
+    }
+
+private:
+    std::mutex rings_mutex;
+    std::vector<std::shared_ptr<Ring>> rings;
+    std::mutex print_mutex;
+    std::mutex wake_mutex;
+    std::condition_variable wake_cv;
+    std::atomic<bool> woken {false};
+    std::atomic<bool> stopping {false};
+    std::thread thread;
+
+    void run() {
+        while (!stopping) {
+            {
+                std::unique_lock<std::mutex> lock(wake_mutex);
+                // timed, since producers notify without taking the lock
+                wake_cv.wait_for(lock, std::chrono::milliseconds(50), [this] { return woken || stopping; });
+                woken = false;
+            }
+            drain();
+        }
+    }
+};
+
+Drainer& drainer() {
+    static Drainer instance;
+    return instance;
+}
+
+// the calling thread's ring, registered with the drainer on first use
+struct RingHandle {
+    std::shared_ptr<Ring> ring = drainer().register_ring();
+    ~RingHandle() { ring->thread_exited = true; }
+};
+
+thread_local RingHandle local_ring;
+
+}  // namespace
+
+namespace bwlog {
+
+void set_level(Level level) {
+    runtime_level.store(static_cast<int>(level), std::memory_order_relaxed);
+}
+
+Level level() {
+    return static_cast<Level>(runtime_level.load(std::memory_order_relaxed));
+}
+
+Level parse_level(const std::string& name) {
+    for (size_t i = 0; i < level_names.size(); i++) {
+        if (name == level_names[i])
+            return static_cast<Level>(i);
+    }
+    throw std::invalid_argument("bwlog::parse_level: unknown log level " + name);
+}
+
+bool enabled(Level level) {
+    return static_cast<int>(level) >= runtime_level.load(std::memory_order_relaxed);
+}
+
+void write(Level level, std::string_view msg) {
+    std::string cut;
+    if (msg.size() > max_message_bytes) {
+        // the marker counts the bytes left out, which its own length adds to
+        size_t keep = max_message_bytes;
+        std::string marker;
+        for (;;) {
+            marker = "...(+" + std::to_string(msg.size() - keep) + " bytes)";
+            if (keep + marker.size() <= max_message_bytes)
+                break;
+            keep = max_message_bytes - marker.size();
+        }
+        cut.reserve(max_message_bytes);
+        cut.append(msg.substr(0, keep)).append(marker);
+        msg = cut;
+    }
+    const size_t slots = std::max<size_t>(1, (msg.size() + msg_capacity - 1) / msg_capacity);
+
+    Ring& ring = *local_ring.ring;
+    size_t head = ring.head.load(std::memory_order_relaxed);
+
+    while (head + slots - ring.tail.load(std::memory_order_acquire) > ring_slots) {
+        drainer().wake();
+        if (level < Level::warn) {
+            ring.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        std::this_thread::yield();
+    }
+
+    for (size_t slot = 0; slot < slots; slot++) {
+        Entry& entry = ring.entries[(head + slot) % ring_slots];
+        entry.level = level;
+        entry.continued = slot + 1 < slots;
+        entry.len = std::min(msg.size() - slot * msg_capacity, msg_capacity);
+        std::memcpy(entry.msg, msg.data() + slot * msg_capacity, entry.len);
+    }
+    ring.head.store(head + slots, std::memory_order_release);
+
+    // don't let warnings wait, nor the ring fill up before the next timed drain
+    if (level >= Level::warn || head + slots - ring.tail.load(std::memory_order_relaxed) > ring_slots / 2)
+        drainer().wake();
+}
+
+void flush() {
+    drainer().drain();
+}
+
+}  // namespace bwlog
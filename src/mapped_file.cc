@@ -0,0 +1,115 @@
+#include <cerrno>
+#include <cstdio>
+#include <system_error>
+#include <utility>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <bigWigs2tensors/mapped_file.h>
+
+MappedFile MappedFile::create(const std::filesystem::path& path, size_t size) {
+    std::filesystem::path tmp_path = path.string() + ".tmp";
+    int fd = open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+        throw std::system_error(errno, std::generic_category(), "MappedFile::create: could not open " + tmp_path.string());
+
+    // posix_fallocate returns the error rather than setting errno
+    if (int err = posix_fallocate(fd, 0, size)) {
+        close(fd);
+        unlink(tmp_path.c_str());
+        throw std::system_error(err, std::generic_category(), "MappedFile::create: could not allocate " + tmp_path.string());
+    }
+
+    void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        int err = errno;
+        close(fd);
+        unlink(tmp_path.c_str());
+        throw std::system_error(err, std::generic_category(), "MappedFile::create: could not map " + tmp_path.string());
+    }
+    MappedFile file(path, fd, static_cast<char*>(addr), size);
+    file.tmp_path = std::move(tmp_path);
+    return file;
+}
+
+MappedFile MappedFile::open_read(const std::filesystem::path& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        throw std::system_error(errno, std::generic_category(), "MappedFile::open_read: could not open " + path.string());
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        int err = errno;
+        close(fd);
+        throw std::system_error(err, std::generic_category(), "MappedFile::open_read: could not stat " + path.string());
+    }
+    size_t size = st.st_size;
+    if (size == 0)
+        return MappedFile(path, fd, nullptr, 0);
+
+    void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+        int err = errno;
+        close(fd);
+        throw std::system_error(err, std::generic_category(), "MappedFile::open_read: could not map " + path.string());
+    }
+    // all of it is about to be read, once, each thread through its own part
+    madvise(addr, size, MADV_SEQUENTIAL);
+    madvise(addr, size, MADV_WILLNEED);
+    return MappedFile(path, fd, static_cast<char*>(addr), size);
+}
+
+MappedFile::MappedFile(const std::filesystem::path& path, int fd, char* addr, size_t len)
+    : file_path(path), fd(fd), addr(addr), len(len) {}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : file_path(std::move(other.file_path)),
+    tmp_path(std::exchange(other.tmp_path, {})),
+    fd(std::exchange(other.fd, -1)),
+    addr(std::exchange(other.addr, nullptr)),
+    len(std::exchange(other.len, 0)) {}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if (this != &other) {
+        release();
+        file_path = std::move(other.file_path);
+        tmp_path = std::exchange(other.tmp_path, {});
+        fd = std::exchange(other.fd, -1);
+        addr = std::exchange(other.addr, nullptr);
+        len = std::exchange(other.len, 0);
+    }
+    return *this;
+}
+
+MappedFile::~MappedFile() {
+    release();
+}
+
+void MappedFile::release() {
+    if (addr)
+        munmap(addr, len);
+    if (fd != -1)
+        close(fd);
+    // never committed, so incomplete
+    if (!tmp_path.empty())
+        unlink(tmp_path.c_str());
+    addr = nullptr;
+    fd = -1;
+    tmp_path.clear();
+}
+
+void MappedFile::sync() const {
+    if (addr && msync(addr, len, MS_SYNC) == -1)
+        throw std::system_error(errno, std::generic_category(), "MappedFile::sync: could not flush " + file_path.string());
+}
+
+void MappedFile::commit() {
+    if (tmp_path.empty())
+        return;
+    sync();
+    if (fsync(fd) == -1)
+        throw std::system_error(errno, std::generic_category(), "MappedFile::commit: could not fsync " + tmp_path.string());
+    if (rename(tmp_path.c_str(), file_path.c_str()) == -1)
+        throw std::system_error(errno, std::generic_category(), "MappedFile::commit: could not rename " + tmp_path.string());
+    tmp_path.clear();
+}
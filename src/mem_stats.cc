@@ -0,0 +1,169 @@
+#include <array>
+#include <vector>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <numeric>
+#include <algorithm>
+#include <sys/resource.h>
+#include <bigWigs2tensors/mem_stats.h>
+#include <bigWigs2tensors/atomic_file.h>
+#include <bigWigs2tensors/util.h>
+#include <bigWigs2tensors/log.h>
+
+namespace {
+
+constexpr std::array<const char*, bwmem::num_pools> pool_names {"reader", "decode", "accumulators", "outputs", "serialization"};
+
+struct PoolCounters {
+    std::atomic<size_t> current {0};
+    std::atomic<size_t> peak {0};
+    // peak since the current stage started
+    std::atomic<size_t> stage_peak {0};
+    std::atomic<size_t> allocations {0};
+};
+
+std::array<PoolCounters, bwmem::num_pools> pools;
+
+std::mutex stages_mutex;
+std::vector<bwmem::StageReport> finished_stages;
+
+void raise_to(std::atomic<size_t>& peak, size_t val) {
+    size_t seen = peak.load(std::memory_order_relaxed);
+    while (seen < val && !peak.compare_exchange_weak(seen, val, std::memory_order_relaxed)) {}
+}
+
+// a "VmXXX:   1234 kB" line of /proc/self/status, in bytes, 0 if missing
+size_t proc_status_bytes(const std::string& key) {
+    std::ifstream status_F("/proc/self/status");
+    std::string line;
+    while (std::getline(status_F, line)) {
+        if (line.compare(0, key.size(), key) == 0 && line.size() > key.size() && line[key.size()] == ':')
+            return std::stoull(line.substr(key.size() + 1)) * 1024;
+    }
+    return 0;
+}
+
+size_t peak_rss() {
+    size_t hwm = proc_status_bytes("VmHWM");
+    if (hwm)
+        return hwm;
+    // the process's peak so far, without /proc
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return size_t(usage.ru_maxrss) * 1024;
+}
+
+double mib(size_t bytes) {
+    return bytes / double(1 << 20);
+}
+
+}  // namespace
+
+namespace bwmem {
+
+const char* pool_name(Pool pool) {
+    return pool_names[static_cast<int>(pool)];
+}
+
+void add(Pool pool, size_t bytes) {
+    PoolCounters& counters = pools[static_cast<int>(pool)];
+    size_t current = counters.current.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    counters.allocations.fetch_add(1, std::memory_order_relaxed);
+    raise_to(counters.peak, current);
+    raise_to(counters.stage_peak, current);
+}
+
+void sub(Pool pool, size_t bytes) {
+    pools[static_cast<int>(pool)].current.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+PoolStats stats(Pool pool) {
+    const PoolCounters& counters = pools[static_cast<int>(pool)];
+    return {counters.current.load(std::memory_order_relaxed), counters.peak.load(std::memory_order_relaxed),
+            counters.allocations.load(std::memory_order_relaxed)};
+}
+
+size_t current_rss() {
+    return proc_status_bytes("VmRSS");
+}
+
+Stage::Stage(std::string name) : name(std::move(name)), start(std::chrono::steady_clock::now()) {
+    for (PoolCounters& counters : pools)
+        counters.stage_peak.store(counters.current.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    // "5" resets VmHWM to the current RSS, since Linux 4.0
+    std::ofstream clear_refs_F("/proc/self/clear_refs");
+    clear_refs_F << "5";
+}
+
+Stage::~Stage() {
+    StageReport report;
+    report.name = name;
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    // the end first, then the peak, which can only have grown since; the kernel updates
+    // VmHWM lazily, so it may still lag the RSS
+    report.end_rss = current_rss();
+    report.peak_rss = std::max(peak_rss(), report.end_rss);
+    for (size_t p = 0; p < num_pools; p++)
+        report.pool_peaks[p] = pools[p].stage_peak.load(std::memory_order_relaxed);
+    // an upper bound, the pools need not peak together
+    size_t buffers = std::accumulate(report.pool_peaks.begin(), report.pool_peaks.end(), size_t(0));
+    BW_LOG_INFO("stage " << report.name << ": " << std::fixed << std::setprecision(1) << report.seconds << " s, peak RSS "
+                << mib(report.peak_rss) << " MiB, buffers at most " << mib(buffers) << " MiB");
+
+    std::lock_guard<std::mutex> lock(stages_mutex);
+    finished_stages.push_back(std::move(report));
+}
+
+std::vector<StageReport> stages() {
+    std::lock_guard<std::mutex> lock(stages_mutex);
+    return finished_stages;
+}
+
+void write_summary(std::ostream& os) {
+    std::ios_base::fmtflags flags = os.flags();
+    os << std::fixed << std::setprecision(1)
+       << "memory by stage (MiB): stage, seconds, peak RSS, end RSS, then each pool's peak\n";
+    for (const StageReport& stage : stages()) {
+        os << "  " << stage.name << ": " << stage.seconds << " s, " << mib(stage.peak_rss) << ", " << mib(stage.end_rss);
+        for (size_t p = 0; p < num_pools; p++)
+            os << ", " << pool_names[p] << ' ' << mib(stage.pool_peaks[p]);
+        os << '\n';
+    }
+    os << "memory by pool over the run (MiB): peak, allocations\n";
+    for (size_t p = 0; p < num_pools; p++) {
+        PoolStats pool = stats(Pool(p));
+        os << "  " << pool_names[p] << ": " << mib(pool.peak) << ", " << pool.allocations << '\n';
+    }
+    os.flags(flags);
+}
+
+void write_json(const std::filesystem::path& path) {
+    std::ostringstream json;
+    json << "{\n    \"stages\": [";
+    std::vector<StageReport> reports = stages();
+    for (size_t s = 0; s < reports.size(); s++) {
+        const StageReport& stage = reports[s];
+        json << (s ? "," : "") << "\n        {\"name\": " << json_quote(stage.name) << ", \"seconds\": " << stage.seconds
+             << ", \"peak_rss_bytes\": " << stage.peak_rss << ", \"end_rss_bytes\": " << stage.end_rss << ", \"pool_peak_bytes\": {";
+        for (size_t p = 0; p < num_pools; p++)
+            json << (p ? ", " : "") << json_quote(pool_names[p]) << ": " << stage.pool_peaks[p];
+        json << "}}";
+    }
+    json << "\n    ],\n    \"pools\": {";
+    for (size_t p = 0; p < num_pools; p++) {
+        PoolStats pool = stats(Pool(p));
+        json << (p ? "," : "") << "\n        " << json_quote(pool_names[p]) << ": {\"peak_bytes\": " << pool.peak
+             << ", \"current_bytes\": " << pool.current << ", \"allocations\": " << pool.allocations << "}";
+    }
+    json << "\n    }\n}\n";
+
+    AtomicOfstream json_F(path);
+    json_F << json.str();
+    json_F.commit();
+}
+
+}  // namespace bwmem
@@ -0,0 +1,51 @@
+#include <cstdlib>
+#include <new>
+#include <algorithm>
+#include <bigWigs2tensors/ndarray.h>
+#include <bigWigs2tensors/mem_stats.h>
+
+namespace {
+
+constexpr size_t buf_align = 64;
+
+}  // namespace
+
+NDArray::NDArray(size_t rows, size_t cols, NpyDtype dtype)
+    : n_rows(rows), n_cols(cols), elem_dtype(dtype)
+{
+    // aligned_alloc needs a multiple of the alignment, and something to allocate
+    size_t alloc_size = (std::max<size_t>(nbytes(), 1) + buf_align - 1) / buf_align * buf_align;
+    void* data = std::aligned_alloc(buf_align, alloc_size);
+    if (!data)
+        throw std::bad_alloc();
+    bwmem::add(bwmem::Pool::outputs, alloc_size);
+    buf = std::shared_ptr<void>(data, [alloc_size](void* data) {
+        bwmem::sub(bwmem::Pool::outputs, alloc_size);
+        std::free(data);
+    });
+}
+
+NDArray NDArray::view(void* data, size_t rows, size_t cols, NpyDtype dtype) {
+    NDArray arr;
+    // nothing to free, the memory is owned elsewhere
+    arr.buf = std::shared_ptr<void>(data, [](void*) {});
+    arr.n_rows = rows;
+    arr.n_cols = cols;
+    arr.elem_dtype = dtype;
+    return arr;
+}
+
+std::ostream& operator<<(std::ostream& os, const NDArray& arr) {
+    os << '[' << arr.rows() << ", " << arr.cols() << "]\n";
+    for (size_t r = 0; r < arr.rows(); r++) {
+        for (size_t c = 0; c < arr.cols(); c++) {
+            os << (c ? " " : "");
+            if (arr.dtype() == NpyDtype::float32)
+                os << arr.data<float>()[r*arr.cols() + c];
+            else
+                os << arr.data<double>()[r*arr.cols() + c];
+        }
+        os << '\n';
+    }
+    return os;
+}
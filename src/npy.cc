@@ -0,0 +1,134 @@
+#include <vector>
+#include <string>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+#include <bit>
+#include <bigWigs2tensors/npy.h>
+#include <bigWigs2tensors/mem_stats.h>
+
+// .npy data is written as little-endian, straight from memory
+static_assert(std::endian::native == std::endian::little, "npy writer assumes a little-endian host");
+
+namespace {
+
+const char npy_magic[] = "\x93NUMPY";
+constexpr size_t npy_align = 64;
+// elements converted per write when narrowing
+constexpr size_t convert_chunk = 1 << 16;
+
+}  // namespace
+
+NpyDtype parse_npy_dtype(const std::string& name) {
+    if (name == "float32")
+        return NpyDtype::float32;
+    if (name == "float64")
+        return NpyDtype::float64;
+    throw std::invalid_argument("parse_npy_dtype: unsupported dtype " + name);
+}
+
+std::string npy_descr(NpyDtype dtype) {
+    switch (dtype) {
+        case NpyDtype::float32: return "<f4";
+        case NpyDtype::float64: return "<f8";
+    }
+    throw std::invalid_argument("npy_descr: unknown dtype");
+}
+
+size_t npy_itemsize(NpyDtype dtype) {
+    switch (dtype) {
+        case NpyDtype::float32: return sizeof(float);
+        case NpyDtype::float64: return sizeof(double);
+    }
+    throw std::invalid_argument("npy_itemsize: unknown dtype");
+}
+
+std::string npy_header(NpyDtype dtype, const std::vector<size_t>& shape) {
+    return npy_header(npy_descr(dtype), shape);
+}
+
+std::string npy_header(const std::string& descr, const std::vector<size_t>& shape) {
+    std::string dict = "{'descr': '" + descr + "', 'fortran_order': False, 'shape': (";
+    for (size_t dim : shape) {
+        dict += std::to_string(dim) + ", ";
+    }
+    // 1-tuples need their trailing comma, others can do without
+    if (shape.size() > 1)
+        dict.resize(dict.size() - 2);
+    else if (!shape.empty())
+        dict.pop_back();
+    dict += "), }";
+
+    // magic (6) + version (2) + header length (2), then the dict padded to alignment and ending in '\n'
+    const size_t preamble = sizeof(npy_magic) - 1 + 4;
+    size_t header_len = dict.size() + 1;
+    header_len += (npy_align - (preamble + header_len) % npy_align) % npy_align;
+    if (header_len > 0xFFFF)
+        throw std::invalid_argument("npy_header: shape too long for a version 1.0 header");
+    dict.resize(header_len - 1, ' ');
+    dict += '\n';
+
+    std::string header(npy_magic, sizeof(npy_magic) - 1);
+    header += '\x01';
+    header += '\x00';
+    header += static_cast<char>(header_len & 0xFF);
+    header += static_cast<char>(header_len >> 8);
+    return header + dict;
+}
+
+void write_npy_data(std::ostream& out, const double* data, size_t numel, NpyDtype dtype) {
+    if (dtype == NpyDtype::float64) {
+        out.write(reinterpret_cast<const char*>(data), numel * sizeof(double));
+        return;
+    }
+    bwmem::vector<float, bwmem::Pool::serialization> converted(std::min(numel, convert_chunk));
+    for (size_t i = 0; i < numel; i += convert_chunk) {
+        size_t n = std::min(convert_chunk, numel - i);
+        std::copy_n(data + i, n, converted.begin());
+        out.write(reinterpret_cast<const char*>(converted.data()), n * sizeof(float));
+    }
+}
+
+FileDigest write_npy(const std::filesystem::path& path, const double* data, const std::vector<size_t>& shape, NpyDtype dtype) {
+    AtomicOfstream npy_F(path);
+
+    std::string header = npy_header(dtype, shape);
+    npy_F.write(header.data(), header.size());
+
+    size_t numel = std::accumulate(shape.begin(), shape.end(), size_t(1), std::multiplies<size_t>());
+    write_npy_data(npy_F, data, numel, dtype);
+    return npy_F.commit();
+}
+
+NpyArray read_npy(const std::filesystem::path& path) {
+    std::ifstream npy_F(path, std::ios::binary);
+    char preamble[10];
+    if (!npy_F.read(preamble, sizeof(preamble)) || std::string(preamble, 6) != std::string(npy_magic, 6) || preamble[6] != '\x01')
+        throw std::runtime_error("read_npy: not a version 1.0 .npy file: " + path.string());
+    size_t header_len = static_cast<unsigned char>(preamble[8]) | (static_cast<unsigned char>(preamble[9]) << 8);
+    std::string dict(header_len, '\0');
+    npy_F.read(dict.data(), header_len);
+    if (dict.find("'fortran_order': False") == std::string::npos)
+        throw std::runtime_error("read_npy: only C-order arrays are supported: " + path.string());
+
+    NpyArray arr;
+    size_t descr_pos = dict.find("'descr': '") + 10;
+    arr.descr = dict.substr(descr_pos, dict.find('\'', descr_pos) - descr_pos);
+    size_t shape_pos = dict.find("'shape': (") + 10;
+    std::string shape = dict.substr(shape_pos, dict.find(')', shape_pos) - shape_pos);
+    for (size_t pos = 0; pos < shape.size(); ) {
+        size_t comma = std::min(shape.find(',', pos), shape.size());
+        if (shape.find_first_not_of(' ', pos) < comma)
+            arr.shape.push_back(std::stoul(shape.substr(pos, comma - pos)));
+        pos = comma + 1;
+    }
+
+    size_t numel = std::accumulate(arr.shape.begin(), arr.shape.end(), size_t(1), std::multiplies<size_t>());
+    arr.bytes.resize(numel * std::stoul(arr.descr.substr(2)));
+    npy_F.read(arr.bytes.data(), arr.bytes.size());
+    if (!npy_F)
+        throw std::runtime_error("read_npy: truncated data in " + path.string());
+    return arr;
+}
@@ -1,15 +1,105 @@
 #include <vector>
 #include <array>
+#include <memory>
 #include <map>
 #include <algorithm>
 #include <execution>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <functional>
 #include <cmath>
+#include <cstring>
 #include <iostream>
 #include <fstream>
 #include <filesystem>
-#include <torch/torch.h>
 #include <bigWigs2tensors/proc_bigWigs.h>
+#include <bigWigs2tensors/log.h>
+#ifdef BIGWIGS2TENSORS_WITH_TORCH
+#include <bigWigs2tensors/torch_sink.h>
+#endif
 #include <bigWig.h>
+#include <zlib.h>
+
+namespace {
+
+// the most a data block is assumed to take in a file without compression, where the header
+// gives no bound; the UCSC tools' and libBigWig's 1024 items per block take at most 24 KiB
+constexpr size_t uncompressed_block_bytes = 1 << 16;
+
+// workers binning blocks of tracks in parallel, at most one per block
+size_t block_workers(size_t num_bws) {
+    return std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()),
+                            (num_bws + constants::tile_tracks - 1) / constants::tile_tracks);
+}
+
+// the most a BinScratch holds of a data block of any of `bw_files`, as stored plus decompressed
+size_t max_block_bytes(const std::vector<bigWigFile_t*>& bw_files) {
+    size_t bytes = 0;
+    for (const bigWigFile_t* bw : bw_files) {
+        uint32_t buf_size = bw->hdr->bufSize;
+        bytes = std::max(bytes, buf_size ? compressBound(buf_size) + buf_size : uncompressed_block_bytes);
+    }
+    return bytes;
+}
+
+// what bin_chrom_chunks holds at once, bar the range: per bin, each worker's tile of doubles,
+// at most tile_bins long, and fixed, each worker's read buffers and the output's write buffer
+struct ChunkBuffers {
+    size_t tile_bin_bytes;
+    size_t fixed_bytes;
+};
+
+ChunkBuffers chunk_buffers(const std::vector<bigWigFile_t*>& bw_files) {
+    size_t workers = block_workers(bw_files.size());
+    size_t worker_tracks = std::min<size_t>(constants::tile_tracks, bw_files.size());
+    // per track, a data block and a fetch's sums and coverage; per worker, a coalesced fetch's bins
+    size_t track_bytes = max_block_bytes(bw_files) + constants::max_fetch_bins * (sizeof(double) + sizeof(uint32_t));
+    size_t worker_bytes = worker_tracks * track_bytes + constants::max_fetch_bins * sizeof(double);
+    return {workers * worker_tracks * sizeof(double), workers * worker_bytes + AtomicOfstream::buffer_bytes};
+}
+
+// totals of the workers' BinScratch counters over a chromosome, for logging
+struct FetchCounts {
+    std::mutex mutex;
+    size_t fetches = 0;
+    size_t allocations = 0;
+
+    void add(const std::vector<BinScratch>& scratch) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const BinScratch& s : scratch) {
+            fetches += s.fetches;
+            allocations += s.allocations;
+        }
+    }
+};
+
+// libBigWig's I/O buffers, `bwInit`'s size for each remote file
+size_t io_buffer_bytes(const std::vector<bigWigFile_t*>& bw_files) {
+    size_t bytes = 0;
+    for (const bigWigFile_t* bw : bw_files) {
+        if (bw && bw->URL && bw->URL->memBuf)
+            bytes += bw->URL->bufSize;
+    }
+    return bytes;
+}
+
+// streams a vector as [a, b, ...], for logging
+template <typename T>
+struct fmt_list {
+    const std::vector<T>& vals;
+};
+
+template <typename T>
+std::ostream& operator<<(std::ostream& os, const fmt_list<T>& f) {
+    os << '[';
+    for (size_t i = 0; i < f.vals.size(); i++) {
+        os << (i ? ", " : "") << f.vals[i];
+    }
+    return os << ']';
+}
+
+}  // namespace
 
 std::vector<bigWigFile_t*> open_bigWigs(const std::vector<std::string>& bw_paths) {
     std::vector<bigWigFile_t*> bw_files;
@@ -59,18 +149,18 @@ std::vector<double> bin_vec_NaNmeans(std::vector<double>& in_vec, size_t bin_siz
     return means;
 }
 
-BWBinner::BWBinner(const std::vector<std::string>& bigWig_paths, const std::string& chrom_sizes_path, const std::string& coords_bed_path)
+BWBinner::BWBinner(const std::vector<std::string>& bigWig_paths, const std::string& chrom_sizes_path, const std::string& coords_bed_path,
+                   TensorLayout layout)
     : bw_files(open_bigWigs(bigWig_paths)),
     num_bws(bw_files.size()),
-    tens_opts(constants::tensor_opts)
+    layout(layout)
 {
     // assign the returned maps to the class members using move semantics
     std::tie(chrom_sizes, spec_coords) = std::move(parse_chrom_sizes_coords(chrom_sizes_path, coords_bed_path));
 
-    // std::cout << "\n=========================\n";
-    std::cout << "Chrom sizes after filtering: \n";
+    bwmem::add(bwmem::Pool::reader, io_buffer_bytes(bw_files));
     for (const auto& [chr, size] : chrom_sizes) {
-        std::cout << chr << ": " << size << std::endl;
+        BW_LOG_DEBUG("chrom size after filtering, " << chr << ": " << size);
     }
 
     // for (const auto& [chr, interv] : spec_coords) {
@@ -89,13 +179,15 @@ BWBinner::BWBinner(const std::vector<std::string>& bigWig_paths, const std::stri
                     });
 }
 
-BWBinner::BWBinner(const std::vector<std::string>& bigWig_paths, const std::string& chrom_sizes_path)
+BWBinner::BWBinner(const std::vector<std::string>& bigWig_paths, const std::string& chrom_sizes_path,
+                   TensorLayout layout)
     : bw_files(open_bigWigs(bigWig_paths)),
     num_bws(bw_files.size()),
-    tens_opts(constants::tensor_opts),
     chrom_sizes(parse_chrom_sizes(chrom_sizes_path)),
-    spec_coords(make_full_chroms_coords_map(chrom_sizes))
+    spec_coords(make_full_chroms_coords_map(chrom_sizes)),
+    layout(layout)
 {
+    bwmem::add(bwmem::Pool::reader, io_buffer_bytes(bw_files));
     std::transform(bigWig_paths.cbegin(), bigWig_paths.cend(),
                     std::back_inserter(bw_paths),
                     [](const std::string& path) {
@@ -104,185 +196,1070 @@ BWBinner::BWBinner(const std::vector<std::string>& bigWig_paths, const std::stri
 }
 
 BWBinner::BWBinner(BWBinner&& other)
-    : bw_files(std::move(other.bw_files)),
+    : bw_paths(std::move(other.bw_paths)),
+    bw_files(std::move(other.bw_files)),
     num_bws(other.num_bws),
-    tens_opts(other.tens_opts),
     chrom_sizes(std::move(other.chrom_sizes)),
     spec_coords(std::move(other.spec_coords)),
-    chrom_binneds(std::move(other.chrom_binneds)) {}
+    chrom_binneds(std::move(other.chrom_binneds)),
+    layout(other.layout),
+    mapped_dir(std::move(other.mapped_dir)),
+    mapped_dtype(other.mapped_dtype),
+    chrom_mappings(std::move(other.chrom_mappings)),
+    streamed_dir(std::move(other.streamed_dir)),
+    streamed_dtype(other.streamed_dtype),
+    memory_budget(other.memory_budget),
+    streamed_digests(std::move(other.streamed_digests)),
+    fetch_gap(other.fetch_gap),
+    masked(std::move(other.masked)),
+    chrom_fills(std::move(other.chrom_fills)),
+    windows_dir(std::move(other.windows_dir)),
+    window_opts(std::move(other.window_opts)),
+    chrom_windows(std::move(other.chrom_windows)),
+    window_shards{std::move(other.window_shards[0]), std::move(other.window_shards[1])},
+    binned_bin_size(other.binned_bin_size) {
+    // the handles are now this binner's alone, a moved-from vector is not guaranteed empty
+    other.bw_files.clear();
+}
 
 BWBinner::~BWBinner() {
     // std::cout << "BWBinner shutting down" << std::endl;
+    bwmem::sub(bwmem::Pool::reader, io_buffer_bytes(bw_files));
     for (auto& bw : bw_files) {
         bwClose(bw);
     }
-    // coordinates specification map
-    for (auto& [chr, interv] : spec_coords) {
-        bbDestroyOverlappingEntries(interv);
-    }
 
     bwCleanup();
-    // final Torch tensors
+    // final binned arrays, before any mappings they view
     chrom_binneds.clear();
 }
 
-void BWBinner::load_bin_chrom_bigWig_tensor(const std::string& chrom, size_t bw_idx, const std::vector<unsigned>& start_bindxs, unsigned bin_size, unsigned num_bins) {
-    // check that the tensor for the chrom was created
-    if (!chrom_binneds.contains(chrom)) {
-        throw std::invalid_argument("BWBinner::load_bin_chrom_bigWig_tensor: no tensor for chrom " + chrom);
+template <typename T>
+void write_tile_impl(const double* tile, size_t n_tracks, size_t n_bins,
+                     T* dest, size_t dest_bins, size_t dest_tracks,
+                     size_t track_lo, size_t bin_lo, TensorLayout layout) {
+    if (layout == TensorLayout::track_major) {
+        // tile rows are already contiguous runs of the destination rows
+        for (size_t t = 0; t < n_tracks; t++) {
+            std::copy_n(tile + t*n_bins, n_bins, dest + (track_lo + t)*dest_bins + bin_lo);
+        }
+        return;
     }
 
-    bbOverlappingEntries_t* chrom_coords = spec_coords[chrom];
-    // parallelize across intervals' indices within the spec_coords map
-    // credit: https://stackoverflow.com/a/62829166
-    std::vector<size_t> interv_idxs (chrom_coords->l);
-    std::iota(interv_idxs.begin(), interv_idxs.end(), 0);
+    // bin-major: transpose block by block so that both the tile rows being read and
+    // the destination rows being written stay in cache
+    constexpr size_t block = 16;
+    for (size_t b0 = 0; b0 < n_bins; b0 += block) {
+        size_t b1 = std::min(b0 + block, n_bins);
+        for (size_t t0 = 0; t0 < n_tracks; t0 += block) {
+            size_t t1 = std::min(t0 + block, n_tracks);
+            for (size_t b = b0; b < b1; b++) {
+                T* dest_row = dest + (bin_lo + b)*dest_tracks + track_lo;
+                for (size_t t = t0; t < t1; t++) {
+                    dest_row[t] = tile[t*n_bins + b];
+                }
+            }
+        }
+    }
+}
 
-    // TODO: check all values in spec_coords with debugger
-    std::for_each(std::execution::par_unseq,
-                    interv_idxs.begin(), interv_idxs.end(),
-                    [this, chrom, bw_idx, &chrom_coords, &start_bindxs, bin_size, num_bins](size_t interv_idx) {
-                        // each bigWig is a column in the tensor
-                        // set interv_idx'th column of chrom_tensor to binned_vals
-                        unsigned start_bin = start_bindxs[interv_idx];
-                        unsigned end_bin;
-                        // 0-based half-open
-                        if (interv_idx != chrom_coords->l - 1)
-                            end_bin = start_bindxs[interv_idx+1];
-                        else // last interval
-                            end_bin = num_bins;
-
-                        if (end_bin > start_bin) {
-                            unsigned start = chrom_coords->start[interv_idx];
-                            unsigned end = chrom_coords->end[interv_idx];
-                            // libBigWig, including chrom_coords, uses 0-based half-open intervals
-                            unsigned interv_len = end - start;
-                            double* vals_arr = bwStats(bw_files[bw_idx], const_cast<char*>(chrom.c_str()),
-                                                            start, end, num_bins,
-                                                            bwStatsType::mean);
-                            std::vector<double> binned_vals(vals_arr, vals_arr + interv_len);
-
-                            std::cout << "Loaded " << binned_vals.size() << " bins for " << bw_paths[bw_idx].stem().string() << std::endl; // << ": [";
-                            // for (double val : chrom_vals) {
-                            //     std::cout << " " << val;
-                            // }
-                            // std::cout << " ]" << std::endl;
-
-                            // std::vector<double> binned_vals = bin_vec_NaNmeans(chrom_vals, bin_size);
-
-                            std::cout << binned_vals.size() << " binned values" << std::endl;
-                            // std::cout << "Binned result: [";
-                            // for (double val : binned_vals) {
-                            //     std::cout << " " << val;
-                            // }
-                            // std::cout << "]" << std::endl;
-
-                            using namespace torch::indexing;
-
-                            // std::vector<double> overlapping_binned_vals = std::vector<double>(binned_vals.begin(),
-                            //                                                                 binned_vals.begin() + (end_bin - start_bin));
-                            std::cout << "interval "<< interv_idx <<": ["<< start_bin <<", "<< end_bin <<"), "<< end_bin - start_bin << " overlapping bins." << std::endl;
-
-                            // 0-based half-open
-                            chrom_binneds[chrom].index_put_({Slice(start_bin, end_bin), (int)bw_idx},
-                                                    torch::from_blob(binned_vals.data(), {end_bin - start_bin},
-                                                    // torch::from_blob(overlapping_binned_vals.data(), {end_bin - start_bin},
-                                                                    torch::dtype(torch::kFloat64)));
-                        }
-                        else {
-                            std::cout << "Interval "<< interv_idx << " is empty, skipping." << std::endl;
-                            return;
-                        }
-                    });
-    // return chrom_binneds[chrom];
+void write_tile(const double* tile, size_t n_tracks, size_t n_bins,
+                double* dest, size_t dest_bins, size_t dest_tracks,
+                size_t track_lo, size_t bin_lo, TensorLayout layout) {
+    write_tile_impl(tile, n_tracks, n_bins, dest, dest_bins, dest_tracks, track_lo, bin_lo, layout);
 }
 
-void BWBinner::load_bin_chrom_tensor(const std::string& chrom, unsigned bin_size) {
-    // calculate number of bins first
-    // // ceiling division: ceil(chrom_size / bin_size)
-    // // credit: https://stackoverflow.com/a/2745086
-    // unsigned num_bins = 1 + ((chrom_sizes[chrom] - 1) / bin_size);
+void write_tile(const double* tile, size_t n_tracks, size_t n_bins,
+                float* dest, size_t dest_bins, size_t dest_tracks,
+                size_t track_lo, size_t bin_lo, TensorLayout layout) {
+    write_tile_impl(tile, n_tracks, n_bins, dest, dest_bins, dest_tracks, track_lo, bin_lo, layout);
+}
+
+std::vector<char> BWBinner::masked_intervals(const std::string& chrom) const {
+    auto chrom_masked = masked.find(chrom);
+    if (chrom_masked == masked.end())
+        return {};
+    return spec_coords.at(chrom).overlapped_by(chrom_masked->second);
+}
 
-    unsigned num_intervs = spec_coords[chrom]->l;
+void BWBinner::load_bin_chrom_tile(const std::string& chrom, const std::vector<unsigned>& start_bindxs,
+                                   const std::vector<char>& masked_intervals, unsigned bin_size,
+                                   size_t bw_lo, size_t bw_hi, unsigned bin_lo, unsigned bin_hi, TileBuffer& tile,
+                                   TileScratch& scratch) {
+    const IntervalIndex& chrom_coords = spec_coords.at(chrom);
+    const unsigned tile_bins = bin_hi - bin_lo;
+    tile.assign((bw_hi - bw_lo) * tile_bins, std::nan(""));
+
+    // last interval starting at or before bin_lo, skipping over empty intervals
+    std::vector<TileScratch::Segment>& segments = scratch.segments;
+    segments.clear();
+    size_t interv_idx = std::upper_bound(start_bindxs.begin(), start_bindxs.end() - 1, bin_lo) - start_bindxs.begin() - 1;
+    for (; interv_idx < chrom_coords.size() && start_bindxs[interv_idx] < bin_hi; interv_idx++) {
+        // 0-based half-open, clipped to the tile
+        unsigned seg_lo = std::max(bin_lo, start_bindxs[interv_idx]);
+        unsigned seg_hi = std::min(bin_hi, start_bindxs[interv_idx+1]);
+        if (seg_hi <= seg_lo)
+            continue;
+
+        // libBigWig, including chrom_coords, uses 0-based half-open intervals;
+        // only the bins fully covered by the interval are fetched
+        unsigned first_bin = unsigned((chrom_coords.start(interv_idx) + bin_size - 1) / bin_size);
+        unsigned chrom_lo = first_bin + (seg_lo - start_bindxs[interv_idx]);
+        // a bin fully covered by an interval only overlaps a masked region that overlaps the interval
+        if (masked_intervals.empty() || !masked_intervals[interv_idx]) {
+            segments.push_back({chrom_lo, chrom_lo + (seg_hi - seg_lo), seg_lo - bin_lo});
+            continue;
+        }
+        // only the runs of bins between masked regions, the rest stay NaN
+        for_each_unexcluded_run(masked.at(chrom), uint64_t(chrom_lo) * bin_size, bin_size, seg_hi - seg_lo,
+                                [&segments, chrom_lo, seg_lo, bin_lo](uint32_t first, uint32_t n) {
+                                    segments.push_back({chrom_lo + first, chrom_lo + first + n, seg_lo - bin_lo + first});
+                                });
+    }
+    // overlapping intervals need not be in order of their (clipped) first bins
+    std::sort(segments.begin(), segments.end(),
+              [](const TileScratch::Segment& a, const TileScratch::Segment& b) { return a.chrom_lo < b.chrom_lo; });
+
+    const unsigned gap_bins = fetch_gap / bin_size;
+    for (size_t seg = 0; seg < segments.size(); ) {
+        // coalesce the following pieces that overlap or are near enough
+        unsigned fetch_lo = segments[seg].chrom_lo;
+        unsigned fetch_hi = segments[seg].chrom_hi;
+        size_t seg_end = seg + 1;
+        for (; seg_end < segments.size() && segments[seg_end].chrom_lo <= fetch_hi + gap_bins; seg_end++) {
+            unsigned hi = std::max(fetch_hi, segments[seg_end].chrom_hi);
+            if (hi - fetch_lo > constants::max_fetch_bins)
+                break;
+            fetch_hi = hi;
+        }
+        BW_LOG_TRACE(chrom << ": " << seg_end - seg << " pieces of intervals fetched as bins [" << fetch_lo << ", " << fetch_hi << ")");
+
+        for (size_t bw_idx = bw_lo; bw_idx < bw_hi; bw_idx++) {
+            double* track_tile = tile.data() + (bw_idx - bw_lo)*tile_bins;
+            // a lone piece goes straight into the tile, no intermediate array
+            if (seg_end == seg + 1) {
+                read_bin_means(bw_files[bw_idx], chrom, fetch_lo * bin_size, bin_size, fetch_hi - fetch_lo,
+                               track_tile + segments[seg].tile_lo, scratch.tracks[bw_idx - bw_lo]);
+                continue;
+            }
+            if (scratch.fetched.size() < fetch_hi - fetch_lo) {
+                scratch.fetched.reserve(fetch_hi - fetch_lo);
+                scratch.fetched.resize(fetch_hi - fetch_lo);
+            }
+            read_bin_means(bw_files[bw_idx], chrom, fetch_lo * bin_size, bin_size, fetch_hi - fetch_lo,
+                           scratch.fetched.data(), scratch.tracks[bw_idx - bw_lo]);
+            for (size_t s = seg; s < seg_end; s++) {
+                std::copy_n(scratch.fetched.data() + (segments[s].chrom_lo - fetch_lo), segments[s].chrom_hi - segments[s].chrom_lo,
+                            track_tile + segments[s].tile_lo);
+            }
+        }
+        seg = seg_end;
+    }
+}
+
+void BWBinner::load_bin_chrom_tensor(const std::string& chrom, unsigned bin_size) {
     // cache starting indices of all intervals within tensor
-    // std::cout << "Starting indices of intervals for " << chrom << ": [";
-    std::vector<unsigned> start_bindxs(spec_coords[chrom]->l);
-    start_bindxs[0] = 0;
-    std::cout << "[" << start_bindxs[0];
-    for (int i = 1; i < num_intervs; i++) {
-        // start of this interval is 1 + end of previous interval
-        start_bindxs[i] = start_bindxs[i-1] + num_bins_intersect_interval(spec_coords[chrom]->start[i-1], spec_coords[chrom]->end[i-1], bin_size);
-        std::cout << ", " << start_bindxs[i];
-    }
-    std::cout << "]" << std::endl;
+    std::vector<unsigned> start_bindxs = spec_coords.at(chrom).start_bins(bin_size);
+    const std::vector<char> interv_masked = masked_intervals(chrom);
+    BW_LOG_TRACE("bin offsets of intervals for " << chrom << ": " << fmt_list<unsigned>{start_bindxs});
     // total num bins just the last interval's end
     // remember, always 0-based [start, end)
-    unsigned num_bins = start_bindxs.back() + num_bins_intersect_interval(spec_coords[chrom]->start[num_intervs-1], spec_coords[chrom]->end[num_intervs-1], bin_size);
-
-    // use emplace to not copy into a temporary
-    chrom_binneds.emplace(chrom, torch::empty({num_bins, num_bws}, tens_opts));
-    std::cout << "Created " << chrom_binneds[chrom].sizes() << " tensor for "<< num_bws <<" tracks." << std::endl;
-    
-    // parallelize across bigWigs' indices within the bw_files vector
-    // credit: https://stackoverflow.com/a/62829166
-    std::vector<size_t> bw_idxs(bw_files.size());
-    std::iota(bw_idxs.begin(), bw_idxs.end(), 0);
-
-    // std::cout << "bw_idxs: [";
-    // for (auto& idx : bw_idxs) {
-    //     std::cout << idx << ", ";
-    // }
-    // std::cout << "]" << std::endl;
+    unsigned num_bins = start_bindxs.back();
 
-    std::for_each(std::execution::par_unseq,
-                    bw_idxs.begin(), bw_idxs.end(),
-                    [this, chrom, bin_size, num_bins, &start_bindxs](size_t bw_idx) {
-                        load_bin_chrom_bigWig_tensor(chrom, bw_idx, start_bindxs, bin_size, num_bins);
-                    });
-    // return chrom_binneds[chrom];
+    std::vector<size_t> shape {num_bins, num_bws};
+    if (layout == TensorLayout::track_major)
+        std::swap(shape[0], shape[1]);
+
+    if (mapped_dir.empty()) {
+        // use emplace to not copy into a temporary
+        chrom_binneds.emplace(chrom, NDArray(shape[0], shape[1]));
+    }
+    else {
+        // preallocate the .npy at its final size and bin into the mapped data after its header
+        std::string header = npy_header(mapped_dtype, shape);
+        MappedFile mapping = MappedFile::create(mapped_dir / (chrom + ".npy"),
+                                                header.size() + size_t(num_bins)*num_bws*npy_itemsize(mapped_dtype));
+        std::copy(header.begin(), header.end(), mapping.data());
+        chrom_binneds.emplace(chrom, NDArray::view(mapping.data() + header.size(), shape[0], shape[1], mapped_dtype));
+        chrom_mappings.emplace(chrom, std::move(mapping));
+    }
+    BW_LOG_DEBUG("created " << fmt_list<size_t>{shape} << " array for " << chrom << ", " << num_bws << " tracks");
+
+    // parallelize across blocks of bigWigs, each worker walking its block along the
+    // chromosome one tile at a time, so that a bigWig handle is only ever read by one worker
+    std::vector<size_t> bw_blocks((num_bws + constants::tile_tracks - 1) / constants::tile_tracks);
+    std::iota(bw_blocks.begin(), bw_blocks.end(), 0);
+
+    // each worker only counts its own tracks' fills
+    std::vector<TrackFill>& fills = chrom_fills[chrom];
+    fills.assign(num_bws, TrackFill());
+
+    FetchCounts counts;
+    auto bin_into = [this, &chrom, bin_size, num_bins, &start_bindxs, &interv_masked, &bw_blocks, &fills, &counts](auto* dest) {
+        parallel_for_each(bw_blocks.begin(), bw_blocks.end(),
+                        [this, &chrom, bin_size, num_bins, dest, &start_bindxs, &interv_masked, &fills, &counts](size_t block) {
+                            size_t bw_lo = block * constants::tile_tracks;
+                            size_t bw_hi = std::min<size_t>(bw_lo + constants::tile_tracks, num_bws);
+                            // worker-local tile and read buffers, reused across the chromosome
+                            TileBuffer tile;
+                            TileScratch scratch;
+                            scratch.tracks.resize(bw_hi - bw_lo);
+                            for (unsigned bin_lo = 0; bin_lo < num_bins; bin_lo += constants::tile_bins) {
+                                unsigned bin_hi = std::min(bin_lo + constants::tile_bins, num_bins);
+                                load_bin_chrom_tile(chrom, start_bindxs, interv_masked, bin_size, bw_lo, bw_hi, bin_lo, bin_hi, tile, scratch);
+                                write_tile(tile.data(), bw_hi - bw_lo, bin_hi - bin_lo,
+                                            dest, num_bins, num_bws, bw_lo, bin_lo, layout);
+                                for (size_t t = 0; t < bw_hi - bw_lo; t++) {
+                                    TrackFill& fill = fills[bw_lo + t];
+                                    for (unsigned b = 0; b < bin_hi - bin_lo; b++) {
+                                        double val = tile[t*(bin_hi - bin_lo) + b];
+                                        fill.zeros += val == 0;
+                                        fill.nans += std::isnan(val);
+                                    }
+                                }
+                            }
+                            counts.add(scratch.tracks);
+                        });
+    };
+    if (chrom_binneds[chrom].dtype() == NpyDtype::float32)
+        bin_into(chrom_binneds[chrom].data<float>());
+    else
+        bin_into(chrom_binneds[chrom].data<double>());
+    BW_LOG_DEBUG(chrom << ": " << counts.fetches << " fetches, " << counts.allocations << " heap allocations");
+    // complete, so its .npy appears under its name
+    if (auto mapping = chrom_mappings.find(chrom); mapping != chrom_mappings.end())
+        mapping->second.commit();
 }
 
-const std::map<std::string, torch::Tensor>& BWBinner::load_bin_all_chroms(unsigned bin_size) {
-    // parallelize over chromosomes
-    std::for_each(std::execution::par_unseq,
-        chrom_sizes.begin(), chrom_sizes.end(),
-        [this, bin_size](auto& chr_entry) {
-            std::cout << "Binning " << chr_entry.first << std::endl;
-            //chrom_binneds[chr_entry.first] = BWBinner::load_bin_chrom_tensor(chr_entry.first, bin_size);
-            BWBinner::load_bin_chrom_tensor(chr_entry.first, bin_size);
+void BWBinner::map_binneds(const std::string& out_dir, NpyDtype dtype) {
+    mapped_dir = out_dir;
+    mapped_dtype = dtype;
+    std::filesystem::create_directories(mapped_dir);
+}
+
+void BWBinner::limit_memory(const std::string& out_dir, size_t max_memory, NpyDtype dtype) {
+    // fails early if the budget cannot hold a single bin
+    budget_chunk_bins(max_memory, dtype);
+    streamed_dir = out_dir;
+    streamed_dtype = dtype;
+    memory_budget = max_memory;
+    std::filesystem::create_directories(streamed_dir);
+}
+
+size_t BWBinner::min_memory_budget(NpyDtype dtype) const {
+    ChunkBuffers buffers = chunk_buffers(bw_files);
+    return buffers.fixed_bytes + size_t(num_bws) * npy_itemsize(dtype) + buffers.tile_bin_bytes;
+}
+
+size_t BWBinner::budget_chunk_bins(size_t max_memory, NpyDtype dtype) const {
+    if (max_memory < min_memory_budget(dtype))
+        throw std::invalid_argument("BWBinner::limit_memory: " + std::to_string(max_memory) + " bytes cannot hold a bin of "
+                                    + std::to_string(num_bws) + " tracks and the workers' buffers, at least "
+                                    + std::to_string(min_memory_budget(dtype)) + " are needed");
+    // a range of every track's bins, plus each worker's tile
+    ChunkBuffers buffers = chunk_buffers(bw_files);
+    size_t avail = max_memory - buffers.fixed_bytes;
+    size_t bin_bytes = size_t(num_bws) * npy_itemsize(dtype);
+    size_t chunk_bins = avail / (bin_bytes + buffers.tile_bin_bytes);
+    // past a full tile of bins, only the range grows
+    if (chunk_bins > constants::tile_bins)
+        chunk_bins = (avail - buffers.tile_bin_bytes * constants::tile_bins) / bin_bytes;
+    return chunk_bins;
+}
+
+void BWBinner::bin_chrom_chunks(const std::string& chrom, unsigned bin_size, NDArray& chunk,
+                                const std::function<void(unsigned, unsigned)>& sink) {
+    std::vector<unsigned> start_bindxs = spec_coords.at(chrom).start_bins(bin_size);
+    const std::vector<char> interv_masked = masked_intervals(chrom);
+    const unsigned num_bins = start_bindxs.back();
+    const size_t chunk_bins = layout == TensorLayout::track_major ? chunk.cols() : chunk.rows();
+
+    // as in load_bin_chrom_tensor, each block of bigWigs is read by one worker at a time, here a fixed set of
+    // workers each taking the next block, so that the buffers held are only ever those of `block_workers`
+    const size_t n_blocks = (num_bws + constants::tile_tracks - 1) / constants::tile_tracks;
+    std::vector<size_t> workers(block_workers(num_bws));
+    std::iota(workers.begin(), workers.end(), 0);
+
+    // each worker's tile and read buffers, kept across the ranges
+    std::vector<TileBuffer> tiles(workers.size());
+    std::vector<TileScratch> scratches(workers.size());
+    for (TileScratch& scratch : scratches)
+        scratch.tracks.resize(std::min<size_t>(constants::tile_tracks, num_bws));
+
+    for (unsigned chunk_lo = 0; chunk_lo < num_bins; chunk_lo += chunk_bins) {
+        unsigned chunk_hi = std::min<size_t>(chunk_lo + chunk_bins, num_bins);
+        auto bin_into = [this, &chrom, bin_size, &start_bindxs, &interv_masked, n_blocks, &workers, &tiles, &scratches, chunk_lo, chunk_hi, chunk_bins](auto* dest) {
+            std::atomic<size_t> next_block {0};
+            parallel_for_each(workers.begin(), workers.end(),
+                            [this, &chrom, bin_size, &start_bindxs, &interv_masked, n_blocks, &next_block, &tiles, &scratches, chunk_lo, chunk_hi, chunk_bins, dest](size_t worker) {
+                                TileBuffer& tile = tiles[worker];
+                                for (size_t block = next_block++; block < n_blocks; block = next_block++) {
+                                    size_t bw_lo = block * constants::tile_tracks;
+                                    size_t bw_hi = std::min<size_t>(bw_lo + constants::tile_tracks, num_bws);
+                                    for (unsigned bin_lo = chunk_lo; bin_lo < chunk_hi; bin_lo += constants::tile_bins) {
+                                        unsigned bin_hi = std::min(bin_lo + constants::tile_bins, chunk_hi);
+                                        load_bin_chrom_tile(chrom, start_bindxs, interv_masked, bin_size, bw_lo, bw_hi, bin_lo, bin_hi, tile, scratches[worker]);
+                                        write_tile(tile.data(), bw_hi - bw_lo, bin_hi - bin_lo,
+                                                    dest, chunk_bins, num_bws, bw_lo, bin_lo - chunk_lo, layout);
+                                    }
+                                }
+                            });
+        };
+        if (chunk.dtype() == NpyDtype::float32)
+            bin_into(chunk.data<float>());
+        else
+            bin_into(chunk.data<double>());
+        sink(chunk_lo, chunk_hi - chunk_lo);
+    }
+
+    FetchCounts counts;
+    for (const TileScratch& scratch : scratches)
+        counts.add(scratch.tracks);
+    BW_LOG_DEBUG(chrom << ": " << counts.fetches << " fetches, " << counts.allocations << " heap allocations");
+}
+
+void BWBinner::stream(unsigned bin_size, size_t chunk_bins,
+                      const std::function<void(const std::string&, unsigned, const NDArray&)>& callback,
+                      NpyDtype dtype) {
+    if (chunk_bins == 0)
+        throw std::invalid_argument("BWBinner::stream: chunk_bins must be positive");
+    // one buffer for every range of every chromosome
+    NDArray chunk = layout == TensorLayout::track_major ? NDArray(num_bws, chunk_bins, dtype)
+                                                        : NDArray(chunk_bins, num_bws, dtype);
+    const size_t itemsize = npy_itemsize(dtype);
+    char* bytes = static_cast<char*>(chunk.raw_data());
+    for (const auto& chr_entry : chrom_sizes) {
+        const std::string& chrom = chr_entry.first;
+        BW_LOG_INFO("streaming " << chrom << ", " << chunk_bins << " bins at a time");
+        bin_chrom_chunks(chrom, bin_size, chunk, [&](unsigned bin_lo, unsigned n_bins) {
+            if (layout == TensorLayout::bin_major) {
+                callback(chrom, bin_lo, NDArray::view(bytes, n_bins, num_bws, dtype));
+                return;
+            }
+            // track-major, a short last range's rows are packed together to make a contiguous array,
+            // each moving down, never past a row not yet moved
+            if (n_bins < chunk_bins) {
+                for (size_t t = 1; t < num_bws; t++)
+                    std::memmove(bytes + t*n_bins*itemsize, bytes + t*chunk_bins*itemsize, n_bins*itemsize);
+            }
+            callback(chrom, bin_lo, NDArray::view(bytes, num_bws, n_bins, dtype));
+        });
+    }
+}
+
+void BWBinner::stream_chrom_npy(const std::string& chrom, unsigned bin_size) {
+    const unsigned num_bins = spec_coords.at(chrom).start_bins(bin_size).back();
+    const size_t chunk_bins = std::min<size_t>(budget_chunk_bins(memory_budget, streamed_dtype), std::max(num_bins, 1u));
+    std::vector<size_t> shape {num_bins, num_bws};
+    NDArray chunk(chunk_bins, num_bws, streamed_dtype);
+    if (layout == TensorLayout::track_major) {
+        std::swap(shape[0], shape[1]);
+        chunk = NDArray(num_bws, chunk_bins, streamed_dtype);
+    }
+    BW_LOG_DEBUG(chrom << ": " << fmt_list<size_t>{shape} << " streamed " << chunk_bins << " bins at a time");
+
+    AtomicOfstream npy_F(streamed_dir / (chrom + ".npy"));
+    std::string header = npy_header(streamed_dtype, shape);
+    npy_F.write(header.data(), header.size());
+    const size_t itemsize = npy_itemsize(streamed_dtype);
+    const char* bytes = static_cast<const char*>(chunk.raw_data());
+    bin_chrom_chunks(chrom, bin_size, chunk, [this, &npy_F, &header, bytes, itemsize, num_bins, chunk_bins](unsigned bin_lo, unsigned n_bins) {
+        // bin-major ranges are runs of whole rows, appended as they come
+        if (layout == TensorLayout::bin_major) {
+            npy_F.write(bytes, size_t(n_bins) * num_bws * itemsize);
+            return;
         }
-    );
-    return chrom_binneds;
+        // track-major, each track's part of the range lands in its own row
+        for (size_t t = 0; t < num_bws; t++) {
+            npy_F.seekp(header.size() + (t*num_bins + bin_lo) * itemsize);
+            npy_F.write(bytes + t*chunk_bins*itemsize, size_t(n_bins) * itemsize);
+        }
+    });
+    streamed_digests[chrom] = npy_F.commit();
+}
+
+void BWBinner::coalesce_fetches(unsigned max_gap) {
+    fetch_gap = max_gap;
+}
+
+void BWBinner::exclude(const std::string& exclude_path, ExcludeMode mode) {
+    std::map<std::string, IntervalSet> excluded = read_interval_sets(exclude_path, chrom_sizes);
+    if (mode == ExcludeMode::mask) {
+        for (auto& [chrom, set] : excluded)
+            masked[chrom] = union_intervals(masked[chrom], set);
+        BW_LOG_INFO(exclude_path << ": masking regions on " << excluded.size() << " chromosomes");
+        return;
+    }
+
+    for (const auto& [chrom, set] : excluded) {
+        auto coords = spec_coords.find(chrom);
+        if (coords == spec_coords.end())
+            continue;
+        const IntervalIndex& index = coords->second;
+        // only the intervals an excluded region overlaps are cut, the others are kept whole
+        std::vector<char> hit = index.overlapped_by(set);
+        std::vector<Interval> kept, cut;
+        for (size_t i = 0; i < index.size(); i++)
+            (hit[i] ? cut : kept).push_back(index[i]);
+        if (cut.empty())
+            continue;
+        std::vector<Interval> pieces = subtract_intervals(cut, set);
+        kept.insert(kept.end(), pieces.begin(), pieces.end());
+        BW_LOG_DEBUG(chrom << ": " << cut.size() << " of " << index.size() << " intervals cut into " << pieces.size()
+                     << " pieces once excluded regions are dropped");
+
+        if (kept.empty()) {
+            // nothing left to bin, as for a coords BED without intervals on the chromosome
+            spec_coords.erase(coords);
+            chrom_sizes.erase(chrom);
+            continue;
+        }
+        coords->second = IntervalIndex(std::move(kept));
+    }
+    BW_LOG_INFO(exclude_path << ": dropped regions on " << excluded.size() << " chromosomes");
+}
+
+void BWBinner::shard_windows(const std::string& out_dir, const WindowOptions& opts) {
+    if (opts.length == 0 || opts.stride == 0)
+        throw std::invalid_argument("BWBinner::shard_windows: window length and stride must be positive");
+    windows_dir = out_dir;
+    window_opts = opts;
+    std::filesystem::create_directories(windows_dir);
+}
+
+void BWBinner::plan_windows(unsigned bin_size) {
+    // windows in a fixed order, chromosome by chromosome and interval by interval, so that
+    // the seeded shuffle always gives the same shards
+    std::vector<ChromWindow*> split_windows[2];
+    for (const auto& [chrom, size] : chrom_sizes) {
+        const IntervalIndex& coords = spec_coords.at(chrom);
+        std::vector<unsigned> start_bindxs = coords.start_bins(bin_size);
+        bool holdout = std::find(window_opts.holdout_chroms.begin(), window_opts.holdout_chroms.end(), chrom)
+                       != window_opts.holdout_chroms.end();
+        std::vector<ChromWindow>& windows = chrom_windows[chrom];
+        windows.clear();
+        for (size_t i = 0; i < coords.size(); i++) {
+            unsigned num_bins = start_bindxs[i+1] - start_bindxs[i];
+            uint64_t first_start = uint64_t((coords.start(i) + bin_size - 1) / bin_size) * bin_size;
+            for (unsigned lo = 0; lo + window_opts.length <= num_bins; lo += window_opts.stride) {
+                windows.push_back({start_bindxs[i] + lo, first_start + uint64_t(lo) * bin_size, holdout, {}});
+            }
+        }
+    }
+    for (auto& [chrom, windows] : chrom_windows) {
+        for (ChromWindow& window : windows) {
+            split_windows[window.holdout].push_back(&window);
+        }
+    }
+
+    const char* split_names[2] = {"train", "holdout"};
+    const size_t window_bytes = size_t(window_opts.length) * num_bws * npy_itemsize(window_opts.dtype);
+    for (int split = 0; split < 2; split++) {
+        std::vector<size_t> shard_sizes;
+        std::vector<ShardSlot> slots = assign_shards(split_windows[split].size(), window_opts.windows_per_shard,
+                                                     window_opts.seed + split, shard_sizes);
+        for (size_t w = 0; w < slots.size(); w++) {
+            split_windows[split][w]->slot = slots[w];
+        }
+        window_shards[split].clear();
+        for (size_t shard = 0; shard < shard_sizes.size(); shard++) {
+            std::string header = npy_header(window_opts.dtype, {shard_sizes[shard], window_opts.length, num_bws});
+            MappedFile mapping = MappedFile::create(windows_dir / shard_name(split_names[split], shard),
+                                                    header.size() + shard_sizes[shard] * window_bytes);
+            std::copy(header.begin(), header.end(), mapping.data());
+            window_shards[split].push_back({std::move(mapping), header.size()});
+        }
+        BW_LOG_INFO(split_windows[split].size() << " " << split_names[split] << " windows in " << shard_sizes.size() << " shards");
+    }
+}
+
+void BWBinner::write_chrom_windows(const std::string& chrom) {
+    const NDArray& binned = chrom_binneds.at(chrom);
+    const std::vector<ChromWindow>& windows = chrom_windows.at(chrom);
+    const size_t num_bins = layout == TensorLayout::track_major ? binned.cols() : binned.rows();
+    const size_t window_elems = size_t(window_opts.length) * num_bws;
+
+    auto copy_windows = [this, &windows, num_bins, window_elems](const auto* src, auto* dest_type) {
+        using T = std::remove_pointer_t<decltype(dest_type)>;
+        parallel_for_each(windows.begin(), windows.end(),
+                        [this, src, num_bins, window_elems](const ChromWindow& window) {
+                            const WindowShard& shard = window_shards[window.holdout][window.slot.shard];
+                            T* dest = reinterpret_cast<T*>(shard.file.data() + shard.data_offset) + window.slot.row * window_elems;
+                            // windows are always [length, num_bws]
+                            for (size_t b = 0; b < window_opts.length; b++) {
+                                for (size_t t = 0; t < num_bws; t++) {
+                                    dest[b*num_bws + t] = layout == TensorLayout::track_major ? src[t*num_bins + window.bin_lo + b]
+                                                                                           : src[(window.bin_lo + b)*num_bws + t];
+                                }
+                            }
+                        });
+    };
+    auto from = [&binned, &copy_windows, this](auto* dest_type) {
+        if (binned.dtype() == NpyDtype::float32)
+            copy_windows(binned.data<float>(), dest_type);
+        else
+            copy_windows(binned.data<double>(), dest_type);
+    };
+    if (window_opts.dtype == NpyDtype::float32)
+        from(static_cast<float*>(nullptr));
+    else
+        from(static_cast<double*>(nullptr));
+}
+
+void BWBinner::finish_windows(unsigned bin_size) {
+    // every shard now holds all its windows
+    std::vector<FileDigest> digests;
+    for (auto& shards : window_shards) {
+        for (WindowShard& shard : shards) {
+            shard.file.commit();
+            digests.push_back(file_digest(shard.file.path()));
+        }
+    }
+
+    // rows in shard order, a row's window covering [start, end) of chrom
+    struct IndexRow {
+        bool holdout;
+        ShardSlot slot;
+        const std::string* chrom;
+        uint64_t start;
+    };
+    std::vector<IndexRow> rows;
+    for (const auto& [chrom, windows] : chrom_windows) {
+        for (const ChromWindow& window : windows) {
+            rows.push_back({window.holdout, window.slot, &chrom, window.start});
+        }
+    }
+    std::sort(rows.begin(), rows.end(), [](const IndexRow& a, const IndexRow& b) {
+        return std::tie(a.holdout, a.slot.shard, a.slot.row) < std::tie(b.holdout, b.slot.shard, b.slot.row);
+    });
+
+    AtomicOfstream index_F(windows_dir / "windows_index.tsv");
+    index_F << "split" << '\t' << "shard" << '\t' << "row" << '\t' << "chrom" << '\t' << "start" << '\t' << "end" << '\n';
+    for (const IndexRow& row : rows) {
+        index_F << (row.holdout ? "holdout" : "train") << '\t' << row.slot.shard << '\t' << row.slot.row << '\t'
+                << *row.chrom << '\t' << row.start << '\t' << row.start + uint64_t(window_opts.length) * bin_size << '\n';
+    }
+    digests.push_back(index_F.commit());
+    write_manifest(windows_dir, std::move(digests));
 }
 
-std::map<std::string, torch::Tensor> BWBinner::binned_chroms() const {
+const std::map<std::string, NDArray>& BWBinner::load_bin_all_chroms(unsigned bin_size) {
+    binned_bin_size = bin_size;
+    if (memory_budget > 0) {
+        if (!windows_dir.empty() || !mapped_dir.empty())
+            throw std::invalid_argument("BWBinner::load_bin_all_chroms: binning within a memory budget cannot be combined"
+                                        " with windows or memory-mapped output");
+        for (const auto& chr_entry : chrom_sizes) {
+            BW_LOG_INFO("binning " << chr_entry.first << " within " << memory_budget << " bytes");
+            stream_chrom_npy(chr_entry.first, bin_size);
+        }
+        return chrom_binneds;
+    }
+    if (!windows_dir.empty())
+        plan_windows(bin_size);
+    // chromosomes one after another: the workers within each already cover all the bigWigs,
+    // and inserting into chrom_binneds is not thread-safe
+    for (const auto& chr_entry : chrom_sizes) {
+        BW_LOG_INFO("binning " << chr_entry.first);
+        BWBinner::load_bin_chrom_tensor(chr_entry.first, bin_size);
+        if (!windows_dir.empty())
+            write_chrom_windows(chr_entry.first);
+    }
+    if (!windows_dir.empty())
+        finish_windows(bin_size);
     return chrom_binneds;
 }
 
-void BWBinner::save_binneds(const std::string& out_dir) const {
+NDArray BWBinner::bin_regions(const std::vector<BedRegion>& regions, unsigned bin_size, unsigned flank) {
+    if (bin_size == 0 || flank == 0 || (2 * uint64_t(flank)) % bin_size != 0)
+        throw std::invalid_argument("BWBinner::bin_regions: a window of 2 * " + std::to_string(flank) + " bases is not a"
+                                    " positive multiple of the bin size " + std::to_string(bin_size));
+    const unsigned window_bins = 2 * uint64_t(flank) / bin_size;
+
+    // each window's bins wholly on its chromosome, [first_bin, last_bin)
+    struct Span {
+        int64_t start;
+        unsigned first_bin;
+        unsigned last_bin;
+        const IntervalSet* masked;
+    };
+    std::vector<Span> spans(regions.size());
+    for (size_t r = 0; r < regions.size(); r++) {
+        auto chrom_size = chrom_sizes.find(regions[r].chrom);
+        if (chrom_size == chrom_sizes.end())
+            throw std::invalid_argument("BWBinner::bin_regions: region " + std::to_string(r) + " is on " + regions[r].chrom
+                                        + ", not in the chromosome sizes");
+        Span& span = spans[r];
+        auto chrom_masked = masked.find(regions[r].chrom);
+        span.masked = chrom_masked == masked.end() ? nullptr : &chrom_masked->second;
+        span.start = int64_t(regions[r].summit) - flank;
+        span.first_bin = span.start < 0 ? (-span.start + bin_size - 1) / bin_size : 0;
+        int64_t on_chrom = int64_t(chrom_size->second) - span.start;
+        span.last_bin = std::max<int64_t>(span.first_bin, std::min<int64_t>(window_bins, on_chrom / bin_size));
+    }
+
+    // fetched in genomic order, for locality of the reads, while the rows keep the regions' order
+    std::vector<size_t> order(regions.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&regions](size_t a, size_t b) {
+        return std::tie(regions[a].chrom, regions[a].summit) < std::tie(regions[b].chrom, regions[b].summit);
+    });
+
+    NDArray windows(regions.size() * window_bins, num_bws);
+    double* dest = windows.data<double>();
+    std::vector<size_t> bw_blocks((num_bws + constants::tile_tracks - 1) / constants::tile_tracks);
+    std::iota(bw_blocks.begin(), bw_blocks.end(), 0);
+    FetchCounts counts;
+    parallel_for_each(bw_blocks.begin(), bw_blocks.end(),
+                    [this, &regions, &spans, &order, bin_size, window_bins, dest, &counts](size_t block) {
+                        size_t bw_lo = block * constants::tile_tracks;
+                        size_t bw_hi = std::min<size_t>(bw_lo + constants::tile_tracks, num_bws);
+                        std::vector<BinScratch> scratch(bw_hi - bw_lo);
+                        TileBuffer window(window_bins);
+                        for (size_t r : order) {
+                            const Span& span = spans[r];
+                            double* rows = dest + r * window_bins * num_bws;
+                            for (size_t bw_idx = bw_lo; bw_idx < bw_hi; bw_idx++) {
+                                std::fill(window.begin(), window.end(), std::nan(""));
+                                auto read_run = [&](uint32_t first, uint32_t n) {
+                                    read_bin_means(bw_files[bw_idx], regions[r].chrom, span.start + int64_t(first) * bin_size,
+                                                   bin_size, n, window.data() + first, scratch[bw_idx - bw_lo]);
+                                };
+                                if (span.first_bin < span.last_bin && !span.masked) {
+                                    read_run(span.first_bin, span.last_bin - span.first_bin);
+                                }
+                                else if (span.first_bin < span.last_bin) {
+                                    for_each_unexcluded_run(*span.masked, span.start + int64_t(span.first_bin) * bin_size, bin_size,
+                                                            span.last_bin - span.first_bin,
+                                                            [&](uint32_t first, uint32_t n) { read_run(span.first_bin + first, n); });
+                                }
+                                for (unsigned b = 0; b < window_bins; b++)
+                                    rows[b*num_bws + bw_idx] = window[b];
+                            }
+                        }
+                        counts.add(scratch);
+                    });
+    BW_LOG_DEBUG(regions.size() << " regions: " << counts.fetches << " fetches, " << counts.allocations << " heap allocations");
+    return windows;
+}
+
+void BWBinner::save_regions(const std::string& out_dir, const std::vector<BedRegion>& regions, const NDArray& binned,
+                            unsigned bin_size, unsigned flank, NpyDtype dtype) const {
     std::filesystem::path out_dir_p{out_dir};
-    if (!std::filesystem::exists(out_dir_p)) {
-        std::cout << "Creating directory " << out_dir_p << "\n";
-        std::filesystem::create_directory(out_dir_p);
+    std::filesystem::create_directories(out_dir_p);
+    const size_t window_bins = 2 * uint64_t(flank) / bin_size;
+    if (binned.rows() != regions.size() * window_bins || binned.cols() != num_bws)
+        throw std::invalid_argument("BWBinner::save_regions: the array is not of " + std::to_string(regions.size())
+                                    + " windows of " + std::to_string(window_bins) + " bins");
+
+    std::vector<FileDigest> digests {write_npy(out_dir_p / "regions.npy", binned.data<double>(),
+                                               {regions.size(), window_bins, num_bws}, dtype)};
+    AtomicOfstream index_F(out_dir_p / "regions_index.tsv");
+    index_F << "row" << '\t' << "chrom" << '\t' << "summit" << '\t' << "start" << '\t' << "end" << '\t' << "name" << '\n';
+    for (size_t r = 0; r < regions.size(); r++) {
+        int64_t start = int64_t(regions[r].summit) - flank;
+        index_F << r << '\t' << regions[r].chrom << '\t' << regions[r].summit << '\t' << start << '\t'
+                << start + 2 * int64_t(flank) << '\t' << regions[r].name << '\n';
     }
+    digests.push_back(index_F.commit());
+    digests.push_back(save_track_names(out_dir_p));
+    write_manifest(out_dir_p, digests);
+}
 
-    //std::cout << "in save_binneds(): chrom_binneds.size() = " << chrom_binneds.size() << std::endl;
-    for (const auto& [chrom, size] : chrom_sizes) {
-        // save this chrom's binned tensor
-        //std::cout << "in save_binneds(): saving " << chrom << std::endl;
-        auto bytes = torch::pickle_save(chrom_binneds.at(chrom));
-        std::ofstream chr_stream{out_dir_p / (chrom + ".pt")};
-        chr_stream.write(bytes.data(), bytes.size());
-        chr_stream.close();
-    }
-    
+FileDigest BWBinner::save_track_names(const std::filesystem::path& out_dir_p) const {
     // save the indices of the bigWigs in the tensor
-    std::filesystem::path bw_idx_p{out_dir_p / "tensor_bigWigs_inds.csv"};
-    std::ofstream bw_idx_F(bw_idx_p);
+    AtomicOfstream bw_idx_F(out_dir_p / "tensor_bigWigs_inds.csv");
     // headers
     bw_idx_F << "column" << ',' << "name" << '\n';
     for (size_t i = 0; i < bw_paths.size(); i++) {
         bw_idx_F << i << ',' << bw_paths[i].stem().string() << '\n';
     }
-    bw_idx_F.close();
+    return bw_idx_F.commit();
+}
+
+std::map<std::string, NDArray> BWBinner::binned_chroms() const {
+    return chrom_binneds;
+}
+
+QuantParams BWBinner::fit_binneds_quant(const OutputOptions& opts) const {
+    std::vector<double> lo(num_bws, std::nan("")), hi(num_bws, std::nan(""));
+    if (opts.quant_range == QuantRange::header) {
+        for (size_t t = 0; t < num_bws; t++) {
+            lo[t] = bw_files[t]->hdr->minVal;
+            hi[t] = bw_files[t]->hdr->maxVal;
+        }
+        return fit_quant(opts.quant, opts.quant_transform, lo, hi);
+    }
+
+    // one pass over every track's bins, in parallel across tracks
+    std::vector<size_t> tracks(num_bws);
+    std::iota(tracks.begin(), tracks.end(), 0);
+    parallel_for_each(tracks.begin(), tracks.end(),
+                    [this, &lo, &hi](size_t t) {
+                        double t_lo = INFINITY, t_hi = -INFINITY;
+                        for (const auto& [chrom, binned] : chrom_binneds) {
+                            const double* data = binned.data<double>();
+                            size_t num_bins = layout == TensorLayout::track_major ? binned.cols() : binned.rows();
+                            size_t stride = layout == TensorLayout::track_major ? 1 : num_bws;
+                            const double* first = layout == TensorLayout::track_major ? data + t*num_bins : data + t;
+                            for (size_t b = 0; b < num_bins; b++) {
+                                double val = first[b*stride];
+                                // NaNs fail both comparisons
+                                if (val < t_lo)
+                                    t_lo = val;
+                                if (val > t_hi)
+                                    t_hi = val;
+                            }
+                        }
+                        lo[t] = t_lo;
+                        hi[t] = t_hi;
+                    });
+    return fit_quant(opts.quant, opts.quant_transform, lo, hi);
+}
+
+std::vector<FileDigest> BWBinner::save_sparse_binned(const std::filesystem::path& out_dir_p, const std::string& chrom,
+                                                     const OutputOptions& opts) const {
+    const NDArray& binned = chrom_binneds.at(chrom);
+    const std::vector<TrackFill>& fills = chrom_fills.at(chrom);
+    size_t num_bins = layout == TensorLayout::track_major ? binned.cols() : binned.rows();
+    size_t track_axis = layout == TensorLayout::track_major ? 0 : 1;
+
+    std::vector<int64_t> sparse_tracks, dense_tracks;
+    std::vector<double> sparse_fills;
+    for (size_t t = 0; t < num_bws; t++) {
+        if (fills[t].density(num_bins) < opts.sparse_density) {
+            sparse_tracks.push_back(t);
+            sparse_fills.push_back(fills[t].fill());
+        }
+        else {
+            dense_tracks.push_back(t);
+        }
+    }
+    BW_LOG_INFO(chrom << ": " << sparse_tracks.size() << " of " << num_bws << " tracks sparse");
+    if (sparse_tracks.empty())
+        return {write_npy(out_dir_p / (chrom + ".npy"), binned.data<double>(), binned.shape(), opts.dtype)};
+
+    std::vector<FileDigest> digests = write_sparse_columns(
+        out_dir_p / (chrom + ".sparse"),
+        make_sparse_columns(binned.data<double>(), binned.rows(), binned.cols(), track_axis, sparse_tracks, sparse_fills),
+        opts.dtype);
+
+    // the dense tracks alone, in the same layout
+    const double* data = binned.data<double>();
+    bwmem::vector<double, bwmem::Pool::outputs> dense(num_bins * dense_tracks.size());
+    for (size_t d = 0; d < dense_tracks.size(); d++) {
+        for (size_t b = 0; b < num_bins; b++) {
+            double val = track_axis == 0 ? data[dense_tracks[d]*num_bins + b] : data[b*num_bws + dense_tracks[d]];
+            if (track_axis == 0)
+                dense[d*num_bins + b] = val;
+            else
+                dense[b*dense_tracks.size() + d] = val;
+        }
+    }
+    std::vector<size_t> shape {num_bins, dense_tracks.size()};
+    if (layout == TensorLayout::track_major)
+        std::swap(shape[0], shape[1]);
+    digests.push_back(write_npy(out_dir_p / (chrom + ".npy"), dense.data(), shape, opts.dtype));
+    return digests;
+}
+
+std::vector<FileDigest> BWBinner::save_binned_bigWigs(const std::filesystem::path& out_dir_p) const {
+    if (!chrom_mappings.empty() && mapped_dtype != NpyDtype::float64)
+        throw std::invalid_argument("BWBinner::save_binneds: float32 memory-mapped chromosomes cannot be saved as bigWigs");
+    if (binned_bin_size == 0)
+        throw std::invalid_argument("BWBinner::save_binneds: nothing binned to save as bigWigs, call load_bin_all_chroms first");
+
+    std::vector<size_t> tracks(num_bws);
+    std::iota(tracks.begin(), tracks.end(), 0);
+    std::vector<FileDigest> digests(num_bws);
+    parallel_for_each(tracks.begin(), tracks.end(),
+                    [this, &out_dir_p, &digests](size_t t) {
+                        // each interval's bins of this track, in chrom_sizes order; overlapping intervals share
+                        // bins, on the same grid and of the same values, so each bin is only written once
+                        std::vector<BinnedSegment> segments;
+                        for (const auto& [chrom, size] : chrom_sizes) {
+                            const NDArray& binned = chrom_binneds.at(chrom);
+                            const IntervalIndex& coords = spec_coords.at(chrom);
+                            std::vector<unsigned> start_bindxs = coords.start_bins(binned_bin_size);
+                            size_t num_bins = start_bindxs.back();
+                            size_t stride = layout == TensorLayout::track_major ? 1 : num_bws;
+                            const double* first = binned.data<double>() + (layout == TensorLayout::track_major ? t*num_bins : t);
+                            // the intervals are sorted by start, so this only grows
+                            uint64_t written_end = 0;
+                            for (size_t i = 0; i < coords.size(); i++) {
+                                uint64_t start = (coords.start(i) + binned_bin_size - 1) / binned_bin_size * binned_bin_size;
+                                uint64_t end = start + uint64_t(start_bindxs[i+1] - start_bindxs[i]) * binned_bin_size;
+                                if (end <= written_end)
+                                    continue;
+                                size_t skip = start < written_end ? (written_end - start) / binned_bin_size : 0;
+                                segments.push_back({chrom, uint32_t(start + skip*binned_bin_size), first + (start_bindxs[i] + skip)*stride,
+                                                    start_bindxs[i+1] - start_bindxs[i] - skip, stride});
+                                written_end = end;
+                            }
+                        }
+                        digests[t] = write_binned_bigWig(out_dir_p / (bw_paths[t].stem().string() + ".binned.bw"),
+                                                         chrom_sizes, segments, binned_bin_size);
+                    });
+    return digests;
+}
+
+std::vector<FileDigest> BWBinner::save_genome_binned(const std::filesystem::path& out_dir_p, const OutputOptions& opts,
+                                                     const QuantParams& quant) const {
+    if (opts.format != OutputFormat::npy)
+        throw std::invalid_argument("BWBinner::save_binneds: a genome-wide array can only be saved as npy");
+    if (!chrom_mappings.empty())
+        throw std::invalid_argument("BWBinner::save_binneds: a genome-wide array cannot be saved from memory-mapped chromosomes");
+
+    // rows of each chromosome within the genome-wide array, in chrom_sizes order
+    size_t total_bins = 0;
+    std::map<std::string, size_t> row_offsets;
+    for (const auto& [chrom, size] : chrom_sizes) {
+        row_offsets[chrom] = total_bins;
+        total_bins += layout == TensorLayout::track_major ? chrom_binneds.at(chrom).cols() : chrom_binneds.at(chrom).rows();
+    }
+
+    AtomicOfstream genome_F(out_dir_p / "genome.npy");
+    std::string header = opts.quant == QuantDtype::none ? npy_header(opts.dtype, {total_bins, num_bws})
+                                                        : npy_header(quant_descr(opts.quant), {total_bins, num_bws});
+    genome_F.write(header.data(), header.size());
+    auto write_rows = [&genome_F, &opts, &quant, this](const double* data, size_t n_rows) {
+        if (opts.quant == QuantDtype::none)
+            write_npy_data(genome_F, data, n_rows * num_bws, opts.dtype);
+        else
+            write_quantized_data(genome_F, data, n_rows, num_bws, 1, quant);
+    };
+    // a bin-major chromosome is already a run of rows, a track-major one is transposed through a buffer
+    bwmem::vector<double, bwmem::Pool::outputs> rows;
+    for (const auto& [chrom, size] : chrom_sizes) {
+        const NDArray& binned = chrom_binneds.at(chrom);
+        const double* data = binned.data<double>();
+        if (layout == TensorLayout::bin_major) {
+            write_rows(data, binned.rows());
+            continue;
+        }
+        size_t num_bins = binned.cols();
+        for (size_t bin_lo = 0; bin_lo < num_bins; bin_lo += constants::tile_bins) {
+            size_t n_bins = std::min<size_t>(constants::tile_bins, num_bins - bin_lo);
+            rows.resize(n_bins * num_bws);
+            for (size_t t = 0; t < num_bws; t++) {
+                for (size_t b = 0; b < n_bins; b++) {
+                    rows[b*num_bws + t] = data[t*num_bins + bin_lo + b];
+                }
+            }
+            write_rows(rows.data(), n_bins);
+        }
+    }
+    std::vector<FileDigest> digests {genome_F.commit()};
+
+    // one record per interval: a genomic position `pos` within [start, end) of `chrom`
+    // is row `row_offset + (pos - start) / bin_size`
+    AtomicOfstream index_F(out_dir_p / "genome_index.tsv");
+    index_F << "chrom" << '\t' << "row_offset" << '\t' << "num_bins" << '\t' << "start" << '\t' << "end" << '\n';
+    for (const auto& [chrom, size] : chrom_sizes) {
+        const IntervalIndex& coords = spec_coords.at(chrom);
+        std::vector<unsigned> start_bindxs = coords.start_bins(binned_bin_size);
+        for (size_t i = 0; i < coords.size(); i++) {
+            unsigned num_bins = start_bindxs[i+1] - start_bindxs[i];
+            if (num_bins == 0)
+                continue;
+            uint64_t start = uint64_t((coords.start(i) + binned_bin_size - 1) / binned_bin_size) * binned_bin_size;
+            index_F << chrom << '\t' << row_offsets[chrom] + start_bindxs[i] << '\t' << num_bins << '\t'
+                    << start << '\t' << start + uint64_t(num_bins) * binned_bin_size << '\n';
+        }
+    }
+    digests.push_back(index_F.commit());
+    return digests;
+}
+
+void BWBinner::save_binneds(const std::string& out_dir, const OutputOptions& opts) const {
+    std::filesystem::path out_dir_p{out_dir};
+    if (!std::filesystem::exists(out_dir_p)) {
+        BW_LOG_INFO("creating directory " << out_dir_p);
+        std::filesystem::create_directory(out_dir_p);
+    }
+
+    std::string layout_name = layout == TensorLayout::track_major ? "tracks" : "bins";
+    std::string tracks_json = "[";
+    for (size_t i = 0; i < bw_paths.size(); i++) {
+        tracks_json += (i ? ", " : "") + json_quote(bw_paths[i].stem().string());
+    }
+    tracks_json += "]";
+
+    if (!streamed_digests.empty() && (opts.format != OutputFormat::npy || opts.genome_wide
+                                      || opts.quant != QuantDtype::none || opts.sparse_density > 0))
+        throw std::invalid_argument("BWBinner::save_binneds: chromosomes binned within a memory budget are already"
+                                    " saved as plain npy, and can only be saved as such");
+    if (opts.sparse_density > 0 && (opts.format != OutputFormat::npy || opts.genome_wide
+                                    || opts.quant != QuantDtype::none || !chrom_mappings.empty()))
+        throw std::invalid_argument("BWBinner::save_binneds: sparse tracks can only be saved as per-chromosome, unquantized npy,"
+                                    " not memory-mapped");
+
+    QuantParams quant;
+    // of every file written, for the manifest, appended to from the chromosome workers
+    std::vector<FileDigest> digests;
+    std::mutex digests_mutex;
+    auto add_digests = [&digests, &digests_mutex](const std::vector<FileDigest>& written) {
+        std::lock_guard<std::mutex> lock(digests_mutex);
+        digests.insert(digests.end(), written.begin(), written.end());
+    };
+
+    if (opts.quant != QuantDtype::none) {
+        if (opts.format != OutputFormat::npy || !chrom_mappings.empty())
+            throw std::invalid_argument("BWBinner::save_binneds: quantized output can only be saved as npy, not memory-mapped");
+        quant = fit_binneds_quant(opts);
+        std::vector<std::string> track_names;
+        for (const auto& path : bw_paths) {
+            track_names.push_back(path.stem().string());
+        }
+        add_digests({write_quant_params(out_dir_p / "quantization.json", quant, track_names)});
+    }
+
+    if (opts.format == OutputFormat::zarr) {
+        // the output directory is the group, one array per chromosome
+        add_digests(write_zarr_group(out_dir_p, "{\n    \"layout\": " + json_quote(layout_name) + ",\n    \"tracks\": " + tracks_json + "\n}\n"));
+    }
+    // safetensors: chromosomes gathered into one file, unless one file each
+    std::vector<SafetensorsEntry> st_entries;
+    const std::map<std::string, std::string> st_metadata {{"layout", layout_name}, {"tracks", tracks_json}};
+    // bsz: totals over all chromosomes, reported once done
+    BszStats bsz_stats;
+    // arrow: chromosomes appended to one file as record batches
+    std::unique_ptr<ArrowIpcWriter> arrow_writer;
+    if (opts.format == OutputFormat::arrow) {
+        std::vector<std::string> track_names;
+        for (const auto& path : bw_paths) {
+            track_names.push_back(path.stem().string());
+        }
+        arrow_writer = std::make_unique<ArrowIpcWriter>(out_dir_p / "binned.arrow", track_names, opts.dtype);
+    }
+
+    // saves this chrom's binned array, concurrently with the others' when each has its own file
+    // a chromosome already in its .npy, copied unless that is where it is saved to
+    auto copy_npy = [&out_dir_p](const std::filesystem::path& npy_path, const std::string& chrom) {
+        std::filesystem::path chr_path = out_dir_p / (chrom + ".npy");
+        if (!std::filesystem::exists(chr_path) || !std::filesystem::equivalent(npy_path, chr_path)) {
+            std::filesystem::path tmp_path = chr_path.string() + ".tmp";
+            std::filesystem::copy_file(npy_path, tmp_path, std::filesystem::copy_options::overwrite_existing);
+            commit_file(tmp_path, chr_path);
+        }
+    };
+    auto save_chrom = [&](const std::string& chrom) {
+        if (streamed_digests.contains(chrom)) {
+            copy_npy(streamed_dir / (chrom + ".npy"), chrom);
+            add_digests({streamed_digests.at(chrom)});
+            return;
+        }
+        const NDArray& binned = chrom_binneds.at(chrom);
+        if (opts.format == OutputFormat::npy && chrom_mappings.contains(chrom)) {
+            // already in its .npy, just make sure it is on disk
+            const MappedFile& mapping = chrom_mappings.at(chrom);
+            mapping.sync();
+            copy_npy(mapping.path(), chrom);
+            add_digests({file_digest(out_dir_p / (chrom + ".npy"))});
+            return;
+        }
+        if (opts.format != OutputFormat::pt && binned.dtype() != NpyDtype::float64) {
+            throw std::invalid_argument("BWBinner::save_binneds: " + chrom + " was binned into a memory-mapped .npy,"
+                                        " it can only be saved as npy or pt");
+        }
+
+        // written straight from the array's buffer, no intermediate copy
+        std::vector<size_t> shape = binned.shape();
+        switch (opts.format) {
+            case OutputFormat::npy:
+                if (opts.sparse_density > 0)
+                    add_digests(save_sparse_binned(out_dir_p, chrom, opts));
+                else if (opts.quant != QuantDtype::none)
+                    add_digests({write_quantized_npy(out_dir_p / (chrom + ".npy"), binned.data<double>(), shape[0], shape[1],
+                                                     layout == TensorLayout::track_major ? 0 : 1, quant)});
+                else
+                    add_digests({write_npy(out_dir_p / (chrom + ".npy"), binned.data<double>(), shape, opts.dtype)});
+                break;
+            case OutputFormat::zarr: {
+                ZarrArrayOptions zarr_opts {opts.chunk_bins, opts.chunk_tracks, opts.dtype, opts.zlib_level};
+                if (layout == TensorLayout::track_major)
+                    std::swap(zarr_opts.chunk_rows, zarr_opts.chunk_cols);
+                add_digests(write_zarr_array(out_dir_p / chrom, binned.data<double>(), shape[0], shape[1], zarr_opts));
+                break;
+            }
+            case OutputFormat::safetensors:
+                if (opts.per_chrom_files)
+                    add_digests({write_safetensors(out_dir_p / (chrom + ".safetensors"), {{chrom, binned.data<double>(), shape}},
+                                                   opts.dtype, st_metadata)});
+                else
+                    st_entries.push_back({chrom, binned.data<double>(), shape});
+                break;
+            case OutputFormat::bsz: {
+                BszStats stats = write_bsz(out_dir_p / (chrom + ".bsz"), binned.data<double>(), shape[0], shape[1],
+                                           {opts.block_elems, opts.dtype, opts.bsz_level, opts.bsz_codec});
+                add_digests({stats.digest});
+                std::lock_guard<std::mutex> lock(digests_mutex);
+                bsz_stats += stats;
+                break;
+            }
+            case OutputFormat::arrow: {
+                // each bin's coordinates, from the intervals' bins
+                const IntervalIndex& coords = spec_coords.at(chrom);
+                std::vector<unsigned> start_bindxs = coords.start_bins(binned_bin_size);
+                std::vector<int64_t> starts, ends;
+                for (size_t i = 0; i < coords.size(); i++) {
+                    int64_t first_start = int64_t((coords.start(i) + binned_bin_size - 1) / binned_bin_size) * binned_bin_size;
+                    for (unsigned b = 0; b < start_bindxs[i+1] - start_bindxs[i]; b++) {
+                        starts.push_back(first_start + int64_t(b) * binned_bin_size);
+                        ends.push_back(starts.back() + binned_bin_size);
+                    }
+                }
+                size_t num_bins = starts.size();
+                size_t row_stride = layout == TensorLayout::track_major ? 1 : num_bws;
+                size_t track_stride = layout == TensorLayout::track_major ? num_bins : 1;
+                for (size_t lo = 0; lo < num_bins; lo += opts.batch_rows) {
+                    arrow_writer->write_batch(chrom, starts.data() + lo, ends.data() + lo, std::min(opts.batch_rows, num_bins - lo),
+                                              binned.data<double>() + lo*row_stride, row_stride, track_stride);
+                }
+                break;
+            }
+            case OutputFormat::bigwig:
+                break;
+            case OutputFormat::pt:
+#ifdef BIGWIGS2TENSORS_WITH_TORCH
+                add_digests({write_pt(out_dir_p / (chrom + ".pt"), binned, opts.dtype)});
+                break;
+#else
+                throw std::invalid_argument("BWBinner::save_binneds: pt output needs a build with libtorch"
+                                            " (BIGWIGS2TENSORS_WITH_TORCH)");
+#endif
+        }
+    };
+
+    if (opts.genome_wide) {
+        add_digests(save_genome_binned(out_dir_p, opts, quant));
+    }
+    else if (opts.format == OutputFormat::bigwig) {
+        add_digests(save_binned_bigWigs(out_dir_p));
+    }
+    else {
+        std::vector<std::string> chroms;
+        for (const auto& [chrom, size] : chrom_sizes) {
+            chroms.push_back(chrom);
+        }
+        // arrow and gathered safetensors append to a single file, in chrom_sizes order
+        bool single_file = opts.format == OutputFormat::arrow || (opts.format == OutputFormat::safetensors && !opts.per_chrom_files);
+        if (single_file)
+            std::for_each(chroms.begin(), chroms.end(), save_chrom);
+        else
+            parallel_for_each(chroms.begin(), chroms.end(), save_chrom);
+    }
+    if (!st_entries.empty())
+        add_digests({write_safetensors(out_dir_p / "binned.safetensors", st_entries, opts.dtype, st_metadata)});
+    if (arrow_writer)
+        add_digests({arrow_writer->close()});
+    if (opts.format == OutputFormat::bsz) {
+        BW_LOG_INFO("bsz: " << bsz_stats.raw_bytes << " bytes compressed to " << bsz_stats.compressed_bytes
+                    << " (ratio " << bsz_stats.ratio() << "), " << bsz_stats.throughput() << " MB/s");
+    }
+
+    add_digests({save_track_names(out_dir_p)});
+
+    // last, so a manifest means everything listed is complete
+    write_manifest(out_dir_p, digests);
 }
\ No newline at end of file
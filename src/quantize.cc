@@ -0,0 +1,154 @@
+#include <vector>
+#include <string>
+#include <filesystem>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <sstream>
+#include <stdexcept>
+#include <bigWigs2tensors/quantize.h>
+#include <bigWigs2tensors/npy.h>
+#include <bigWigs2tensors/util.h>
+
+namespace {
+
+// elements quantized per write
+constexpr size_t convert_chunk = 1 << 16;
+
+// codes values may take, i.e. all but the sentinel
+std::pair<long, long> code_range(QuantDtype dtype) {
+    switch (dtype) {
+        case QuantDtype::uint8: return {0, UINT8_MAX - 1};
+        case QuantDtype::uint16: return {0, UINT16_MAX - 1};
+        case QuantDtype::int16: return {INT16_MIN + 1, INT16_MAX};
+        case QuantDtype::none: break;
+    }
+    throw std::invalid_argument("code_range: not a quantized dtype");
+}
+
+double transform(double val, QuantTransform tf) {
+    return tf == QuantTransform::log1p ? std::copysign(std::log1p(std::abs(val)), val) : val;
+}
+
+template <typename T>
+void write_codes(std::ostream& out, const double* data, size_t rows, size_t cols, size_t track_axis,
+                 const QuantParams& params) {
+    auto [code_lo, code_hi] = code_range(params.dtype);
+    const T sentinel = static_cast<T>(quant_sentinel(params.dtype));
+    const size_t numel = rows * cols;
+    std::vector<T> codes(std::min(numel, convert_chunk));
+    for (size_t lo = 0; lo < numel; lo += convert_chunk) {
+        size_t n = std::min(convert_chunk, numel - lo);
+        for (size_t i = 0; i < n; i++) {
+            double val = data[lo + i];
+            if (std::isnan(val)) {
+                codes[i] = sentinel;
+                continue;
+            }
+            size_t track = track_axis == 0 ? (lo + i) / cols : (lo + i) % cols;
+            double code = std::nearbyint((transform(val, params.transform) - params.offset[track]) / params.scale[track]);
+            codes[i] = static_cast<T>(std::clamp(code, double(code_lo), double(code_hi)));
+        }
+        out.write(reinterpret_cast<const char*>(codes.data()), n * sizeof(T));
+    }
+}
+
+}  // namespace
+
+QuantDtype parse_quant_dtype(const std::string& name) {
+    if (name == "none")
+        return QuantDtype::none;
+    if (name == "uint8")
+        return QuantDtype::uint8;
+    if (name == "uint16")
+        return QuantDtype::uint16;
+    if (name == "int16")
+        return QuantDtype::int16;
+    throw std::invalid_argument("parse_quant_dtype: unsupported dtype " + name);
+}
+
+std::string quant_descr(QuantDtype dtype) {
+    switch (dtype) {
+        case QuantDtype::uint8: return "|u1";
+        case QuantDtype::uint16: return "<u2";
+        case QuantDtype::int16: return "<i2";
+        case QuantDtype::none: break;
+    }
+    throw std::invalid_argument("quant_descr: not a quantized dtype");
+}
+
+long quant_sentinel(QuantDtype dtype) {
+    switch (dtype) {
+        case QuantDtype::uint8: return UINT8_MAX;
+        case QuantDtype::uint16: return UINT16_MAX;
+        case QuantDtype::int16: return INT16_MIN;
+        case QuantDtype::none: break;
+    }
+    throw std::invalid_argument("quant_sentinel: not a quantized dtype");
+}
+
+QuantParams fit_quant(QuantDtype dtype, QuantTransform tf, const std::vector<double>& lo, const std::vector<double>& hi) {
+    auto [code_lo, code_hi] = code_range(dtype);
+    QuantParams params {dtype, tf, std::vector<double>(lo.size(), 1.0), std::vector<double>(lo.size(), 0.0)};
+    for (size_t t = 0; t < lo.size(); t++) {
+        double y_lo = transform(lo[t], tf);
+        double y_hi = transform(hi[t], tf);
+        if (!std::isfinite(y_lo) || !std::isfinite(y_hi))
+            continue;
+        double scale = (y_hi - y_lo) / double(code_hi - code_lo);
+        // a constant track still needs its value back
+        params.scale[t] = scale > 0 ? scale : 1.0;
+        params.offset[t] = y_lo - code_lo * params.scale[t];
+    }
+    return params;
+}
+
+void write_quantized_data(std::ostream& out, const double* data, size_t rows, size_t cols, size_t track_axis,
+                          const QuantParams& params) {
+    switch (params.dtype) {
+        case QuantDtype::uint8: write_codes<uint8_t>(out, data, rows, cols, track_axis, params); break;
+        case QuantDtype::uint16: write_codes<uint16_t>(out, data, rows, cols, track_axis, params); break;
+        case QuantDtype::int16: write_codes<int16_t>(out, data, rows, cols, track_axis, params); break;
+        case QuantDtype::none: throw std::invalid_argument("write_quantized_data: not a quantized dtype");
+    }
+}
+
+FileDigest write_quantized_npy(const std::filesystem::path& path, const double* data, size_t rows, size_t cols, size_t track_axis,
+                               const QuantParams& params) {
+    AtomicOfstream npy_F(path);
+
+    std::string header = npy_header(quant_descr(params.dtype), {rows, cols});
+    npy_F.write(header.data(), header.size());
+    write_quantized_data(npy_F, data, rows, cols, track_axis, params);
+    return npy_F.commit();
+}
+
+FileDigest write_quant_params(const std::filesystem::path& path, const QuantParams& params, const std::vector<std::string>& track_names) {
+    // full precision, so dequantizing matches the writer exactly
+    std::ostringstream json;
+    json.precision(17);
+    auto list = [&json](const auto& vals, auto fmt) {
+        json << '[';
+        for (size_t i = 0; i < vals.size(); i++) {
+            json << (i ? ", " : "") << fmt(vals[i]);
+        }
+        json << ']';
+    };
+    auto as_is = [](double val) { return val; };
+
+    json << "{\n"
+         << "    \"dtype\": " << json_quote(quant_descr(params.dtype)) << ",\n"
+         << "    \"transform\": " << json_quote(params.transform == QuantTransform::log1p ? "log1p" : "linear") << ",\n"
+         << "    \"sentinel\": " << quant_sentinel(params.dtype) << ",\n"
+         << "    \"tracks\": ";
+    list(track_names, json_quote);
+    json << ",\n    \"scale\": ";
+    list(params.scale, as_is);
+    json << ",\n    \"offset\": ";
+    list(params.offset, as_is);
+    json << "\n}\n";
+
+    AtomicOfstream json_F(path);
+    json_F << json.str();
+    return json_F.commit();
+}
@@ -0,0 +1,76 @@
+#include <vector>
+#include <map>
+#include <string>
+#include <filesystem>
+#include <numeric>
+#include <stdexcept>
+#include <bigWigs2tensors/safetensors.h>
+#include <bigWigs2tensors/util.h>
+
+namespace {
+
+constexpr size_t data_align = 64;
+
+size_t numel(const std::vector<size_t>& shape) {
+    return std::accumulate(shape.begin(), shape.end(), size_t(1), std::multiplies<size_t>());
+}
+
+}  // namespace
+
+std::string safetensors_dtype(NpyDtype dtype) {
+    switch (dtype) {
+        case NpyDtype::float32: return "F32";
+        case NpyDtype::float64: return "F64";
+    }
+    throw std::invalid_argument("safetensors_dtype: unknown dtype");
+}
+
+std::string safetensors_header(const std::vector<SafetensorsEntry>& tensors, NpyDtype dtype,
+                               const std::map<std::string, std::string>& metadata) {
+    std::string json = "{";
+    if (!metadata.empty()) {
+        json += "\"__metadata__\":{";
+        for (const auto& [key, val] : metadata) {
+            json += json_quote(key) + ":" + json_quote(val) + ",";
+        }
+        json.back() = '}';
+        json += ",";
+    }
+
+    // offsets are relative to the start of the data, with no gaps between tensors
+    size_t offset = 0;
+    for (const auto& tensor : tensors) {
+        size_t end = offset + numel(tensor.shape) * npy_itemsize(dtype);
+        json += json_quote(tensor.name) + ":{\"dtype\":\"" + safetensors_dtype(dtype) + "\",\"shape\":[";
+        for (size_t i = 0; i < tensor.shape.size(); i++) {
+            json += (i ? "," : "") + std::to_string(tensor.shape[i]);
+        }
+        json += "],\"data_offsets\":[" + std::to_string(offset) + "," + std::to_string(end) + "]},";
+        offset = end;
+    }
+    if (json.back() == ',')
+        json.pop_back();
+    json += "}";
+
+    // trailing spaces are allowed in the header
+    json.resize(json.size() + (data_align - (8 + json.size()) % data_align) % data_align, ' ');
+
+    std::string header(8, '\0');
+    uint64_t header_len = json.size();
+    for (int i = 0; i < 8; i++) {
+        header[i] = static_cast<char>((header_len >> (8*i)) & 0xFF);
+    }
+    return header + json;
+}
+
+FileDigest write_safetensors(const std::filesystem::path& path, const std::vector<SafetensorsEntry>& tensors, NpyDtype dtype,
+                             const std::map<std::string, std::string>& metadata) {
+    AtomicOfstream out_F(path);
+
+    std::string header = safetensors_header(tensors, dtype, metadata);
+    out_F.write(header.data(), header.size());
+    for (const auto& tensor : tensors) {
+        write_npy_data(out_F, tensor.data, numel(tensor.shape), dtype);
+    }
+    return out_F.commit();
+}
@@ -0,0 +1,116 @@
+#include <vector>
+#include <string>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <bigWigs2tensors/sparse.h>
+
+namespace {
+
+bool is_fill(double val, double fill) {
+    return std::isnan(fill) ? std::isnan(val) : val == fill;
+}
+
+FileDigest write_i64_npy(const std::filesystem::path& path, const std::vector<int64_t>& vals) {
+    AtomicOfstream npy_F(path);
+    std::string header = npy_header("<i8", {vals.size()});
+    npy_F.write(header.data(), header.size());
+    npy_F.write(reinterpret_cast<const char*>(vals.data()), vals.size() * sizeof(int64_t));
+    return npy_F.commit();
+}
+
+std::vector<int64_t> read_i64_npy(const std::filesystem::path& path) {
+    NpyArray arr = read_npy(path);
+    if (arr.descr != "<i8")
+        throw std::runtime_error("read_sparse_columns: expected int64 in " + path.string());
+    std::vector<int64_t> vals(arr.bytes.size() / sizeof(int64_t));
+    std::memcpy(vals.data(), arr.bytes.data(), arr.bytes.size());
+    return vals;
+}
+
+std::vector<double> read_f64_npy(const std::filesystem::path& path) {
+    NpyArray arr = read_npy(path);
+    if (arr.descr == "<f4") {
+        const float* vals = reinterpret_cast<const float*>(arr.bytes.data());
+        return std::vector<double>(vals, vals + arr.bytes.size() / sizeof(float));
+    }
+    if (arr.descr != "<f8")
+        throw std::runtime_error("read_sparse_columns: expected floats in " + path.string());
+    std::vector<double> vals(arr.bytes.size() / sizeof(double));
+    std::memcpy(vals.data(), arr.bytes.data(), arr.bytes.size());
+    return vals;
+}
+
+}  // namespace
+
+double TrackFill::fill() const {
+    return nans > zeros ? std::nan("") : 0.0;
+}
+
+double TrackFill::density(size_t num_bins) const {
+    return num_bins ? double(num_bins - std::max(zeros, nans)) / num_bins : 0.0;
+}
+
+void SparseColumns::densify(size_t col, size_t bin_lo, size_t bin_hi, double* out) const {
+    std::fill_n(out, bin_hi - bin_lo, fill.at(col));
+    auto first = indices.begin() + indptr[col];
+    auto last = indices.begin() + indptr[col + 1];
+    for (auto it = std::lower_bound(first, last, int64_t(bin_lo)); it != last && *it < int64_t(bin_hi); it++) {
+        out[*it - bin_lo] = data[it - indices.begin()];
+    }
+}
+
+SparseColumns make_sparse_columns(const double* data, size_t rows, size_t cols, size_t track_axis,
+                                  const std::vector<int64_t>& tracks, const std::vector<double>& fills) {
+    SparseColumns sparse;
+    sparse.num_bins = track_axis == 0 ? cols : rows;
+    sparse.tracks = tracks;
+    sparse.fill = fills;
+    // a track's bins are contiguous along a row, or strided down a column
+    size_t bin_stride = track_axis == 0 ? 1 : cols;
+    for (size_t c = 0; c < tracks.size(); c++) {
+        const double* first = track_axis == 0 ? data + tracks[c]*cols : data + tracks[c];
+        for (size_t b = 0; b < sparse.num_bins; b++) {
+            double val = first[b*bin_stride];
+            if (is_fill(val, fills[c]))
+                continue;
+            sparse.indices.push_back(b);
+            sparse.data.push_back(val);
+        }
+        sparse.indptr.push_back(sparse.indices.size());
+    }
+    return sparse;
+}
+
+std::vector<FileDigest> write_sparse_columns(const std::filesystem::path& dir, const SparseColumns& cols, NpyDtype dtype) {
+    std::filesystem::create_directories(dir);
+    std::vector<FileDigest> digests {
+        write_i64_npy(dir / "num_bins.npy", {int64_t(cols.num_bins)}),
+        write_i64_npy(dir / "tracks.npy", cols.tracks),
+        write_npy(dir / "fill.npy", cols.fill.data(), {cols.fill.size()}, NpyDtype::float64),
+        write_i64_npy(dir / "indptr.npy", cols.indptr),
+        write_i64_npy(dir / "indices.npy", cols.indices),
+        write_npy(dir / "data.npy", cols.data.data(), {cols.data.size()}, dtype)
+    };
+    // named relative to the directory's parent
+    for (FileDigest& digest : digests) {
+        digest.file = (dir.filename() / digest.file).string();
+    }
+    return digests;
+}
+
+SparseColumns read_sparse_columns(const std::filesystem::path& dir) {
+    SparseColumns cols;
+    cols.num_bins = read_i64_npy(dir / "num_bins.npy").at(0);
+    cols.tracks = read_i64_npy(dir / "tracks.npy");
+    cols.fill = read_f64_npy(dir / "fill.npy");
+    cols.indptr = read_i64_npy(dir / "indptr.npy");
+    cols.indices = read_i64_npy(dir / "indices.npy");
+    cols.data = read_f64_npy(dir / "data.npy");
+    if (cols.indptr.size() != cols.tracks.size() + 1 || cols.indices.size() != cols.data.size())
+        throw std::runtime_error("read_sparse_columns: inconsistent sparse columns in " + dir.string());
+    return cols;
+}
@@ -0,0 +1,21 @@
+#include <fstream>
+#include <stdexcept>
+#include <bigWigs2tensors/torch_sink.h>
+#include <bigWigs2tensors/mem_stats.h>
+
+torch::Tensor to_tensor(const NDArray& arr) {
+    // the deleter holds a copy of the array, sharing (and so keeping alive) its buffer
+    return torch::from_blob(arr.raw_data(), {int64_t(arr.rows()), int64_t(arr.cols())},
+                            [arr](void*) {},
+                            constants::tensor_opts.dtype(arr.dtype() == NpyDtype::float32 ? torch::kFloat32 : torch::kFloat64));
+}
+
+FileDigest write_pt(const std::filesystem::path& path, const NDArray& arr, NpyDtype dtype) {
+    torch::Tensor tensor = to_tensor(arr);
+    auto bytes = torch::pickle_save(dtype == NpyDtype::float32 ? tensor.to(torch::kFloat32) : tensor.to(torch::kFloat64));
+    // the whole pickled file, allocated by libtorch
+    bwmem::Charge pickled(bwmem::Pool::serialization, bytes.capacity());
+    AtomicOfstream pt_F(path);
+    pt_F.write(bytes.data(), bytes.size());
+    return pt_F.commit();
+}
@@ -2,11 +2,38 @@
 #include <map>
 #include <execution>
 #include <cmath>
+#include <cstdio>
+#include <cctype>
+#include <string>
+#include <stdexcept>
 #include <iostream>
 #include <fstream>
 #include <filesystem>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <numeric>
 #include <bigWig.h>
 #include <bigWigs2tensors/util.h>
+#include <bigWigs2tensors/bed.h>
+#include <bigWigs2tensors/log.h>
+
+namespace {
+
+// streams all of a chromosome's intervals, for logging
+struct fmt_intervals {
+    const IntervalIndex& interv;
+};
+
+std::ostream& operator<<(std::ostream& os, const fmt_intervals& f) {
+    os << "{ ";
+    for (size_t i = 0; i < f.interv.size(); i++) {
+        os << '[' << f.interv.start(i) << ',' << f.interv.end(i) << ") ";
+    }
+    return os << '}';
+}
+
+}  // namespace
 
 std::vector<std::string> find_paths_filetype(const std::string& search_dir, const std::string& file_ext) {
     // collect all the bigWig files in the data directory
@@ -20,6 +47,52 @@ std::vector<std::string> find_paths_filetype(const std::string& search_dir, cons
     return match_paths;
 }
 
+std::string json_quote(const std::string& str) {
+    std::string quoted = "\"";
+    for (char c : str) {
+        switch (c) {
+            case '"': quoted += "\\\""; break;
+            case '\\': quoted += "\\\\"; break;
+            case '\n': quoted += "\\n"; break;
+            case '\t': quoted += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char escaped[7];
+                    std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    quoted += escaped;
+                }
+                else quoted += c;
+        }
+    }
+    return quoted + '"';
+}
+
+size_t parse_byte_size(const std::string& str) {
+    size_t pos = 0;
+    unsigned long long val;
+    try {
+        val = std::stoull(str, &pos);
+    }
+    catch (const std::exception&) {
+        throw std::invalid_argument("parse_byte_size: not a size: " + str);
+    }
+    std::string suffix = str.substr(pos);
+    int shift = 0;
+    if (!suffix.empty()) {
+        const std::string units = "KMGT";
+        size_t unit = units.find(std::toupper(suffix[0]));
+        if (unit != std::string::npos) {
+            shift = 10 * (unit + 1);
+            suffix = suffix.substr(1);
+        }
+    }
+    if (!(suffix.empty() || suffix == "B" || (shift && suffix == "iB")))
+        throw std::invalid_argument("parse_byte_size: not a size: " + str);
+    if (shift && val > (~0ull >> shift))
+        throw std::invalid_argument("parse_byte_size: too large: " + str);
+    return size_t(val) << shift;
+}
+
 std::map<std::string, int> parse_chrom_sizes(const std::string& chrom_sizes_path) {
     std::map<std::string, int> chrom_sizes;
     std::ifstream chrom_sizes_file(chrom_sizes_path);
@@ -37,150 +110,83 @@ std::map<std::string, int> parse_chrom_sizes(const std::string& chrom_sizes_path
 }
 
 chroms_coords_map_t parse_coords_bigBed(const std::string& coords_bed_path, const std::map<std::string, int>& chrom_sizes) {
-    bigWigFile_t* coords_bed = bbOpen(const_cast<char*>(coords_bed_path.c_str()), NULL);
-    if (bbIsBigBed(const_cast<char*>(coords_bed_path.c_str()), NULL) != 1) {
-        std::cerr << "ERROR: " << coords_bed_path << " is not a bigBed file" << std::endl;
-        exit(1);
-    }
-
-    std::map<std::string, bbOverlappingEntries_t*> chroms_coords;
-    // get a bbOverlappingEntry from the coordinates specification bigBed for each chromosome
-    std::for_each(std::execution::par_unseq,
-                    chrom_sizes.begin(), chrom_sizes.end(),
-                    [&coords_bed, &chroms_coords](const auto& chr_entry) {
-                        std::string chrom = chr_entry.first;
-                        int chrom_size = chr_entry.second;
-                        // REMEMBER to bwDestroyOverlappingIntervals() to free
-                        bbOverlappingEntries_t* interv = bbGetOverlappingEntries(coords_bed, const_cast<char*>(chrom.c_str()), 0, chrom_size, 0);
-
-                        // if (!interv) {
-                        //     // std::cout << "Warning: no intervals found for " << chrom << " in specified coordinates BED file, skipping..." << std::endl;
-                        // }
-                        // else {
-                        if (interv) {
-                            std::cout << interv->l <<" intervals for "<< chrom <<": {";
-                            std::cout << ' ';
-
-                            for (int i = 0; i < interv->l; i++) {
-                                std::cout << '[' << interv->start[i] << ',' << interv->end[i] << ')';
-                                std::cout << ' ';
-                            };
-                            std::cout << "}" << std::endl;
-
-                            chroms_coords.emplace(chrom, interv);
+    if (bbIsBigBed(const_cast<char*>(coords_bed_path.c_str()), NULL) != 1)
+        throw std::runtime_error("parse_coords_bigBed: " + coords_bed_path + " is not a bigBed file");
+
+    // a slot per chromosome, in chrom_sizes order, each only ever written by the worker that fetched it
+    std::vector<std::pair<const std::string*, int>> chroms;
+    for (const auto& [chrom, size] : chrom_sizes)
+        chroms.emplace_back(&chrom, size);
+    std::vector<IntervalIndex> slots(chroms.size());
+
+    // libBigWig handles are not thread-safe: each worker opens its own, then takes chromosomes
+    // one at a time, as they vary widely in size
+    std::vector<size_t> workers(std::min<size_t>(chroms.size(), std::max(1u, std::thread::hardware_concurrency())));
+    std::iota(workers.begin(), workers.end(), 0);
+    std::atomic<size_t> next_chrom {0};
+    parallel_for_each(workers.begin(), workers.end(),
+                    [&coords_bed_path, &chroms, &slots, &next_chrom](size_t) {
+                        std::unique_ptr<bigWigFile_t, decltype(&bwClose)> coords_bed(
+                            bbOpen(const_cast<char*>(coords_bed_path.c_str()), NULL), &bwClose);
+                        if (!coords_bed)
+                            throw std::runtime_error("parse_coords_bigBed: could not open " + coords_bed_path);
+                        for (size_t c = next_chrom++; c < chroms.size(); c = next_chrom++) {
+                            const auto& [chrom, size] = chroms[c];
+                            std::unique_ptr<bbOverlappingEntries_t, decltype(&bbDestroyOverlappingEntries)> entries(
+                                bbGetOverlappingEntries(coords_bed.get(), const_cast<char*>(chrom->c_str()), 0, size, 0),
+                                &bbDestroyOverlappingEntries);
+                            if (!entries)
+                                continue;
+                            // copied out of libBigWig's arrays, which are freed right away
+                            std::vector<Interval> intervals(entries->l);
+                            for (uint32_t i = 0; i < entries->l; i++)
+                                intervals[i] = {entries->start[i], entries->end[i]};
+                            slots[c] = IntervalIndex(std::move(intervals));
                         }
                     });
-    /*
-    for (const auto& chr_entry : chrom_sizes) {
-        std::string chrom = chr_entry.first;
-        int chrom_size = chr_entry.second;
-        // REMEMBER to bwDestroyOverlappingIntervals() to free
-        bbOverlappingEntries_t* interv = bbGetOverlappingEntries(coords_bed, const_cast<char*>(chrom.c_str()), 0, chrom_size, 0);
-        chroms_coords.emplace(chrom, interv);
-
-        std::cout << interv->l <<" intervals for "<< chrom <<": {";
-        std::cout << ' ';
-
-        for (int i = 0; i < interv->l; i++) {
-            std::cout << '[' << interv->start[i] << ',' << interv->end[i] << ')';
-            std::cout << ' ';
-        };
-        std::cout << "}" << std::endl;
-    }
-    */
-
-    bwClose(coords_bed);
 
+    chroms_coords_map_t chroms_coords;
+    for (size_t c = 0; c < chroms.size(); c++) {
+        if (slots[c].empty()) {
+            BW_LOG_DEBUG("no intervals found for " << *chroms[c].first << " in " << coords_bed_path << ", skipping...");
+            continue;
+        }
+        BW_LOG_DEBUG(slots[c].size() << " intervals for " << *chroms[c].first);
+        BW_LOG_TRACE(*chroms[c].first << ": " << fmt_intervals{slots[c]});
+        chroms_coords.emplace(*chroms[c].first, std::move(slots[c]));
+    }
+    BW_LOG_INFO(coords_bed_path << ": intervals on " << chroms_coords.size() << " chromosomes, by " << workers.size() << " workers");
     return chroms_coords;
 }
 
 std::pair< std::map<std::string,int>, chroms_coords_map_t > parse_chrom_sizes_coords(const std::string& chrom_sizes_path, const std::string& coords_bed_path) {
-    std::map<std::string, int> chrom_sizes;
-    std::map<std::string, bbOverlappingEntries_t*> chroms_coords;
-
-    std::ifstream chrom_sizes_file(chrom_sizes_path);
-    if (!chrom_sizes_file.is_open()) {
-        std::cerr << "ERROR: could not open " << chrom_sizes_path << std::endl;
-        exit(1);
-    }
-    bigWigFile_t* coords_bed = bbOpen(const_cast<char*>(coords_bed_path.c_str()), NULL);
-    if (bbIsBigBed(const_cast<char*>(coords_bed_path.c_str()), NULL) != 1) {
-        std::cerr << "ERROR: " << coords_bed_path << " is not a bigBed file" << std::endl;
-        exit(1);
-    }
+    std::map<std::string, int> all_sizes = parse_chrom_sizes(chrom_sizes_path);
+    // anything but a bigBed is read as a plain-text, or gzipped, BED
+    chroms_coords_map_t chroms_coords = bbIsBigBed(const_cast<char*>(coords_bed_path.c_str()), NULL) == 1
+                                        ? parse_coords_bigBed(coords_bed_path, all_sizes)
+                                        : parse_coords_bed(coords_bed_path, all_sizes);
 
-    std::string chrom;
-    int size;
-    bbOverlappingEntries_t* interv;
-    // for each chromsome in the chrom_sizes file, get the intervals from the bigBed file
-    while (chrom_sizes_file >> chrom >> size) {
-        bbOverlappingEntries_t* interv = bbGetOverlappingEntries(coords_bed, const_cast<char*>(chrom.c_str()), 0, size, 0);
-        if (!interv) {
-            std::cout << "Warning: no intervals found for " << chrom << " in specified coordinates BED file, skipping..." << std::endl;
-        }
-        else {
-            // only add to the map if chrom specified in coords_bed
-            chrom_sizes[chrom] = size;
-            chroms_coords.emplace(chrom, interv);
-        }
+    // only the chromosomes with intervals
+    std::map<std::string, int> chrom_sizes;
+    for (const auto& [chrom, interv] : chroms_coords) {
+        chrom_sizes[chrom] = all_sizes.at(chrom);
     }
-
-    chrom_sizes_file.close();
-    bwClose(coords_bed);
-
-    return std::make_pair(chrom_sizes, chroms_coords);
-}
-
-unsigned num_bins_intersect_interval(unsigned start, unsigned end, unsigned bin_size) {
-    return std::floor(end / static_cast<float>(bin_size)) - std::ceil(start / static_cast<float>(bin_size));
+    return std::make_pair(std::move(chrom_sizes), std::move(chroms_coords));
 }
 
-bwOverlappingIntervals_t* bin_coords(const bbOverlappingEntries_t* coords, unsigned bin_size) {
-    bwOverlappingIntervals_t* binned_coords = new bwOverlappingIntervals_t;
-    binned_coords->l = coords->l;
-    binned_coords->start = new uint32_t[coords->l];
-    binned_coords->end = new uint32_t[coords->l];
-    binned_coords->value = new float[coords->l];
-
-    std::transform(coords->start, coords->start + coords->l, binned_coords->start,
-                   [bin_size](uint32_t start) { return std::ceil(start / static_cast<float>(bin_size)); });
-
-    std::transform(coords->end, coords->end + coords->l, binned_coords->end,
-                   [bin_size](uint32_t end) { return std::floor(end / static_cast<float>(bin_size)); });
-
-    std::transform(binned_coords->start, binned_coords->start + coords->l, binned_coords->end, binned_coords->value,
-                   [](uint32_t start, uint32_t end) { return end - start; });
-
-    return binned_coords;
+unsigned num_bins_intersect_interval(uint64_t start, uint64_t end, unsigned bin_size) {
+    // integer floor(end / bin_size) - ceil(start / bin_size), floats lose precision past 2^24 bp
+    uint64_t first_bin = (start + bin_size - 1) / bin_size;
+    uint64_t last_bin = end / bin_size;
+    // an interval within a single bin covers none
+    return last_bin > first_bin ? last_bin - first_bin : 0;
 }
 
 chroms_coords_map_t make_full_chroms_coords_map(const std::map<std::string, int>& chrom_sizes) {
-    std::map<std::string, bbOverlappingEntries_t*> chroms_coords;
-
-    std::transform(chrom_sizes.begin(), chrom_sizes.end(),
-                    std::inserter(chroms_coords, chroms_coords.end()),
-                    [](const std::pair<std::string, int>& chrom_size) {
-                        std::string chrom = chrom_size.first;
-                        unsigned size = chrom_size.second;
-
-                        bbOverlappingEntries_t* entries = new bbOverlappingEntries_t;
-
-                        // Will use entire chromosomes <=> "full" coordinates <=> 0 to chrom_size
-                        uint32_t* starts = new uint32_t[1];
-                        starts[0] = 0;
-                        entries->start = starts;
-
-                        uint32_t* ends = new uint32_t[1];
-                        // 0-based half open
-                        ends[0] = size;
-                        entries->end = ends;
-
-                        entries->l = 1;
-                        entries->m = 1;
-                        entries->str = NULL;
-
-                        return std::make_pair(chrom, entries);
-                    });
-    
+    chroms_coords_map_t chroms_coords;
+    for (const auto& [chrom, size] : chrom_sizes) {
+        // Will use entire chromosomes <=> "full" coordinates <=> 0 to chrom_size, 0-based half open
+        chroms_coords.emplace(chrom, IntervalIndex({{0, uint64_t(size)}}));
+    }
     return chroms_coords;
-}
\ No newline at end of file
+}
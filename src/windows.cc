@@ -0,0 +1,45 @@
+#include <vector>
+#include <string>
+#include <numeric>
+#include <random>
+#include <cstdio>
+#include <stdexcept>
+#include <bigWigs2tensors/windows.h>
+
+std::vector<ShardSlot> assign_shards(size_t n_windows, size_t windows_per_shard, uint64_t seed,
+                                     std::vector<size_t>& shard_sizes) {
+    if (windows_per_shard == 0)
+        throw std::invalid_argument("assign_shards: shards must hold at least one window");
+
+    std::vector<size_t> order(n_windows);
+    std::iota(order.begin(), order.end(), 0);
+    std::mt19937_64 rng(seed);
+    for (size_t i = n_windows; i > 1; i--) {
+        std::swap(order[i - 1], order[rng() % i]);
+    }
+
+    // the first n_windows % num_shards shards get one window more
+    size_t num_shards = (n_windows + windows_per_shard - 1) / windows_per_shard;
+    shard_sizes.assign(num_shards, num_shards ? n_windows / num_shards : 0);
+    for (size_t s = 0; s < (num_shards ? n_windows % num_shards : 0); s++) {
+        shard_sizes[s]++;
+    }
+
+    // fill the shards one after another with the shuffled windows
+    std::vector<ShardSlot> slots(n_windows);
+    size_t shard = 0, row = 0;
+    for (size_t i = 0; i < n_windows; i++) {
+        if (row == shard_sizes[shard]) {
+            shard++;
+            row = 0;
+        }
+        slots[order[i]] = {uint32_t(shard), row++};
+    }
+    return slots;
+}
+
+std::string shard_name(const std::string& split, size_t shard) {
+    char num[16];
+    std::snprintf(num, sizeof(num), "%05zu", shard);
+    return split + "-" + num + ".npy";
+}
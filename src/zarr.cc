@@ -0,0 +1,105 @@
+#include <vector>
+#include <string>
+#include <filesystem>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <stdexcept>
+#include <zlib.h>
+#include <bigWigs2tensors/zarr.h>
+#include <bigWigs2tensors/util.h>
+#include <bigWigs2tensors/mem_stats.h>
+
+namespace {
+
+using Bytes = bwmem::vector<char, bwmem::Pool::serialization>;
+
+FileDigest write_file(const std::filesystem::path& path, const char* bytes, size_t size) {
+    AtomicOfstream out_F(path);
+    out_F.write(bytes, size);
+    return out_F.commit();
+}
+
+// copies chunk (row_lo, col_lo) out of `data`, NaN-padded to the full chunk shape
+template <typename T>
+void gather_chunk(const double* data, size_t rows, size_t cols, size_t row_lo, size_t col_lo,
+                  size_t chunk_rows, size_t chunk_cols, Bytes& bytes) {
+    bytes.resize(chunk_rows * chunk_cols * sizeof(T));
+    T* chunk = reinterpret_cast<T*>(bytes.data());
+    std::fill_n(chunk, chunk_rows * chunk_cols, std::nan(""));
+
+    size_t n_rows = std::min(chunk_rows, rows - row_lo);
+    size_t n_cols = std::min(chunk_cols, cols - col_lo);
+    for (size_t r = 0; r < n_rows; r++) {
+        std::copy_n(data + (row_lo + r)*cols + col_lo, n_cols, chunk + r*chunk_cols);
+    }
+}
+
+}  // namespace
+
+std::vector<FileDigest> write_zarr_group(const std::filesystem::path& group_dir, const std::string& attrs_json) {
+    std::filesystem::create_directories(group_dir);
+    const std::string zgroup = "{\n    \"zarr_format\": 2\n}\n";
+    std::vector<FileDigest> digests {write_file(group_dir / ".zgroup", zgroup.data(), zgroup.size())};
+    if (!attrs_json.empty())
+        digests.push_back(write_file(group_dir / ".zattrs", attrs_json.data(), attrs_json.size()));
+    return digests;
+}
+
+std::vector<FileDigest> write_zarr_array(const std::filesystem::path& array_dir, const double* data, size_t rows, size_t cols,
+                                         const ZarrArrayOptions& opts) {
+    if (opts.chunk_rows == 0 || opts.chunk_cols == 0)
+        throw std::invalid_argument("write_zarr_array: chunk dimensions must be positive");
+    std::filesystem::create_directories(array_dir);
+
+    std::string compressor = "null";
+    if (opts.zlib_level > 0)
+        compressor = "{\"id\": \"zlib\", \"level\": " + std::to_string(opts.zlib_level) + "}";
+    std::string zarray = "{\n"
+        "    \"zarr_format\": 2,\n"
+        "    \"shape\": [" + std::to_string(rows) + ", " + std::to_string(cols) + "],\n"
+        "    \"chunks\": [" + std::to_string(opts.chunk_rows) + ", " + std::to_string(opts.chunk_cols) + "],\n"
+        "    \"dtype\": \"" + npy_descr(opts.dtype) + "\",\n"
+        "    \"compressor\": " + compressor + ",\n"
+        "    \"fill_value\": \"NaN\",\n"
+        "    \"order\": \"C\",\n"
+        "    \"filters\": null,\n"
+        "    \"dimension_separator\": \".\"\n"
+        "}\n";
+
+    // parallelize over the chunk grid, each worker with its own chunk buffers; the .zarray goes last
+    size_t grid_rows = (rows + opts.chunk_rows - 1) / opts.chunk_rows;
+    size_t grid_cols = (cols + opts.chunk_cols - 1) / opts.chunk_cols;
+    std::vector<size_t> chunk_idxs(grid_rows * grid_cols);
+    std::iota(chunk_idxs.begin(), chunk_idxs.end(), 0);
+    std::vector<FileDigest> digests(chunk_idxs.size() + 1);
+
+    parallel_for_each(chunk_idxs.begin(), chunk_idxs.end(),
+                    [&array_dir, data, rows, cols, &opts, grid_cols, &digests](size_t chunk_idx) {
+                        size_t i = chunk_idx / grid_cols;
+                        size_t j = chunk_idx % grid_cols;
+                        Bytes raw;
+                        if (opts.dtype == NpyDtype::float32)
+                            gather_chunk<float>(data, rows, cols, i*opts.chunk_rows, j*opts.chunk_cols, opts.chunk_rows, opts.chunk_cols, raw);
+                        else
+                            gather_chunk<double>(data, rows, cols, i*opts.chunk_rows, j*opts.chunk_cols, opts.chunk_rows, opts.chunk_cols, raw);
+
+                        std::filesystem::path chunk_path = array_dir / (std::to_string(i) + "." + std::to_string(j));
+                        if (opts.zlib_level <= 0) {
+                            digests[chunk_idx] = write_file(chunk_path, raw.data(), raw.size());
+                            return;
+                        }
+                        Bytes compressed(compressBound(raw.size()));
+                        uLongf compressed_size = compressed.size();
+                        if (compress2(reinterpret_cast<Bytef*>(compressed.data()), &compressed_size,
+                                      reinterpret_cast<const Bytef*>(raw.data()), raw.size(), opts.zlib_level) != Z_OK)
+                            throw std::runtime_error("write_zarr_array: zlib failed compressing " + chunk_path.string());
+                        digests[chunk_idx] = write_file(chunk_path, compressed.data(), compressed_size);
+                    });
+    digests.back() = write_file(array_dir / ".zarray", zarray.data(), zarray.size());
+    // named relative to the directory's parent
+    for (FileDigest& digest : digests) {
+        digest.file = (array_dir.filename() / digest.file).string();
+    }
+    return digests;
+}
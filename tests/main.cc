@@ -1,25 +1,161 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include <vector>
+#include <memory>
+#include <algorithm>
+#include <array>
 #include <map>
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cmath>
 #include <filesystem>
+#include <random>
+#include <type_traits>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <zlib.h>
 #include <doctest/doctest.h>
 #include <bigWigs2tensors/util.h>
 #include <bigWigs2tensors/proc_bigWigs.h>
+#include <bigWigs2tensors/bed.h>
+#include <bigWigs2tensors/intervals.h>
+#include <bigWigs2tensors/log.h>
 
 const std::filesystem::path DATA_DIR = std::filesystem::current_path() / "data";
 
+// appends `val` little-endian
+template <typename T>
+void put_le(std::string& out, T val) {
+    for (size_t i = 0; i < sizeof(T); i++)
+        out += char((uint64_t(val) >> (8*i)) & 0xff);
+}
+
+/*
+Writes a minimal uncompressed BED3 bigBed: every chromosome of `chrom_sizes` in its chromosome tree,
+the `intervals` of each (sorted) in one data block, and a single-leaf R-tree over the blocks.
+*/
+void write_toy_bigBed(const std::filesystem::path& path, const std::map<std::string, int>& chrom_sizes,
+                      const std::map<std::string, std::vector<std::pair<uint32_t, uint32_t>>>& intervals) {
+    const size_t header_len = 64, chrom_tree_header_len = 32, index_header_len = 48;
+    size_t key_size = 1;
+    for (const auto& [chrom, size] : chrom_sizes)
+        key_size = std::max(key_size, chrom.size());
+
+    std::string chrom_tree;
+    put_le<uint32_t>(chrom_tree, 0x78CA8C91);
+    put_le<uint32_t>(chrom_tree, chrom_sizes.size());
+    put_le<uint32_t>(chrom_tree, key_size);
+    put_le<uint32_t>(chrom_tree, 8);
+    put_le<uint64_t>(chrom_tree, chrom_sizes.size());
+    put_le<uint64_t>(chrom_tree, 0);
+    put_le<uint8_t>(chrom_tree, 1);
+    put_le<uint8_t>(chrom_tree, 0);
+    put_le<uint16_t>(chrom_tree, chrom_sizes.size());
+    uint32_t tid = 0;
+    for (const auto& [chrom, size] : chrom_sizes) {
+        chrom_tree += chrom + std::string(key_size - chrom.size(), '\0');
+        put_le<uint32_t>(chrom_tree, tid++);
+        put_le<uint32_t>(chrom_tree, size);
+    }
+
+    // a block per chromosome with intervals: its tid, first start, last end and where its records are
+    struct Block {
+        uint32_t tid, start, end;
+        uint64_t offset, size;
+    };
+    std::vector<Block> blocks;
+    const uint64_t data_offset = header_len + chrom_tree.size();
+    std::string data;
+    uint64_t n_records = 0;
+    put_le<uint64_t>(data, 0);
+    tid = 0;
+    for (const auto& [chrom, size] : chrom_sizes) {
+        auto chrom_intervals = intervals.find(chrom);
+        if (chrom_intervals != intervals.end() && !chrom_intervals->second.empty()) {
+            std::vector<std::pair<uint32_t, uint32_t>> sorted = chrom_intervals->second;
+            std::sort(sorted.begin(), sorted.end());
+            Block block {tid, sorted.front().first, 0, data_offset + data.size(), 0};
+            for (const auto& [start, end] : sorted) {
+                put_le<uint32_t>(data, tid);
+                put_le<uint32_t>(data, start);
+                put_le<uint32_t>(data, end);
+                data += '\0';
+                block.end = std::max(block.end, end);
+                n_records++;
+            }
+            block.size = data_offset + data.size() - block.offset;
+            blocks.push_back(block);
+        }
+        tid++;
+    }
+    for (size_t i = 0; i < 8; i++)
+        data[i] = char((n_records >> (8*i)) & 0xff);
+
+    std::string index;
+    const uint64_t index_offset = data_offset + data.size();
+    put_le<uint32_t>(index, 0x2468ACE0);
+    put_le<uint32_t>(index, std::max<size_t>(blocks.size(), 1));
+    put_le<uint64_t>(index, blocks.size());
+    put_le<uint32_t>(index, blocks.empty() ? 0 : blocks.front().tid);
+    put_le<uint32_t>(index, blocks.empty() ? 0 : blocks.front().start);
+    put_le<uint32_t>(index, blocks.empty() ? 0 : blocks.back().tid);
+    put_le<uint32_t>(index, blocks.empty() ? 0 : blocks.back().end);
+    put_le<uint64_t>(index, index_offset);
+    put_le<uint32_t>(index, 1024);
+    put_le<uint32_t>(index, 0);
+    REQUIRE(index.size() == index_header_len);
+    put_le<uint8_t>(index, 1);
+    put_le<uint8_t>(index, 0);
+    put_le<uint16_t>(index, blocks.size());
+    for (const Block& block : blocks) {
+        put_le<uint32_t>(index, block.tid);
+        put_le<uint32_t>(index, block.start);
+        put_le<uint32_t>(index, block.tid);
+        put_le<uint32_t>(index, block.end);
+        put_le<uint64_t>(index, block.offset);
+        put_le<uint64_t>(index, block.size);
+    }
+
+    std::string header;
+    put_le<uint32_t>(header, 0x8789F2EB);
+    put_le<uint16_t>(header, 4);
+    put_le<uint16_t>(header, 0);
+    put_le<uint64_t>(header, header_len);
+    put_le<uint64_t>(header, data_offset);
+    put_le<uint64_t>(header, index_offset);
+    put_le<uint16_t>(header, 3);
+    put_le<uint16_t>(header, 3);
+    put_le<uint64_t>(header, 0);
+    put_le<uint64_t>(header, 0);
+    put_le<uint32_t>(header, 0);
+    put_le<uint64_t>(header, 0);
+    REQUIRE(header.size() == header_len);
+    REQUIRE(chrom_tree.size() == chrom_tree_header_len + 4 + chrom_sizes.size() * (key_size + 8));
+
+    std::ofstream bb_F(path, std::ios::binary);
+    bb_F << header << chrom_tree << data << index;
+}
+
+// whether track `track` of a bin-major array holds `want`, NaNs matching NaNs
+bool track_equals(const NDArray& arr, size_t track, const std::vector<double>& want) {
+    if (arr.rows() != want.size() || track >= arr.cols())
+        return false;
+    for (size_t b = 0; b < want.size(); b++) {
+        double got = arr.data<double>()[b*arr.cols() + track];
+        if (!(got == want[b] || (std::isnan(got) && std::isnan(want[b]))))
+            return false;
+    }
+    return true;
+}
+
 TEST_CASE("open_bigWigs") {
     std::vector<std::string> bw_paths = find_paths_filetype(DATA_DIR, ".bw");
 
-    std::cout << "bigWig files found: \n";
-    for (auto const& path : bw_paths)
-        std::cout <<"  "<< path << std::endl;
-
     std::vector<bigWigFile_t*> bw_files = open_bigWigs(bw_paths);
     CHECK(bw_files.size() == 2);
-    for (int i = 0; i < bw_files.size(); i++) {
+    for (size_t i = 0; i < bw_files.size(); i++) {
         CHECK(bw_files[i] != NULL && bw_files[i] != nullptr);
         bwClose(bw_files[i]);
     }
@@ -32,9 +168,7 @@ TEST_CASE("mono alternate 0/1 toy data") {
     std::filesystem::path chrom_sizes_path = DATA_DIR / "toy.chrom.sizes";
 
     // check chrom sizes parsing
-    //for (const auto& [chr, size] : parse_chrom_sizes(chrom_sizes_path.string())) {
-    //    std::cout << chr << ": " << size << std::endl;
-    //}
+    CHECK(parse_chrom_sizes(chrom_sizes_path.string()) == std::map<std::string, int>{{"chr1", 10}, {"chr2", 4}, {"chr3", 7}});
 
     BWBinner binner(bw_paths, chrom_sizes_path.string());
     REQUIRE(binner.binned_chroms().size() == 0);
@@ -50,24 +184,18 @@ TEST_CASE("mono alternate 0/1 toy data") {
         /* expected binned (out)
         chr1: 0.5 0.5 0.5 0.5 0.5
         chr2: 0.5 0.5
-        chr3: 0.5 0.5 0.5 0
+        chr3: 0.5 0.5 0.5
         */
 
         binner.load_bin_all_chroms(2);
-        std::map<std::string, torch::Tensor> binned_chroms = binner.binned_chroms();
+        std::map<std::string, NDArray> binned_chroms = binner.binned_chroms();
 
         // 3 chromosomes
         CHECK(binned_chroms.size() == 3);
 
-        // chr1
-        std::cout << "binned chr1:\n" << binned_chroms["chr1"] << std::endl;
-        // check(binned_chroms["chr1"].equal( torch::full({5}, 0.5, constants::tensor_opts) ));
-        // chr2
-        std::cout << "binned chr2:\n" << binned_chroms["chr2"] << std::endl;
-        // check(binned_chroms["chr2"].equal( torch::full({2}, 0.5, constants::tensor_opts) ));
-        // chr3
-        std::cout << "binned chr3:\n" << binned_chroms["chr3"] << std::endl;
-        // check(binned_chroms["chr3"].equal( torch::tensor({0.5, 0.5, 0.5, 0}, constants::tensor_opts) ));
+        CHECK(track_equals(binned_chroms["chr1"], 0, {0.5, 0.5, 0.5, 0.5, 0.5}));
+        CHECK(track_equals(binned_chroms["chr2"], 0, {0.5, 0.5}));
+        CHECK(track_equals(binned_chroms["chr3"], 0, {0.5, 0.5, 0.5}));
 
         binner.save_binneds(bwFstem+"_out");
     }
@@ -90,26 +218,20 @@ TEST_CASE("sequential with missings toy data") {
 
     SUBCASE("bin_size = 2") {
         /* expected binned (out)
-        chr1: - 0.5 2.5 - 0.5
+        chr1: 0 0.5 2.5 - 0.5
         chr2: 0.5 2.5
-        chr3: - - 1.5 -
+        chr3: 0 0 1.5
         */
 
         binner.load_bin_all_chroms(2);
-        std::map<std::string, torch::Tensor> binned_chroms = binner.binned_chroms();
+        std::map<std::string, NDArray> binned_chroms = binner.binned_chroms();
 
         // 3 chromosomes
         CHECK(binned_chroms.size() == 3);
 
-        // chr1
-        std::cout << "binned chr1:\n" << binned_chroms["chr1"] << std::endl;
-        // CHECK(binned_chroms["chr1"].equal( torch::full({5}, 0.5, constants::tensor_opts) ));
-        // chr2
-        std::cout << "binned chr2:\n" << binned_chroms["chr2"] << std::endl;
-        // CHECK(binned_chroms["chr2"].equal( torch::full({2}, 0.5, constants::tensor_opts) ));
-        // chr3
-        std::cout << "binned chr3:\n" << binned_chroms["chr3"] << std::endl;
-        // CHECK(binned_chroms["chr3"].equal( torch::tensor({0, 0.5, 0.5, 0.5}, constants::tensor_opts) ));
+        CHECK(track_equals(binned_chroms["chr1"], 0, {0, 0.5, 2.5, NAN, 0.5}));
+        CHECK(track_equals(binned_chroms["chr2"], 0, {0.5, 2.5}));
+        CHECK(track_equals(binned_chroms["chr3"], 0, {0, 0, 1.5}));
 
         binner.save_binneds(bwFstem+"_out");
     }
@@ -118,38 +240,103 @@ TEST_CASE("sequential with missings toy data") {
 TEST_CASE("combined toy datas") {
     std::vector<std::string> bw_paths = find_paths_filetype(DATA_DIR, ".bw");
     std::filesystem::path chrom_sizes_path = DATA_DIR / ("toy.chrom.sizes");
+    REQUIRE(bw_paths.size() == 2);
+    // a track per bigWig, in the order found
+    size_t seq_miss = bw_paths[0].find("test_sequential_missing") != std::string::npos ? 0 : 1;
 
     BWBinner binner(bw_paths, chrom_sizes_path.string());
     REQUIRE(binner.binned_chroms().size() == 0);
 
     binner.load_bin_all_chroms(2);
-    std::map<std::string, torch::Tensor> binned_chroms = binner.binned_chroms();
-    // chr1
-    std::cout << "binned chr1:\n" << binned_chroms["chr1"] << std::endl;
-    // chr2
-    std::cout << "binned chr2:\n" << binned_chroms["chr2"] << std::endl;
-    // chr3
-    std::cout << "binned chr3:\n" << binned_chroms["chr3"] << std::endl;
+    std::map<std::string, NDArray> binned_chroms = binner.binned_chroms();
+    CHECK(track_equals(binned_chroms["chr1"], seq_miss, {0, 0.5, 2.5, NAN, 0.5}));
+    CHECK(track_equals(binned_chroms["chr1"], 1 - seq_miss, {0.5, 0.5, 0.5, 0.5, 0.5}));
+    CHECK(track_equals(binned_chroms["chr2"], seq_miss, {0.5, 2.5}));
+    CHECK(track_equals(binned_chroms["chr2"], 1 - seq_miss, {0.5, 0.5}));
+    CHECK(track_equals(binned_chroms["chr3"], seq_miss, {0, 0, 1.5}));
+    CHECK(track_equals(binned_chroms["chr3"], 1 - seq_miss, {0.5, 0.5, 0.5}));
 
     binner.save_binneds("combined_out");
 }
 
+// a new fixture, not the original toy.coords.bigBed, which was never checked in: intervals drawn to match
+// the coords diagram of "specify coords on sequential missing toy data", written out as a bigBed by the tests
+const std::map<std::string, std::vector<std::pair<uint32_t, uint32_t>>> toy_coords {
+    {"chr1", {{0, 4}, {5, 8}, {8, 9}}},
+    {"chr2", {{0, 1}, {2, 3}}},
+    {"chr3", {{2, 6}}},
+};
+
 TEST_CASE("parse bigBed for specifying coordinates") {
-    std::cout << "\n========================\n";
+    std::map<std::string,int> seq_miss_chrom_sizes = parse_chrom_sizes((DATA_DIR / ("toy.chrom.sizes")).string());
+    write_toy_bigBed("toy.coords.bigBed", seq_miss_chrom_sizes, toy_coords);
 
-    std::filesystem::path coords_bed_path = DATA_DIR / ("toy.coords.bigBed");
-    std::cout << "coords_bed_path: " << coords_bed_path << std::endl;
+    chroms_coords_map_t spec_coords = parse_coords_bigBed("toy.coords.bigBed", seq_miss_chrom_sizes);
+    CHECK(spec_coords.size() == 3);
+    for (const auto& [chrom, intervals] : toy_coords) {
+        const IntervalIndex& index = spec_coords.at(chrom);
+        REQUIRE(index.size() == intervals.size());
+        for (size_t i = 0; i < intervals.size(); i++) {
+            CHECK(index.start(i) == intervals[i].first);
+            CHECK(index.end(i) == intervals[i].second);
+        }
+    }
 
-    std::map<std::string,int> seq_miss_chrom_sizes = parse_chrom_sizes((DATA_DIR / ("toy.chrom.sizes")).string());
-    std::map<std::string, bbOverlappingEntries_t*> spec_coords = parse_coords_bigBed(coords_bed_path.string(), seq_miss_chrom_sizes);
-    for (auto& [chr, interv] : spec_coords) {
-        std::cout << chr <<": "<< interv->l <<" intervals"<< std::endl;
-        std::cout << '\t';
-        for (int i = 0; i < interv->l; i++) {
-            std::cout << ' ' << interv->start[i] << '-' << interv->end[i];
-        };
-        std::cout << std::endl;
-        if (interv) bbDestroyOverlappingEntries(interv);
+    SUBCASE("many chromosomes, fetched by parallel workers") {
+        // chromosomes of the bigBed, those of chrom_sizes, and what each worker's slot should end up holding
+        std::map<std::string, int> file_sizes, chrom_sizes;
+        std::map<std::string, std::vector<std::pair<uint32_t, uint32_t>>> records;
+        std::mt19937 rng(49);
+        for (int c = 0; c < 64; c++) {
+            std::string chrom = "chr" + std::to_string(c);
+            file_sizes[chrom] = chrom_sizes[chrom] = 1000 + rng() % 100000;
+            // a few chromosomes with no entries at all
+            size_t n = c % 9 == 4 ? 0 : 1 + rng() % (c % 5 == 0 ? 2000 : 50);
+            for (size_t i = 0; i < n; i++) {
+                uint32_t start = rng() % (file_sizes[chrom] - 1);
+                records[chrom].emplace_back(start, start + 1 + rng() % std::min<uint32_t>(500, file_sizes[chrom] - start));
+            }
+        }
+        // in the bigBed but not asked for, and asked for but not in the bigBed
+        file_sizes["chrUn"] = 500;
+        records["chrUn"] = {{0, 100}};
+        chrom_sizes["chrAbsent"] = 500;
+        write_toy_bigBed("many.coords.bigBed", file_sizes, records);
+
+        chroms_coords_map_t parsed = parse_coords_bigBed("many.coords.bigBed", chrom_sizes);
+        CHECK(parsed.count("chrUn") == 0);
+        CHECK(parsed.count("chrAbsent") == 0);
+
+        // one chromosome after another, through a single handle
+        std::unique_ptr<bigWigFile_t, decltype(&bwClose)> bb(bbOpen(const_cast<char*>("many.coords.bigBed"), NULL), &bwClose);
+        REQUIRE(bb);
+        size_t n_with_entries = 0;
+        for (const auto& [chrom, size] : chrom_sizes) {
+            std::unique_ptr<bbOverlappingEntries_t, decltype(&bbDestroyOverlappingEntries)> entries(
+                bbGetOverlappingEntries(bb.get(), const_cast<char*>(chrom.c_str()), 0, size, 0), &bbDestroyOverlappingEntries);
+            std::vector<std::pair<uint64_t, uint64_t>> serial;
+            for (uint32_t i = 0; entries && i < entries->l; i++)
+                serial.emplace_back(entries->start[i], entries->end[i]);
+            std::sort(serial.begin(), serial.end());
+
+            std::vector<std::pair<uint64_t, uint64_t>> expected(records[chrom].begin(), records[chrom].end());
+            std::sort(expected.begin(), expected.end());
+            CHECK(serial == expected);
+
+            auto found = parsed.find(chrom);
+            if (expected.empty()) {
+                CHECK(found == parsed.end());
+                continue;
+            }
+            n_with_entries++;
+            REQUIRE(found != parsed.end());
+            std::vector<std::pair<uint64_t, uint64_t>> got;
+            for (size_t i = 0; i < found->second.size(); i++)
+                got.emplace_back(found->second.start(i), found->second.end(i));
+            CHECK(got == serial);
+        }
+        CHECK(n_with_entries < 64);
+        CHECK(parsed.size() == n_with_entries);
     }
     bwCleanup();
 }
@@ -179,26 +366,925 @@ TEST_CASE("specify coords on sequential missing toy data") {
     */
 
     std::vector<std::string> bw_paths = find_paths_filetype(DATA_DIR, ".bw");
-    std::map<std::string,int> seq_miss_chrom_sizes = parse_chrom_sizes((DATA_DIR / ("toy.chrom.sizes")).string());
+    REQUIRE(bw_paths.size() == 2);
+    size_t seq_miss = bw_paths[0].find("test_sequential_missing") != std::string::npos ? 0 : 1;
     std::filesystem::path chrom_sizes_path = DATA_DIR / ("toy.chrom.sizes");
-    std::filesystem::path coords_bed_path = DATA_DIR / ("toy.coords.bigBed");
+    write_toy_bigBed("toy.coords.bigBed", parse_chrom_sizes(chrom_sizes_path.string()), toy_coords);
 
-    BWBinner binner(bw_paths, chrom_sizes_path.string(), coords_bed_path.string());
+    BWBinner binner(bw_paths, chrom_sizes_path.string(), "toy.coords.bigBed");
     REQUIRE(binner.binned_chroms().size() == 0);
 
     binner.load_bin_all_chroms(2);
-    std::map<std::string, torch::Tensor> binned_chroms = binner.binned_chroms();
+    std::map<std::string, NDArray> binned_chroms = binner.binned_chroms();
 
-    // chr1
-    std::cout << "binned chr1:\n" << binned_chroms["chr1"] << std::endl;
-    // CHECK(binned_chroms["chr1"].equal( torch::full({5}, 0.5, constants::tensor_opts) ));
-    // chr2
-    std::cout << "binned chr2:\n" << binned_chroms["chr2"] << std::endl;
-    // CHECK(binned_chroms["chr2"].equal( torch::full({2}, 0.5, constants::tensor_opts) ));
-    // chr3
-    std::cout << "binned chr3:\n" << binned_chroms["chr3"] << std::endl;
+    // only the bins an interval fully covers, one after another
+    CHECK(track_equals(binned_chroms["chr1"], seq_miss, {0, 0.5, NAN}));
+    CHECK(track_equals(binned_chroms["chr1"], 1 - seq_miss, {0.5, 0.5, 0.5}));
+    CHECK(binned_chroms["chr2"].rows() == 0);
+    CHECK(track_equals(binned_chroms["chr3"], seq_miss, {0, 1.5}));
+    CHECK(track_equals(binned_chroms["chr3"], 1 - seq_miss, {0.5, 0.5}));
 
     binner.save_binneds("subset_seq_miss_out");
 
     bwCleanup();
-}
\ No newline at end of file
+}
+TEST_CASE("write_tile into both layouts") {
+    // 2 tracks x 3 bins tile, written at track 1, bin 2 of a 5 bins x 3 tracks chromosome
+    std::vector<double> tile {0, 1, 2,
+                              10, 11, 12};
+
+    std::vector<double> bin_major(5 * 3, -1);
+    write_tile(tile.data(), 2, 3, bin_major.data(), 5, 3, 1, 2, TensorLayout::bin_major);
+    for (size_t b = 0; b < 3; b++) {
+        CHECK(bin_major[(2 + b)*3 + 0] == -1);
+        CHECK(bin_major[(2 + b)*3 + 1] == tile[b]);
+        CHECK(bin_major[(2 + b)*3 + 2] == tile[3 + b]);
+    }
+    CHECK(bin_major[0] == -1);
+
+    std::vector<double> track_major(3 * 5, -1);
+    write_tile(tile.data(), 2, 3, track_major.data(), 5, 3, 1, 2, TensorLayout::track_major);
+    for (size_t b = 0; b < 3; b++) {
+        CHECK(track_major[0*5 + 2 + b] == -1);
+        CHECK(track_major[1*5 + 2 + b] == tile[b]);
+        CHECK(track_major[2*5 + 2 + b] == tile[3 + b]);
+    }
+}
+
+TEST_CASE("npy header and writer") {
+    std::string header = npy_header(NpyDtype::float64, {3, 2});
+    CHECK(header.size() % 64 == 0);
+    CHECK(header.substr(0, 6) == "\x93NUMPY");
+    CHECK(header.find("'descr': '<f8', 'fortran_order': False, 'shape': (3, 2), }") != std::string::npos);
+    CHECK(header.back() == '\n');
+    CHECK(npy_header(NpyDtype::float32, {5}).find("'shape': (5,)") != std::string::npos);
+
+    std::vector<double> vals {0, 0.5, 1, std::nan(""), 2, 2.5};
+    std::filesystem::path npy_path = "npy_writer_out.npy";
+    write_npy(npy_path, vals.data(), {3, 2}, NpyDtype::float32);
+    CHECK(std::filesystem::file_size(npy_path) == npy_header(NpyDtype::float32, {3, 2}).size() + vals.size()*sizeof(float));
+
+    std::ifstream npy_F(npy_path, std::ios::binary);
+    npy_F.seekg(npy_header(NpyDtype::float32, {3, 2}).size());
+    std::vector<float> read(vals.size());
+    npy_F.read(reinterpret_cast<char*>(read.data()), read.size()*sizeof(float));
+    CHECK(read[2] == 1.0f);
+    CHECK(std::isnan(read[3]));
+    CHECK(read[5] == 2.5f);
+}
+
+TEST_CASE("NDArray buffers") {
+    NDArray owned(3, 2, NpyDtype::float32);
+    CHECK(owned.shape() == std::vector<size_t>{3, 2});
+    CHECK(owned.nbytes() == 6*sizeof(float));
+    CHECK(reinterpret_cast<uintptr_t>(owned.raw_data()) % 64 == 0);
+
+    // copies share the buffer
+    NDArray copy = owned;
+    copy.data<float>()[5] = 1.5f;
+    CHECK(owned.data<float>()[5] == 1.5f);
+
+    std::vector<double> vals {0, 1, 2, 3};
+    NDArray view = NDArray::view(vals.data(), 2, 2);
+    CHECK(view.data<double>() == vals.data());
+    CHECK(view.dtype() == NpyDtype::float64);
+}
+
+TEST_CASE("bin into memory-mapped npy files") {
+    std::vector<std::string> bw_paths ({ (DATA_DIR / "test_sequential_missing.bw").string() });
+    std::filesystem::path chrom_sizes_path = DATA_DIR / "toy.chrom.sizes";
+
+    BWBinner binner(bw_paths, chrom_sizes_path.string());
+    binner.map_binneds("mapped_out", NpyDtype::float32);
+    binner.load_bin_all_chroms(2);
+    binner.save_binneds("mapped_out", {.format = OutputFormat::npy});
+
+    // chr2: 0 1 | 2 3
+    std::string header = npy_header(NpyDtype::float32, {2, 1});
+    std::filesystem::path chr2_path = std::filesystem::path("mapped_out") / "chr2.npy";
+    CHECK(std::filesystem::file_size(chr2_path) == header.size() + 2*sizeof(float));
+    std::ifstream npy_F(chr2_path, std::ios::binary);
+    std::string read_header(header.size(), '\0');
+    npy_F.read(read_header.data(), read_header.size());
+    CHECK(read_header == header);
+    std::vector<float> vals(2);
+    npy_F.read(reinterpret_cast<char*>(vals.data()), vals.size()*sizeof(float));
+    CHECK(vals[0] == 0.5f);
+    CHECK(vals[1] == 2.5f);
+    CHECK(!std::filesystem::exists("mapped_out/chr2.npy.tmp"));
+
+    // a created file is only at its path once committed, and removed if never committed
+    {
+        MappedFile uncommitted = MappedFile::create("mapped_out/uncommitted.npy", 16);
+        CHECK(std::filesystem::exists("mapped_out/uncommitted.npy.tmp"));
+        CHECK(!std::filesystem::exists("mapped_out/uncommitted.npy"));
+    }
+    CHECK(!std::filesystem::exists("mapped_out/uncommitted.npy.tmp"));
+    MappedFile committed = MappedFile::create("mapped_out/committed.npy", 16);
+    committed.data()[0] = 'x';
+    committed.commit();
+    CHECK(!std::filesystem::exists("mapped_out/committed.npy.tmp"));
+    CHECK(std::filesystem::file_size("mapped_out/committed.npy") == 16);
+}
+
+TEST_CASE("zarr array chunks") {
+    // 3 bins x 2 tracks, chunked 2 x 1
+    std::vector<double> vals {0, 10,
+                              1, 11,
+                              2, 12};
+    std::filesystem::path array_dir = "zarr_out/chrT";
+    std::vector<FileDigest> digests = write_zarr_array(array_dir, vals.data(), 3, 2, {.chunk_rows = 2, .chunk_cols = 1});
+
+    CHECK(std::filesystem::exists(array_dir / ".zarray"));
+    // every chunk, then the .zarray, named from the group
+    REQUIRE(digests.size() == 4 + 1);
+    CHECK(digests[3].file == "chrT/1.1");
+    CHECK(digests[3].bytes == 2*sizeof(double));
+    CHECK(digests.back().file == "chrT/.zarray");
+    CHECK(digests.back().crc32 == file_digest(array_dir / ".zarray").crc32);
+    for (auto chunk : {"0.0", "0.1", "1.0", "1.1"}) {
+        CHECK(std::filesystem::file_size(array_dir / chunk) == 2*sizeof(double));
+    }
+    // edge chunk of the second track: bin 2, then NaN padding
+    std::ifstream chunk_F(array_dir / "1.1", std::ios::binary);
+    double chunk[2];
+    chunk_F.read(reinterpret_cast<char*>(chunk), sizeof(chunk));
+    CHECK(chunk[0] == 12);
+    CHECK(std::isnan(chunk[1]));
+}
+
+TEST_CASE("safetensors header") {
+    std::vector<double> vals(6);
+    std::vector<SafetensorsEntry> tensors {{"chr1", vals.data(), {2, 2}}, {"chr2", vals.data(), {1, 2}}};
+    std::string header = safetensors_header(tensors, NpyDtype::float32, {{"layout", "bins"}});
+    CHECK(header.size() % 64 == 0);
+    uint64_t json_len = 0;
+    for (int i = 7; i >= 0; i--) {
+        json_len = (json_len << 8) | static_cast<unsigned char>(header[i]);
+    }
+    CHECK(json_len == header.size() - 8);
+    CHECK(header.find("\"__metadata__\":{\"layout\":\"bins\"}") != std::string::npos);
+    CHECK(header.find("\"chr1\":{\"dtype\":\"F32\",\"shape\":[2,2],\"data_offsets\":[0,16]}") != std::string::npos);
+    CHECK(header.find("\"chr2\":{\"dtype\":\"F32\",\"shape\":[1,2],\"data_offsets\":[16,24]}") != std::string::npos);
+}
+
+TEST_CASE("bsz blocks round trip") {
+    // 5 bins x 2 tracks in blocks of 4 elements, the last one short
+    std::vector<double> vals {0, 10, 1, 11, 2, 12, std::nan(""), 13, 4, 14};
+    CHECK(parse_bsz_codec("zlib") == BszCodec::zlib);
+    CHECK_THROWS_AS(parse_bsz_codec("lz4"), std::invalid_argument);
+
+    for (BszCodec codec : {BszCodec::zstd, BszCodec::zlib}) {
+        CAPTURE(static_cast<int>(codec));
+        BszStats stats = write_bsz("bsz_out.bsz", vals.data(), 5, 2, {.block_elems = 4, .dtype = NpyDtype::float32, .codec = codec});
+        CHECK(stats.raw_bytes == vals.size()*sizeof(float));
+
+        BszIndex index = read_bsz_index("bsz_out.bsz");
+        CHECK(index.codec == codec);
+        CHECK(index.shape == std::vector<size_t>{5, 2});
+        CHECK(index.num_blocks() == 3);
+        CHECK(index.data_start + index.offsets.back() == std::filesystem::file_size("bsz_out.bsz"));
+
+        // random access to the middle block
+        std::vector<char> raw = read_bsz_block("bsz_out.bsz", index, 1);
+        REQUIRE(raw.size() == 4*sizeof(float));
+        const float* block = reinterpret_cast<const float*>(raw.data());
+        CHECK(block[0] == 2.0f);
+        CHECK(std::isnan(block[2]));
+        CHECK(block[3] == 13.0f);
+        CHECK(read_bsz_block("bsz_out.bsz", index, 2).size() == 2*sizeof(float));
+    }
+}
+
+TEST_CASE("quantized codes with NaN sentinel") {
+    // 3 bins x 2 tracks, bin-major
+    std::vector<double> vals {0, -1,
+                              5, std::nan(""),
+                              10, 1};
+    QuantParams params = fit_quant(QuantDtype::uint8, QuantTransform::linear, {0, -1}, {10, 1});
+    CHECK(params.offset[0] == 0);
+    CHECK(params.scale[0] == doctest::Approx(10.0 / 254));
+
+    std::ostringstream out;
+    write_quantized_data(out, vals.data(), 3, 2, 1, params);
+    std::string codes = out.str();
+    REQUIRE(codes.size() == 6);
+    CHECK(uint8_t(codes[0]) == 0);
+    CHECK(uint8_t(codes[2]) == 127);
+    CHECK(uint8_t(codes[4]) == 254);
+    CHECK(uint8_t(codes[1]) == 0);
+    CHECK(uint8_t(codes[3]) == quant_sentinel(QuantDtype::uint8));
+    CHECK(uint8_t(codes[5]) == 254);
+
+    // int16 reserves its minimum, and log1p is symmetric about 0
+    QuantParams log_params = fit_quant(QuantDtype::int16, QuantTransform::log1p, {-100}, {100});
+    CHECK(log_params.offset[0] == doctest::Approx(0));
+    CHECK(quant_sentinel(QuantDtype::int16) == INT16_MIN);
+}
+
+TEST_CASE("sparse columns of mostly-empty tracks") {
+    std::vector<std::string> bw_paths = find_paths_filetype(DATA_DIR, ".bw");
+    std::filesystem::path chrom_sizes_path = DATA_DIR / "toy.chrom.sizes";
+
+    BWBinner binner(bw_paths, chrom_sizes_path.string());
+    binner.load_bin_all_chroms(2);
+    binner.save_binneds("sparse_out", {.format = OutputFormat::npy, .sparse_density = 0.5});
+
+    // chr3 of test_sequential_missing: 0 0 1.5, only 1 of 3 bins not 0
+    SparseColumns cols = read_sparse_columns("sparse_out/chr3.sparse");
+    REQUIRE(cols.tracks.size() == 1);
+    CHECK(cols.num_bins == 3);
+    CHECK(cols.fill[0] == 0);
+    CHECK(cols.indices == std::vector<int64_t>{2});
+    CHECK(cols.data == std::vector<double>{1.5});
+    std::vector<double> window(2);
+    cols.densify(0, 1, 3, window.data());
+    CHECK(window[0] == 0);
+    CHECK(window[1] == 1.5);
+
+    // the other, constant 0.5, track stays dense
+    CHECK(std::filesystem::file_size("sparse_out/chr3.npy") == npy_header(NpyDtype::float64, {3, 1}).size() + 3*sizeof(double));
+    CHECK(!std::filesystem::exists("sparse_out/chr2.sparse"));
+}
+
+TEST_CASE("sharded training windows") {
+    std::vector<size_t> shard_sizes;
+    std::vector<ShardSlot> slots = assign_shards(7, 3, 0, shard_sizes);
+    CHECK(shard_sizes == std::vector<size_t>{3, 2, 2});
+    CHECK(slots.size() == 7);
+
+    std::vector<std::string> bw_paths ({ (DATA_DIR / "test_sequential_missing.bw").string() });
+    std::filesystem::path chrom_sizes_path = DATA_DIR / "toy.chrom.sizes";
+
+    BWBinner binner(bw_paths, chrom_sizes_path.string(), TensorLayout::track_major);
+    // chr1: 5 bins, 4 windows; chr2: 2 bins, 1 window; chr3: 3 bins, 2 windows
+    binner.shard_windows("windows_out", {.length = 2, .stride = 1, .holdout_chroms = {"chr2"}, .windows_per_shard = 3});
+    binner.load_bin_all_chroms(2);
+
+    std::string header = npy_header(NpyDtype::float64, {3, 2, 1});
+    CHECK(std::filesystem::file_size("windows_out/train-00000.npy") == header.size() + 3*2*sizeof(double));
+    CHECK(std::filesystem::exists("windows_out/train-00001.npy"));
+    CHECK(!std::filesystem::exists("windows_out/train-00002.npy"));
+
+    // chr2: 0 1 | 2 3
+    std::ifstream holdout_F("windows_out/holdout-00000.npy", std::ios::binary);
+    holdout_F.seekg(npy_header(NpyDtype::float64, {1, 2, 1}).size());
+    double window[2];
+    holdout_F.read(reinterpret_cast<char*>(window), sizeof(window));
+    CHECK(window[0] == 0.5);
+    CHECK(window[1] == 2.5);
+
+    std::ifstream index_F("windows_out/windows_index.tsv");
+    std::string line;
+    size_t n_lines = 0;
+    while (std::getline(index_F, line))
+        n_lines++;
+    CHECK(n_lines == 1 + 7);
+
+    // the shards and index, each listed once complete
+    std::ifstream manifest_F("windows_out/manifest.tsv");
+    std::vector<std::string> listed;
+    std::getline(manifest_F, line);
+    while (std::getline(manifest_F, line))
+        listed.push_back(line.substr(0, line.find('\t')));
+    CHECK(listed == std::vector<std::string>{"holdout-00000.npy", "train-00000.npy", "train-00001.npy", "windows_index.tsv"});
+    CHECK(!std::filesystem::exists("windows_out/train-00000.npy.tmp"));
+}
+
+TEST_CASE("arrow ipc file framing") {
+    std::vector<int64_t> starts {0, 2, 4}, ends {2, 4, 6};
+    std::vector<double> vals {0, 10, 1, 11, 2, 12};
+    ArrowIpcWriter writer("binned.arrow", {"a", "b"}, NpyDtype::float64);
+    writer.write_batch("chr1", starts.data(), ends.data(), 3, vals.data(), 2, 1);
+    writer.close();
+
+    std::ifstream arrow_F("binned.arrow", std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(arrow_F)), std::istreambuf_iterator<char>());
+    CHECK(bytes.substr(0, 6) == "ARROW1");
+    CHECK(bytes.substr(bytes.size() - 6) == "ARROW1");
+    // the footer sits just before its length and the trailing magic
+    int32_t footer_len;
+    std::memcpy(&footer_len, bytes.data() + bytes.size() - 10, 4);
+    CHECK(footer_len > 0);
+    CHECK(size_t(footer_len) < bytes.size());
+    // the first column of track b, 64-byte aligned in the file
+    CHECK(bytes.find(std::string(reinterpret_cast<const char*>(&vals[1]), sizeof(double))) % 64 == 0);
+}
+
+TEST_CASE("binned bigWigs round trip") {
+    std::vector<std::string> bw_paths = find_paths_filetype(DATA_DIR, ".bw");
+    std::filesystem::path chrom_sizes_path = DATA_DIR / "toy.chrom.sizes";
+
+    BWBinner binner(bw_paths, chrom_sizes_path.string(), TensorLayout::bin_major);
+    binner.load_bin_all_chroms(2);
+    binner.save_binneds("bigwig_out", {.format = OutputFormat::bigwig});
+
+    bigWigFile_t* bw = bwOpen("bigwig_out/test_sequential_missing.binned.bw", NULL, "r");
+    REQUIRE(bw != NULL);
+    // chr1: 0 0.5 2.5 NaN 0.5, the NaN bin left out
+    bwOverlappingIntervals_t* intervals = bwGetValues(bw, "chr1", 0, 10, 1);
+    REQUIRE(intervals != NULL);
+    CHECK(intervals->l == 10);
+    CHECK(intervals->value[2] == doctest::Approx(0.5));
+    CHECK(intervals->value[5] == doctest::Approx(2.5));
+    CHECK(std::isnan(intervals->value[6]));
+    CHECK(std::isnan(intervals->value[7]));
+    CHECK(intervals->value[9] == doctest::Approx(0.5));
+    bwDestroyOverlappingIntervals(intervals);
+    bwClose(bw);
+
+    // overlapping intervals, as in narrowPeaks, share bins, each written once and in order
+    {
+        std::ofstream bed_F("overlapping.bed");
+        bed_F << "chr1\t0\t6\nchr1\t2\t10\nchr1\t3\t5\nchr1\t4\t8\n";
+    }
+    BWBinner overlapping({ (DATA_DIR / "test_sequential_missing.bw").string() }, chrom_sizes_path.string(), "overlapping.bed");
+    CHECK_THROWS_AS(overlapping.save_binneds("bigwig_overlapping", {.format = OutputFormat::bigwig}), std::invalid_argument);
+    overlapping.load_bin_all_chroms(2);
+    overlapping.save_binneds("bigwig_overlapping", {.format = OutputFormat::bigwig});
+    bw = bwOpen("bigwig_overlapping/test_sequential_missing.binned.bw", NULL, "r");
+    REQUIRE(bw != NULL);
+    bwOverlappingIntervals_t* runs = bwGetOverlappingIntervals(bw, "chr1", 0, 10);
+    REQUIRE(runs != NULL);
+    // [0, 6) then what [2, 10) adds, the NaN bin [6, 8) left out
+    std::vector<uint32_t> starts(runs->start, runs->start + runs->l), ends(runs->end, runs->end + runs->l);
+    CHECK(starts == std::vector<uint32_t>{0, 2, 4, 8});
+    CHECK(ends == std::vector<uint32_t>{2, 4, 6, 10});
+    CHECK(std::vector<float>(runs->value, runs->value + runs->l) == std::vector<float>{0, 0.5, 2.5, 0.5});
+    bwDestroyOverlappingIntervals(runs);
+    bwClose(bw);
+}
+
+TEST_CASE("atomic files and manifest") {
+    std::filesystem::remove_all("atomic_out");
+    std::filesystem::create_directories("atomic_out");
+    {
+        AtomicOfstream out_F("atomic_out/check.txt");
+        out_F << "123456789";
+        CHECK(std::filesystem::exists("atomic_out/check.txt.tmp"));
+        CHECK(!std::filesystem::exists("atomic_out/check.txt"));
+        FileDigest digest = out_F.commit();
+        // the standard CRC-32 check value
+        CHECK(digest.crc32 == 0xCBF43926);
+        CHECK(digest.bytes == 9);
+    }
+    {
+        // patched after the fact, the checksum is read back
+        AtomicOfstream out_F("atomic_out/patched.txt");
+        out_F << "X23456789";
+        out_F.seekp(0);
+        out_F << '1';
+        CHECK(out_F.commit().crc32 == 0xCBF43926);
+    }
+    {
+        AtomicOfstream out_F("atomic_out/abandoned.txt");
+        out_F << "partial";
+    }
+    CHECK(!std::filesystem::exists("atomic_out/abandoned.txt.tmp"));
+    CHECK(!std::filesystem::exists("atomic_out/abandoned.txt"));
+
+    std::vector<std::string> bw_paths = find_paths_filetype(DATA_DIR, ".bw");
+    BWBinner binner(bw_paths, (DATA_DIR / "toy.chrom.sizes").string());
+    binner.load_bin_all_chroms(2);
+    binner.save_binneds("atomic_out", {.format = OutputFormat::npy});
+    std::ifstream manifest_F("atomic_out/manifest.tsv");
+    std::string line;
+    std::getline(manifest_F, line);
+    CHECK(line == "file\tbytes\tcrc32");
+    std::getline(manifest_F, line);
+    FileDigest chr1 = file_digest("atomic_out/chr1.npy");
+    char crc_hex[9];
+    std::snprintf(crc_hex, sizeof(crc_hex), "%08x", chr1.crc32);
+    CHECK(line == "chr1.npy\t" + std::to_string(chr1.bytes) + "\t" + crc_hex);
+    size_t n_lines = 1;
+    while (std::getline(manifest_F, line))
+        n_lines++;
+    // chr1-3 and tensor_bigWigs_inds.csv
+    CHECK(n_lines == 4);
+}
+
+TEST_CASE("binning within a memory budget") {
+    std::vector<std::string> bw_paths = find_paths_filetype(DATA_DIR, ".bw");
+    std::filesystem::path chrom_sizes_path = DATA_DIR / "toy.chrom.sizes";
+    CHECK(parse_byte_size("512") == 512);
+    CHECK(parse_byte_size("3K") == 3 << 10);
+    CHECK(parse_byte_size("64GiB") == size_t(64) << 30);
+    CHECK_THROWS_AS(parse_byte_size("12Q"), std::invalid_argument);
+
+    for (TensorLayout layout : {TensorLayout::bin_major, TensorLayout::track_major}) {
+        BWBinner in_memory(bw_paths, chrom_sizes_path.string(), layout);
+        in_memory.load_bin_all_chroms(2);
+        in_memory.save_binneds("budget_ref", {.format = OutputFormat::npy});
+
+        BWBinner budgeted(bw_paths, chrom_sizes_path.string(), layout);
+        const size_t min_budget = budgeted.min_memory_budget();
+        CHECK_THROWS_AS(budgeted.limit_memory("budget_out", min_budget - 1), std::invalid_argument);
+        // room for 2 more bins of both tracks and of the one worker's 2-track tile: chr1's 5 bins in 2 ranges
+        const size_t budget = min_budget + 2 * (2*sizeof(double) + 2*sizeof(double));
+        budgeted.limit_memory("budget_out", budget);
+        std::array<size_t, bwmem::num_pools> start;
+        for (size_t p = 0; p < bwmem::num_pools; p++)
+            start[p] = bwmem::stats(bwmem::Pool(p)).current;
+        {
+            bwmem::Stage stage("budgeted binning");
+            CHECK(budgeted.load_bin_all_chroms(2).empty());
+        }
+        // what the pools held on top of what they did before, even were they all to peak together
+        size_t held = 0;
+        for (size_t p = 0; p < bwmem::num_pools; p++)
+            held += bwmem::stages().back().pool_peaks[p] - start[p];
+        CHECK(held > AtomicOfstream::buffer_bytes);
+        CHECK(held <= budget);
+        budgeted.save_binneds("budget_out", {.format = OutputFormat::npy});
+
+        for (const std::string chrom : {"chr1", "chr2", "chr3"}) {
+            NpyArray expected = read_npy("budget_ref/" + chrom + ".npy");
+            NpyArray streamed = read_npy("budget_out/" + chrom + ".npy");
+            CHECK(streamed.shape == expected.shape);
+            // NaNs compare equal bytewise
+            CHECK(streamed.bytes == expected.bytes);
+        }
+    }
+}
+
+TEST_CASE("genome-wide npy with interval index") {
+    std::vector<std::string> bw_paths = find_paths_filetype(DATA_DIR, ".bw");
+    std::filesystem::path chrom_sizes_path = DATA_DIR / "toy.chrom.sizes";
+
+    BWBinner binner(bw_paths, chrom_sizes_path.string(), TensorLayout::track_major);
+    binner.load_bin_all_chroms(2);
+    binner.save_binneds("genome_out", {.format = OutputFormat::npy, .genome_wide = true});
+
+    // chr1: 5 bins, chr2: 2 bins, chr3: 3 bins, always [total_bins, tracks]
+    std::string header = npy_header(NpyDtype::float64, {10, 2});
+    CHECK(std::filesystem::file_size("genome_out/genome.npy") == header.size() + 10*2*sizeof(double));
+
+    std::ifstream index_F("genome_out/genome_index.tsv");
+    std::string line;
+    std::getline(index_F, line);
+    CHECK(line == "chrom\trow_offset\tnum_bins\tstart\tend");
+    std::getline(index_F, line);
+    CHECK(line == "chr1\t0\t5\t0\t10");
+    std::getline(index_F, line);
+    CHECK(line == "chr2\t5\t2\t0\t4");
+    std::getline(index_F, line);
+    CHECK(line == "chr3\t7\t3\t0\t6");
+}
+
+TEST_CASE("bin means from data blocks into reused buffers") {
+    bigWigFile_t* bw = bwOpen((DATA_DIR / "test_sequential_missing.bw").string().c_str(), NULL, "r");
+    REQUIRE(bw != NULL);
+    BinScratch scratch;
+    std::vector<double> means(5);
+    // chr1: 0 0.5 2.5 NaN 0.5
+    read_bin_means(bw, "chr1", 0, 2, 5, means.data(), scratch);
+    CHECK(means[0] == doctest::Approx(0.0));
+    CHECK(means[1] == doctest::Approx(0.5));
+    CHECK(means[2] == doctest::Approx(2.5));
+    CHECK(std::isnan(means[3]));
+    CHECK(means[4] == doctest::Approx(0.5));
+    // bins of 3 over bases 0 1 2 3 N N from base 2, averaged over only the bases with values
+    read_bin_means(bw, "chr1", 2, 3, 2, means.data(), scratch);
+    CHECK(means[0] == doctest::Approx(1.0));
+    CHECK(means[1] == doctest::Approx(3.0));
+
+    // once the buffers are sized, each fetch only allocates libBigWig's block list
+    size_t allocations = scratch.allocations;
+    for (int i = 0; i < 10; i++)
+        read_bin_means(bw, "chr1", 0, 2, 5, means.data(), scratch);
+    CHECK(scratch.allocations == allocations + 10);
+    CHECK(scratch.fetches == 12);
+    bwClose(bw);
+}
+
+TEST_CASE("streaming chunks of bins") {
+    std::vector<std::string> bw_paths = find_paths_filetype(DATA_DIR, ".bw");
+    std::filesystem::path chrom_sizes_path = DATA_DIR / "toy.chrom.sizes";
+
+    for (TensorLayout layout : {TensorLayout::bin_major, TensorLayout::track_major}) {
+        BWBinner in_memory(bw_paths, chrom_sizes_path.string(), layout);
+        std::map<std::string, NDArray> expected = in_memory.load_bin_all_chroms(2);
+
+        BWBinner streamed(bw_paths, chrom_sizes_path.string(), layout);
+        CHECK_THROWS_AS(streamed.stream(2, 0, [](const std::string&, unsigned, const NDArray&) {}), std::invalid_argument);
+        std::vector<std::string> chroms;
+        const void* buffer = nullptr;
+        // chr1's 5 bins come as 2, 2 and 1
+        streamed.stream(2, 2, [&](const std::string& chrom, unsigned first_bin, const NDArray& chunk) {
+            if (chroms.empty() || chroms.back() != chrom)
+                chroms.push_back(chrom);
+            if (buffer)
+                CHECK(chunk.raw_data() == buffer);
+            buffer = chunk.raw_data();
+
+            const NDArray& chrom_arr = expected.at(chrom);
+            bool track_major = layout == TensorLayout::track_major;
+            size_t n_bins = track_major ? chunk.cols() : chunk.rows();
+            CHECK(n_bins == std::min<size_t>(2, (track_major ? chrom_arr.cols() : chrom_arr.rows()) - first_bin));
+            for (size_t b = 0; b < n_bins; b++) {
+                for (size_t t = 0; t < 2; t++) {
+                    double got = track_major ? chunk.data<double>()[t*n_bins + b] : chunk.data<double>()[b*2 + t];
+                    double want = track_major ? chrom_arr.data<double>()[t*chrom_arr.cols() + first_bin + b]
+                                              : chrom_arr.data<double>()[(first_bin + b)*2 + t];
+                    CHECK((got == want || (std::isnan(got) && std::isnan(want))));
+                }
+            }
+        });
+        CHECK(chroms == std::vector<std::string>{"chr1", "chr2", "chr3"});
+        CHECK(streamed.binned_chroms().empty());
+    }
+}
+
+// a stderr that holds the log drainer in its first write until released, so that a ring can fill up meanwhile
+struct HeldStderr : std::stringbuf {
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool entered = false;
+    bool released = false;
+
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            entered = true;
+            cv.notify_all();
+            cv.wait(lock, [this] { return released; });
+        }
+        return std::stringbuf::xsputn(s, n);
+    }
+
+    void wait_entered() {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this] { return entered; });
+    }
+
+    void release() {
+        std::lock_guard<std::mutex> lock(mutex);
+        released = true;
+        cv.notify_all();
+    }
+};
+
+TEST_CASE("logging levels, flushing and dropping") {
+    const bwlog::Level prev_level = bwlog::level();
+    // nothing of other tests left to print into the captured stderr
+    bwlog::flush();
+    std::streambuf* prev_stderr = std::cerr.rdbuf();
+
+    CHECK(bwlog::parse_level("debug") == bwlog::Level::debug);
+    CHECK_THROWS_AS(bwlog::parse_level("verbose"), std::invalid_argument);
+    bwlog::set_level(bwlog::Level::off);
+    CHECK(!bwlog::enabled(bwlog::Level::error));
+    bwlog::set_level(bwlog::Level::info);
+    CHECK(bwlog::level() == bwlog::Level::info);
+    CHECK(!bwlog::enabled(bwlog::Level::debug));
+    CHECK(bwlog::enabled(bwlog::Level::info));
+    CHECK(bwlog::enabled(bwlog::Level::error));
+
+    SUBCASE("flush prints what was queued, long messages whole or marked as cut") {
+        std::stringbuf captured;
+        std::cerr.rdbuf(&captured);
+        BW_LOG(bwlog::Level::debug, "below the level");
+        BW_LOG(bwlog::Level::info, "queued " << 1);
+        // several slots of the ring, and past the longest printed whole
+        bwlog::write(bwlog::Level::info, std::string(1000, 'x') + "end");
+        bwlog::write(bwlog::Level::warn, std::string(bwlog::max_message_bytes + 100, 'y'));
+        bwlog::flush();
+        std::cerr.rdbuf(prev_stderr);
+
+        std::string out = captured.str();
+        CHECK(out.find("below the level") == std::string::npos);
+        CHECK(out.find("[info] queued 1\n") != std::string::npos);
+        CHECK(out.find("[info] " + std::string(1000, 'x') + "end\n") != std::string::npos);
+        size_t cut_at = out.find("[warn] y");
+        REQUIRE(cut_at != std::string::npos);
+        std::string cut = out.substr(cut_at, out.find('\n', cut_at) - cut_at);
+        CHECK(cut.size() == std::string("[warn] ").size() + bwlog::max_message_bytes);
+        // the 100 bytes over, and those of the 15-byte marker
+        CHECK(cut.ends_with("y...(+115 bytes)"));
+    }
+
+    SUBCASE("messages below warn are dropped and counted when the ring is full") {
+        HeldStderr held;
+        std::cerr.rdbuf(&held);
+        // a warning wakes the drainer, which then waits in printing it
+        bwlog::write(bwlog::Level::warn, "holding the drainer");
+        held.wait_entered();
+        const size_t n_written = 5000;
+        for (size_t i = 0; i < n_written; i++)
+            bwlog::write(bwlog::Level::info, "fill " + std::to_string(i));
+        held.release();
+        bwlog::flush();
+        std::cerr.rdbuf(prev_stderr);
+
+        // the first messages kept, in order, up to the ring's size; the rest only counted
+        std::string out = held.str();
+        size_t n_kept = 0;
+        while (out.find("[info] fill " + std::to_string(n_kept) + "\n") != std::string::npos)
+            n_kept++;
+        CHECK(n_kept > 0);
+        CHECK(n_kept < n_written);
+        CHECK(out.find("[info] fill " + std::to_string(n_kept + 1) + "\n") == std::string::npos);
+        CHECK(out.find("[warn] " + std::to_string(n_written - n_kept) + " log messages dropped") != std::string::npos);
+    }
+
+    bwlog::set_level(prev_level);
+}
+
+TEST_CASE("memory accounting by pool and stage") {
+    bwmem::PoolStats before = bwmem::stats(bwmem::Pool::decode);
+    {
+        bwmem::Stage stage("accounting test");
+        bwmem::vector<char, bwmem::Pool::decode> buf(1000);
+        CHECK(bwmem::stats(bwmem::Pool::decode).current == before.current + 1000);
+        {
+            bwmem::Charge charge(bwmem::Pool::decode, 500);
+            CHECK(bwmem::stats(bwmem::Pool::decode).peak >= before.current + 1500);
+        }
+        NDArray arr(10, 4);
+        CHECK(bwmem::stats(bwmem::Pool::outputs).current >= arr.nbytes());
+    }
+    CHECK(bwmem::stats(bwmem::Pool::decode).current == before.current);
+    CHECK(bwmem::stats(bwmem::Pool::decode).allocations == before.allocations + 2);
+
+    std::vector<bwmem::StageReport> stages = bwmem::stages();
+    REQUIRE(!stages.empty());
+    const bwmem::StageReport& stage = stages.back();
+    CHECK(stage.name == "accounting test");
+    CHECK(stage.pool_peaks[int(bwmem::Pool::decode)] == before.current + 1500);
+    CHECK(stage.pool_peaks[int(bwmem::Pool::outputs)] >= 10 * 4 * sizeof(double));
+    CHECK(stage.peak_rss >= stage.end_rss);
+    CHECK(stage.end_rss > 0);
+
+    bwmem::write_json("mem_report.json");
+    std::ifstream json_F("mem_report.json");
+    std::stringstream json;
+    json << json_F.rdbuf();
+    CHECK(json.str().find("\"name\": \"accounting test\"") != std::string::npos);
+    CHECK(json.str().find("\"serialization\": {\"peak_bytes\": ") != std::string::npos);
+}
+
+TEST_CASE("plain and gzipped BED coordinates") {
+    std::map<std::string, int> chrom_sizes = parse_chrom_sizes((DATA_DIR / "toy.chrom.sizes").string());
+    // out of order, a header, a space-separated and a CRLF line, one past chr2's end and one on an unknown chromosome
+    const std::string bed = "track name=peaks\n"
+                            "# comment\n"
+                            "chr1\t6\t10\tpeak1\t0\t.\t5.0\t-1\t-1\t2\n"
+                            "chr1\t0\t4\tpeak2\t0\t.\t5.0\t-1\t-1\t1\n"
+                            "chr2 1 3\r\n"
+                            "\n"
+                            "chr2\t2\t99\n"
+                            "chrUn\t0\t5\n"
+                            "chr1\t0\t2";
+    {
+        std::ofstream bed_F("coords.narrowPeak");
+        bed_F << bed;
+    }
+    gzFile gz = gzopen("coords.bed.gz", "wb");
+    gzwrite(gz, bed.data(), bed.size());
+    gzclose(gz);
+
+    for (const std::string path : {"coords.narrowPeak", "coords.bed.gz"}) {
+        chroms_coords_map_t coords = parse_coords_bed(path, chrom_sizes);
+        REQUIRE(coords.size() == 2);
+        const IntervalIndex& chr1 = coords.at("chr1");
+        REQUIRE(chr1.size() == 3);
+        CHECK((std::vector<uint64_t>{chr1.start(0), chr1.start(1), chr1.start(2)}) == std::vector<uint64_t>{0, 0, 6});
+        CHECK((std::vector<uint64_t>{chr1.end(0), chr1.end(1), chr1.end(2)}) == std::vector<uint64_t>{2, 4, 10});
+        const IntervalIndex& chr2 = coords.at("chr2");
+        REQUIRE(chr2.size() == 2);
+        CHECK(chr2.start(1) == 2);
+        CHECK(chr2.end(1) == 4);
+    }
+
+    {
+        std::ofstream bed_F("bad.bed");
+        bed_F << "chr1\t0\t4\nchr1\tzero\t4\n";
+    }
+    CHECK_THROWS_WITH_AS(parse_coords_bed("bad.bed", chrom_sizes), doctest::Contains("line 2"), std::invalid_argument);
+    CHECK_THROWS_AS(parse_coords_bigBed("coords.narrowPeak", chrom_sizes), std::runtime_error);
+    // as the CLI's -c goes, through parse_chrom_sizes_coords; main reports these as errors
+    const std::string chrom_sizes_path = (DATA_DIR / "toy.chrom.sizes").string();
+    CHECK_THROWS_AS(parse_chrom_sizes_coords(chrom_sizes_path, "nonexistent.bed"), std::runtime_error);
+    CHECK_THROWS_WITH_AS(parse_chrom_sizes_coords(chrom_sizes_path, "bad.bed"), doctest::Contains("line 2"), std::invalid_argument);
+    CHECK_THROWS_AS(BWBinner(find_paths_filetype(DATA_DIR, ".bw"), chrom_sizes_path, "nonexistent.bed"), std::runtime_error);
+
+    // only the chromosomes with intervals are binned
+    std::vector<std::string> bw_paths = find_paths_filetype(DATA_DIR, ".bw");
+    BWBinner binner(bw_paths, (DATA_DIR / "toy.chrom.sizes").string(), "coords.narrowPeak");
+    const std::map<std::string, NDArray>& binned = binner.load_bin_all_chroms(2);
+    REQUIRE(binned.size() == 2);
+    // chr1: bins [0, 2) of [0, 2), [0, 4) and [6, 10)
+    CHECK(binned.at("chr1").rows() == 1 + 2 + 2);
+    // chr2: [1, 3) covers no whole bin, [2, 4) once clipped one
+    CHECK(binned.at("chr2").rows() == 1);
+}
+
+TEST_CASE("coalesced fetches of overlapping and nearby intervals") {
+    {
+        std::ofstream bed_F("coalesced.bed");
+        bed_F << "chr1\t0\t6\nchr1\t2\t10\nchr1\t8\t10\nchr3\t0\t2\nchr3\t4\t6\n";
+    }
+    std::vector<std::string> bw_paths ({ (DATA_DIR / "test_sequential_missing.bw").string() });
+    std::vector<double> chr3_uncoalesced;
+    // 0 only coalesces the overlapping chr1 intervals, 2 also the chr3 ones a bin apart
+    for (unsigned gap : {0u, 2u, 100u}) {
+        CAPTURE(gap);
+        BWBinner binner(bw_paths, (DATA_DIR / "toy.chrom.sizes").string(), "coalesced.bed");
+        binner.coalesce_fetches(gap);
+        const std::map<std::string, NDArray>& binned = binner.load_bin_all_chroms(2);
+
+        // chr1 bins: 0 0.5 2.5 NaN 0.5, each interval's rows in order of their starts
+        const NDArray& chr1 = binned.at("chr1");
+        REQUIRE(chr1.rows() == 3 + 4 + 1);
+        std::vector<double> expected {0, 0.5, 2.5, 0.5, 2.5, std::nan(""), 0.5, 0.5};
+        for (size_t row = 0; row < expected.size(); row++) {
+            CAPTURE(row);
+            if (std::isnan(expected[row]))
+                CHECK(std::isnan(chr1.data<double>()[row]));
+            else
+                CHECK(chr1.data<double>()[row] == expected[row]);
+        }
+
+        const NDArray& chr3 = binned.at("chr3");
+        REQUIRE(chr3.rows() == 2);
+        std::vector<double> chr3_vals(chr3.data<double>(), chr3.data<double>() + 2);
+        if (gap == 0)
+            chr3_uncoalesced = chr3_vals;
+        else
+            CHECK(chr3_vals == chr3_uncoalesced);
+    }
+}
+
+TEST_CASE("summit-centred regions") {
+    std::map<std::string, int> chrom_sizes = parse_chrom_sizes((DATA_DIR / "toy.chrom.sizes").string());
+    {
+        std::ofstream bed_F("summits.narrowPeak");
+        bed_F << "chr2\t0\t4\tp3\t0\t.\t5.0\t-1\t-1\t-1\n"
+                 "chr1\t0\t10\tp1\t0\t.\t5.0\t-1\t-1\t3\n"
+                 "chr1\t4\t8\n"
+                 "chrUn\t0\t10\tpUn\t0\t.\t5.0\t-1\t-1\t3\n"
+                 "chr1\t8\t10\tp4\t0\t.\t5.0\t-1\t-1\t1\n"
+                 "chr3\t0\t2\tp5\t0\t.\t5.0\t-1\t-1\t0\n";
+    }
+    std::vector<BedRegion> regions = parse_regions_bed("summits.narrowPeak", chrom_sizes);
+    REQUIRE(regions.size() == 5);
+    CHECK(regions[0].chrom == "chr2");
+    CHECK(regions[0].summit == 2);
+    CHECK(regions[1].summit == 3);
+    CHECK(regions[2].summit == 6);
+    CHECK(regions[2].name == ".");
+    CHECK(regions[3].summit == 9);
+    CHECK(regions[4].name == "p5");
+
+    // summit offsets are -1 or within the peak: not -2, not at its end, and not one that wraps around 2^32
+    for (const std::string offset : {"-2", "2", "4294967296"}) {
+        CAPTURE(offset);
+        {
+            std::ofstream bed_F("bad_summit.narrowPeak");
+            bed_F << "chr1\t0\t2\tp1\t0\t.\t5.0\t-1\t-1\t0\n"
+                     "chr1\t0\t2\tp2\t0\t.\t5.0\t-1\t-1\t" << offset << "\n";
+        }
+        CHECK_THROWS_WITH_AS(parse_regions_bed("bad_summit.narrowPeak", chrom_sizes), doctest::Contains("line 2"),
+                             std::invalid_argument);
+    }
+
+    std::vector<std::string> bw_paths ({ (DATA_DIR / "test_sequential_missing.bw").string() });
+    BWBinner binner(bw_paths, (DATA_DIR / "toy.chrom.sizes").string());
+    CHECK_THROWS_AS(binner.bin_regions(regions, 4, 3), std::invalid_argument);
+    NDArray windows = binner.bin_regions(regions, 2, 2);
+    REQUIRE(windows.rows() == 5 * 2);
+    REQUIRE(windows.cols() == 1);
+    // chr1: 0 N 0 1 2 3 N N 0 1, chr2: 0 1 2 3; bins not wholly on the chromosome are NaN
+    const double* vals = windows.data<double>();
+    std::vector<double> expected {0.5, 2.5, 0, 1.5, 2.5, std::nan(""), 0, std::nan(""), std::nan("")};
+    for (size_t row = 0; row < expected.size(); row++) {
+        CAPTURE(row);
+        if (std::isnan(expected[row]))
+            CHECK(std::isnan(vals[row]));
+        else
+            CHECK(vals[row] == expected[row]);
+    }
+
+    binner.save_regions("regions_out", regions, windows, 2, 2, NpyDtype::float32);
+    NpyArray saved = read_npy("regions_out/regions.npy");
+    CHECK(saved.shape == std::vector<size_t>{5, 2, 1});
+    CHECK(saved.descr == "<f4");
+    std::ifstream index_F("regions_out/regions_index.tsv");
+    std::string line;
+    std::getline(index_F, line);
+    std::getline(index_F, line);
+    CHECK(line == "0\tchr2\t2\t0\t4\tp3");
+    for (int i = 0; i < 4; i++)
+        std::getline(index_F, line);
+    CHECK(line == "4\tchr3\t0\t-2\t2\tp5");
+    CHECK(std::filesystem::exists("regions_out/manifest.tsv"));
+}
+
+TEST_CASE("interval set algebra and excluded regions") {
+    auto as_pairs = [](const std::vector<Interval>& intervals) {
+        std::vector<std::pair<uint64_t, uint64_t>> pairs;
+        for (const Interval& interv : intervals)
+            pairs.emplace_back(interv.start, interv.end);
+        return pairs;
+    };
+    using Pairs = std::vector<std::pair<uint64_t, uint64_t>>;
+    IntervalSet a = normalize_intervals({{5, 8}, {0, 2}, {2, 3}, {7, 9}, {4, 4}});
+    CHECK(as_pairs(a) == Pairs{{0, 3}, {5, 9}});
+    CHECK(as_pairs(union_intervals(a, {{3, 4}, {10, 12}})) == Pairs{{0, 4}, {5, 9}, {10, 12}});
+    CHECK(as_pairs(intersect_intervals(a, {{2, 6}, {8, 20}})) == Pairs{{2, 3}, {5, 6}, {8, 9}});
+    // overlapping intervals each keep their own pieces
+    CHECK(as_pairs(subtract_intervals({{0, 10}, {2, 4}}, {{1, 3}, {6, 7}})) == Pairs{{0, 1}, {3, 4}, {3, 6}, {7, 10}});
+
+    {
+        std::ofstream bed_F("exclude.bed");
+        bed_F << "chr1\t3\t5\nchr2\t0\t4\n";
+    }
+    std::vector<std::string> bw_paths ({ (DATA_DIR / "test_sequential_missing.bw").string() });
+    auto check_rows = [](const NDArray& arr, const std::vector<double>& expected) {
+        REQUIRE(arr.rows() == expected.size());
+        for (size_t row = 0; row < expected.size(); row++) {
+            CAPTURE(row);
+            if (std::isnan(expected[row]))
+                CHECK(std::isnan(arr.data<double>()[row]));
+            else
+                CHECK(arr.data<double>()[row] == expected[row]);
+        }
+    };
+
+    // chr1: 0 N 0 1 2 3 N N 0 1 less [3, 5) is [0, 3) and [5, 10), of whole bins [0, 2), [6, 8) and [8, 10);
+    // all of chr2 is excluded
+    BWBinner dropping(bw_paths, (DATA_DIR / "toy.chrom.sizes").string());
+    dropping.exclude("exclude.bed", ExcludeMode::drop);
+    const std::map<std::string, NDArray>& dropped = dropping.load_bin_all_chroms(2);
+    CHECK(dropped.size() == 2);
+    CHECK(dropped.count("chr2") == 0);
+    check_rows(dropped.at("chr1"), {0, std::nan(""), 0.5});
+
+    // the bins overlapping [3, 5) are NaN, not fetched
+    BWBinner masking(bw_paths, (DATA_DIR / "toy.chrom.sizes").string());
+    masking.exclude("exclude.bed", ExcludeMode::mask);
+    const std::map<std::string, NDArray>& masked = masking.load_bin_all_chroms(2);
+    check_rows(masked.at("chr1"), {0, std::nan(""), std::nan(""), std::nan(""), 0.5});
+    check_rows(masked.at("chr2"), {std::nan(""), std::nan("")});
+
+    // of several intervals, only [2, 6) meets [3, 5): the others are binned whole and unmasked
+    {
+        std::ofstream bed_F("exclude_coords.bed");
+        bed_F << "chr1\t0\t2\nchr1\t2\t6\nchr1\t6\t10\nchr3\t0\t7\n";
+    }
+    BWBinner dropping_coords(bw_paths, (DATA_DIR / "toy.chrom.sizes").string(), "exclude_coords.bed");
+    dropping_coords.exclude("exclude.bed", ExcludeMode::drop);
+    const std::map<std::string, NDArray>& dropped_coords = dropping_coords.load_bin_all_chroms(2);
+    // [2, 6) less [3, 5) is [2, 3) and [5, 6), without a whole bin
+    check_rows(dropped_coords.at("chr1"), {0, std::nan(""), 0.5});
+    check_rows(dropped_coords.at("chr3"), {0, 0, 1.5});
+
+    BWBinner masking_coords(bw_paths, (DATA_DIR / "toy.chrom.sizes").string(), "exclude_coords.bed");
+    masking_coords.exclude("exclude.bed", ExcludeMode::mask);
+    const std::map<std::string, NDArray>& masked_coords = masking_coords.load_bin_all_chroms(2);
+    check_rows(masked_coords.at("chr1"), {0, std::nan(""), std::nan(""), std::nan(""), 0.5});
+    check_rows(masked_coords.at("chr3"), {0, 0, 1.5});
+}
+
+TEST_CASE("interval index") {
+    static_assert(!std::is_copy_constructible_v<IntervalIndex> && std::is_nothrow_move_constructible_v<IntervalIndex>);
+
+    // sorted by start then end, the empty interval left out; past 2^32 bp
+    IntervalIndex index({{10, 20}, {0, 5}, {7, 7}, {0, 3}, {5'000'000'000, 5'000'000'010}});
+    REQUIRE(index.size() == 4);
+    CHECK(index.start(0) == 0);
+    CHECK(index.end(0) == 3);
+    CHECK(index.end(1) == 5);
+    CHECK(index.start(3) == 5'000'000'000);
+    // whole bins of 2: [0, 2) | [0, 4) | [10, 20) | [5e9, 5e9 + 10)
+    CHECK(index.start_bins(2) == std::vector<unsigned>{0, 1, 3, 8, 13});
+
+    std::mt19937 rng(50);
+    std::uniform_int_distribution<uint64_t> pos(0, 1000), len(0, 60);
+    std::vector<Interval> intervals(300);
+    for (Interval& interv : intervals) {
+        interv.start = pos(rng);
+        interv.end = interv.start + len(rng);
+    }
+    IntervalIndex random(intervals);
+    for (int q = 0; q < 200; q++) {
+        uint64_t start = pos(rng), end = start + len(rng);
+        CAPTURE(start);
+        CAPTURE(end);
+        std::vector<size_t> expected;
+        for (size_t i = 0; i < random.size(); i++)
+            if (random.start(i) < end && start < random.end(i))
+                expected.push_back(i);
+        CHECK(random.overlapping(start, end) == expected);
+    }
+    // [2, 4) overlaps [0, 3) and [0, 5), [20, 30) nothing, [5e9 + 9, 5e9 + 20) the last
+    CHECK(index.overlapped_by({{2, 4}, {20, 30}, {5'000'000'009, 5'000'000'020}}) == std::vector<char>{1, 1, 0, 1});
+
+    // the moved-from index, and binner, own nothing
+    IntervalIndex moved(std::move(random));
+    CHECK(moved.size() == 300 - size_t(std::count_if(intervals.begin(), intervals.end(),
+                                                     [](const Interval& i) { return i.start == i.end; })));
+    BWBinner binner({ (DATA_DIR / "test_sequential_missing.bw").string() }, (DATA_DIR / "toy.chrom.sizes").string());
+    BWBinner moved_binner(std::move(binner));
+    CHECK(moved_binner.load_bin_all_chroms(2).at("chr2").rows() == 2);
+}